@@ -2,6 +2,19 @@
 #define __NOSHELL_H__
 
 #include <noshell/noshell.hpp>
+#include <noshell/fan_in.hpp>
+#include <noshell/graph.hpp>
+#include <noshell/records.hpp>
+#include <noshell/parallel.hpp>
+#include <noshell/coprocess.hpp>
+#include <noshell/builtin.hpp>
+#include <noshell/static_pipeline.hpp>
+#include <noshell/xargs.hpp>
+#include <noshell/template.hpp>
+#include <noshell/trace.hpp>
+#include <noshell/metrics.hpp>
+#include <noshell/fork_exclusions.hpp>
+#include <noshell/spawn_policy.hpp>
 #ifndef NOSHELL_NO_LITERALS
 using namespace noshell::literal;
 #endif
@@ -0,0 +1,34 @@
+#ifndef __NOSHELL_BUILTIN_H__
+#define __NOSHELL_BUILTIN_H__
+
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+// Built-in versions of some trivial coreutils. They are function
+// stages (see stage_function): the child is forked but does not exec
+// a program, and the data is moved with splice(2) and tee(2) when the
+// file descriptors allow it. They return a pipeline and can be used
+// anywhere a command goes:
+//
+// noshell::Exit e = "zcat"_C("data.gz") | noshell::builtin::head(10) > "top";
+//
+// Like coreutils, they exit with status 1 on error (with a message on
+// stderr), and are killed by SIGPIPE if their output is closed.
+namespace builtin {
+// Copy the files (or standard input if none, or for "-") to standard output
+PipeLine cat(std::vector<std::string> files = std::vector<std::string>());
+// Copy standard input to standard output and to the files
+PipeLine tee(std::vector<std::string> files, bool append = false);
+// Copy the first lines of standard input to standard output
+PipeLine head(size_t lines);
+// Copy the first bytes of standard input to standard output
+PipeLine head_bytes(size_t bytes);
+// Output the number of lines of standard input
+PipeLine wc_l();
+// Copy standard input into files of the given number of lines, named
+// prefix followed by aa, ab, etc.
+PipeLine split(size_t lines, std::string prefix = "x");
+} // namespace builtin
+} // namespace noshell
+
+#endif /* __NOSHELL_BUILTIN_H__ */
@@ -0,0 +1,119 @@
+#ifndef __NOSHELL_COPROCESS_H__
+#define __NOSHELL_COPROCESS_H__
+
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+// How requests and responses are delimited on the pipes to a
+// co-process.
+struct framing {
+  enum framing_type {
+    DELIMITER,     // Request and response terminated by a delimiter character
+    LENGTH_PREFIX, // Request and response preceded by their length, big-endian
+    SENTINEL       // Request terminated by a newline, response terminated by a line equal to the sentinel
+  };
+  framing_type type;
+  size_t       size;     // Size of the length (1, 2, 4 or 8) for LENGTH_PREFIX
+  char         delim;    // For DELIMITER
+  std::string  sentinel; // For SENTINEL
+  size_t       max;      // Longest response accepted, see CoProcess::request()
+
+  static const size_t default_max = (size_t)1 << 30;
+
+  static framing delimiter(char d = '\n') { return framing{DELIMITER, 0, d, std::string(), default_max}; }
+  static framing length_prefix(size_t s = 4) {
+    assert(s == 1 || s == 2 || s == 4 || s == 8);
+    return framing{LENGTH_PREFIX, s, '\0', std::string(), default_max};
+  }
+  static framing sentinel_line(const std::string& s) { return framing{SENTINEL, 0, '\n', s, default_max}; }
+  // Same framing, accepting responses of at most m bytes
+  framing max_size(size_t m) const { return framing{type, size, delim, sentinel, m}; }
+
+  // False for a length prefix of an unsupported size
+  bool valid() const { return type != LENGTH_PREFIX || size == 1 || size == 2 || size == 4 || size == 8; }
+  // False if the length of a request of len bytes does not fit in the prefix
+  bool fits(size_t len) const { return type != LENGTH_PREFIX || size >= sizeof(uint64_t) || ((uint64_t)len >> (8 * size)) == 0; }
+};
+
+// A long-lived pipeline with its stdin and stdout connected to the
+// current process, which answers one response per request. It avoids
+// paying for the start of an expensive program at every call. For
+// example:
+//
+// noshell::CoProcess bc([]() { return "bc"_C("-l"); });
+// std::string res;
+// if(bc.request("s(1)", res)) ...
+//
+// The pipeline is started by the constructor, and restarted by the
+// next request if it exits. A CoProcess is not thread safe, see
+// CoProcessPool.
+class CoProcess {
+  pipeline_factory  factory;
+  framing           frame;
+  Exit              status;
+  int               in_fd, out_fd;      // Parent ends of the pipes
+  bool              alive;              // Started and not waited for
+  std::vector<char> buffer;
+  size_t            data_start, data_end; // Unread data in buffer
+  size_t            scanned;            // Bytes after data_start known not to end a response
+  size_t            starts;
+  int               error_;
+
+  bool start();
+  int exchange(const char* data, size_t len, std::string& response);
+  int parse_response(std::string& response);
+  bool read_response();
+  int too_long() { error_ = EMSGSIZE; return -1; }
+
+public:
+  CoProcess(pipeline_factory f, framing fr = framing::delimiter());
+  ~CoProcess() { stop(); }
+
+  // Send a request and wait for its response. Return false if the
+  // co-process failed to start or exited before answering, or if the
+  // request is too long for the length prefix or the response longer
+  // than the framing max (error() is EMSGSIZE, and the co-process is
+  // stopped in the latter case).
+  bool request(const char* data, size_t len, std::string& response);
+  bool request(const std::string& req, std::string& response) { return request(req.data(), req.size(), response); }
+
+  // Close the pipes and wait for the co-process to exit.
+  void stop();
+  bool running() const { return alive; }
+  // Exit status of the last co-process, once stopped.
+  Exit& exit() { return status; }
+  // Number of times the co-process was restarted
+  size_t restarts() const { return starts > 0 ? starts - 1 : 0; }
+  // errno value of the last failure, 0 if none
+  int error() const { return error_; }
+};
+
+// A pool of identical co-processes. Requests may be sent concurrently
+// from many threads, and each is dispatched to the least busy
+// co-process.
+class CoProcessPool {
+  struct slot {
+    CoProcess  process;
+    size_t     busy; // Requests in progress or waiting on this co-process
+    std::mutex lock;
+    slot(const pipeline_factory& f, const framing& fr) : process(f, fr), busy(0) { }
+  };
+  std::vector<std::unique_ptr<slot>> slots;
+  std::mutex                         mutex;
+
+public:
+  CoProcessPool(size_t n, pipeline_factory f, framing fr = framing::delimiter());
+
+  bool request(const char* data, size_t len, std::string& response);
+  bool request(const std::string& req, std::string& response) { return request(req.data(), req.size(), response); }
+
+  size_t size() const { return slots.size(); }
+  CoProcess& operator[](size_t i) { return slots[i]->process; }
+};
+} // namespace noshell
+
+#endif /* __NOSHELL_COPROCESS_H__ */
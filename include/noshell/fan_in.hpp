@@ -0,0 +1,52 @@
+#ifndef __NOSHELL_FAN_IN_H__
+#define __NOSHELL_FAN_IN_H__
+
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+// Merge the standard outputs of many pipelines into a single
+// stream. The input pipelines run in parallel and their outputs are
+// multiplexed (with poll() and splice()) by a single stage forked
+// from the current process, without exec'ing a `cat` or equivalent
+// program. This stage is the first command of the pipeline returned
+// by the pipeline() method. For example, `(zcat a.gz & zcat b.gz) |
+// sort` would be:
+//
+// noshell::FanIn f(noshell::FanIn::LINES);
+// f.add("zcat"_C("a.gz")).add("zcat"_C("b.gz"));
+// noshell::Exit e = f.pipeline() | "sort"_C();
+//
+// The Exit of the input pipelines are in the attached member of the
+// Handle of the merging stage (e[0].attached[i] in the above example).
+class FanIn {
+public:
+  enum merge_type {
+    CONCAT,  // Output of each pipeline in turn, in the order added
+    LINES,   // Whole lines, from any pipeline as they are available. A missing last newline is added
+    RECORDS  // Fixed size records, from any pipeline as they are available
+  };
+
+private:
+  std::vector<std::shared_ptr<PipeLine>> inputs;
+  merge_type                             type;
+  size_t                                 record_size;
+
+public:
+  explicit FanIn(merge_type t = LINES, size_t rs = 1)
+    : type(t)
+    , record_size(std::max(rs, (size_t)1))
+  { }
+
+  FanIn& add(PipeLine&& pl) {
+    inputs.push_back(std::make_shared<PipeLine>(std::move(pl)));
+    return *this;
+  }
+  size_t size() const { return inputs.size(); }
+
+  // Pipeline made of the merging stage. It can be called multiple
+  // times, every run of the returned pipelines runs all the inputs.
+  PipeLine pipeline() const;
+};
+} // namespace noshell
+
+#endif /* __NOSHELL_FAN_IN_H__ */
@@ -0,0 +1,39 @@
+#ifndef __NOSHELL_FORK_EXCLUSIONS_H__
+#define __NOSHELL_FORK_EXCLUSIONS_H__
+
+#include <cstddef>
+
+namespace noshell {
+// Large memory regions of the parent which the children never use. On
+// fork, the kernel copies the page tables of the whole parent, which
+// takes milliseconds for tens of GB. The regions registered here are
+// advised MADV_DONTFORK (not mapped in the child) or MADV_WIPEONFORK
+// (mapped and zeroed in the child, private anonymous memory only)
+// around each fork done by noshell, then restored. For example, for a
+// large index used by the parent only:
+//
+// noshell::fork_exclusions::add(index.data(), index.size());
+//
+// A stage function or a setup touching a DONTFORK region gets
+// SIGSEGV. Only the pages fully inside a region are excluded. The
+// advice is applied when the first of concurrent forks starts and
+// restored when the last one is done.
+class fork_exclusions {
+public:
+  enum mode { DONTFORK, WIPEONFORK };
+
+  // Register the region [addr, addr + len). Return false (with errno
+  // set) if the advice is not supported for this region.
+  static bool add(void* addr, size_t len, mode m = DONTFORK);
+  // Unregister the region starting at addr. Return false if not found.
+  static bool remove(void* addr);
+  static size_t size();
+
+  // Around fork(), in the parent: if enter() returns true, leave()
+  // must be called once fork() returned (in the parent only).
+  static bool enter();
+  static void leave();
+};
+} // namespace noshell
+
+#endif /* __NOSHELL_FORK_EXCLUSIONS_H__ */
@@ -0,0 +1,55 @@
+#ifndef __NOSHELL_GRAPH_H__
+#define __NOSHELL_GRAPH_H__
+
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+// Commands connected by pipes between arbitrary file
+// descriptors. Nodes are commands (from C(), _C() or stage()), edges
+// connect a file descriptor of a node to a file descriptor of another
+// node. For example, where the output on file descriptor 3 of `a`
+// goes to `b` and its standard output goes to `c`:
+//
+// noshell::Graph g;
+// auto a = g.add("a"_C());
+// auto b = g.add("b"_C() > "b.out");
+// auto c = g.add("c"_C() > "c.out");
+// g.connect(a, 3, b, 0);
+// g.connect(a, 1, c, 0);
+// noshell::Exit e = g.run_wait();
+//
+// All the pipes are created by run(), all the commands are started
+// concurrently, and the Handle of the node i is e[i].
+class Graph {
+  struct edge {
+    size_t from_node;
+    int    from_fd;
+    size_t to_node;
+    int    to_fd;
+  };
+  std::vector<Command> nodes;
+  std::vector<edge>    edges;
+
+public:
+  // Add the commands of the pipeline as nodes. A pipeline of n
+  // commands adds n nodes with consecutive ids, each connected from
+  // its standard output to the standard input of the next. Returns
+  // the id of the first node.
+  size_t add(PipeLine&& pl);
+  size_t add(Command&& c) {
+    nodes.push_back(std::move(c));
+    return nodes.size() - 1;
+  }
+  size_t size() const { return nodes.size(); }
+
+  // Connect the file descriptor from_fd of node from to the file
+  // descriptor to_fd of node to. Returns false if a node does not
+  // exist or if one of the file descriptors is already connected.
+  bool connect(size_t from, int from_fd, size_t to, int to_fd);
+
+  Exit run();
+  Exit run_wait();
+};
+} // namespace noshell
+
+#endif /* __NOSHELL_GRAPH_H__ */
@@ -6,9 +6,11 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
+#include <signal.h>
 
 #include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <memory>
 #include <cstring>
 #include <noshell/setters.hpp>
@@ -38,9 +40,118 @@ struct Errno {
 };
 
 class Command;
+class Exit;
+
+// A file descriptor to register in an event loop (poll, epoll, asio,
+// libuv, etc.), as returned by native_handles(). The readiness
+// contract is:
+//
+// * PROCESS: a pidfd, readable (POLLIN) once the child exited. Then
+//   Handle::reap() collects its status without blocking.
+// * READ: the parent end of a pipe from the child, readable when data
+//   is available or at end of file.
+// * WRITE: the parent end of a pipe to the child, writable when there
+//   is room in the pipe, or in error (POLLERR) when the child closed
+//   its end.
+//
+// The pipe file descriptors are owned by the caller (they are the ones
+// returned by the redirections, e.g. `| fd`): remove them from the
+// event loop before closing them. Create them with nonblocking_fd so
+// that reading and writing never block.
+struct native_handle {
+  enum handle_type { PROCESS, READ, WRITE };
+  handle_type type;
+  int         fd;
+  int         child_fd; // File descriptor in the child for a pipe, -1 for a pidfd
+};
+
 inline std::chrono::microseconds to_microseconds(const struct timeval& tp) {
   return std::chrono::microseconds((uint64_t)tp.tv_sec * (uint64_t)1000000 + (uint64_t)tp.tv_usec);
 }
+// Resource usage of a running command, sampled from /proc by the
+// monitor. See PipeLine::monitor().
+struct live_resources {
+  long                      rss;         // Resident set size, in kB
+  double                    cpu_percent; // Over the last sampling interval
+  std::chrono::microseconds cpu_time;    // User and system
+  uint64_t                  read_bytes;  // Bytes read and written, including pipes
+  uint64_t                  write_bytes;
+  live_resources() : rss(0), cpu_percent(0), cpu_time(0), read_bytes(0), write_bytes(0) { }
+};
+
+// Limits enforced by the monitor, 0 for no limit. A command going over
+// one of them is sent the signal sig.
+struct resource_budget {
+  enum limit { NONE, RSS, CPU_TIME, WALL_TIME };
+  long                      rss;       // In kB
+  std::chrono::milliseconds cpu_time;
+  std::chrono::milliseconds wall_time;
+  int                       sig;
+  resource_budget() : rss(0), cpu_time(0), wall_time(0), sig(SIGKILL) { }
+};
+struct monitor_slot;
+class resource_monitor;
+
+// Profile of a pipeline, sampled while it runs. See PipeLine::profile().
+struct link_profile { // Pipe from stage i to stage i+1
+  enum fill_state { BALANCED, MOSTLY_EMPTY, MOSTLY_FULL };
+  size_t     capacity;    // Size of the pipe buffer
+  double     mean_fill;   // Average fraction of the capacity filled
+  double     full_ratio;  // Fraction of the samples at least 3/4 full
+  double     empty_ratio; // Fraction of the samples less than 1/8 full
+  size_t     samples;
+  fill_state state;       // Full or empty in more than half of the samples
+  link_profile() : capacity(0), mean_fill(0), full_ratio(0), empty_ratio(0), samples(0), state(BALANCED) { }
+};
+struct stage_profile {
+  std::chrono::microseconds cpu_time;
+  double                    cpu_percent; // Average over the run
+  uint64_t                  write_bytes; // Bytes written (all file descriptors)
+  double                    throughput;  // Estimated, in bytes written per second
+  stage_profile() : cpu_time(0), cpu_percent(0), write_bytes(0), throughput(0) { }
+};
+struct PipelineProfile {
+  std::vector<stage_profile> stages;
+  std::vector<link_profile>  links; // links[i] is between stages[i] and stages[i+1]
+  // The stage reading from a mostly full pipe and writing to a mostly
+  // empty one, -1 if none stands out.
+  ssize_t                    bottleneck;
+  PipelineProfile() : bottleneck(-1) { }
+};
+class pipeline_profiler;
+
+// Data relayed by the parent through a pipe between two commands. See
+// PipeLine::metered().
+struct link_stat {
+  uint64_t                  bytes;
+  std::chrono::microseconds duration;  // From the first to the last byte
+  double                    peak_rate; // Highest rate over 100ms, in MB/s
+  bool                      done;      // End of file, or the reader exited
+  link_stat() : bytes(0), duration(0), peak_rate(0), done(false) { }
+  // Average rate, in MB/s
+  double rate() const { return duration.count() > 0 ? (double)bytes / duration.count() : 0.0; }
+};
+class link_meter;
+
+// Accounting of the cgroup of a pipeline, covering all the processes
+// started in it, descendants of the commands included. See
+// PipeLine::cgroup().
+struct CgroupStats {
+  struct io_device { // One line of io.stat
+    unsigned major, minor;
+    uint64_t rbytes, wbytes, rios, wios;
+  };
+  bool                      valid;       // The cgroup could be read
+  int64_t                   memory_peak; // memory.peak in bytes, -1 without the memory controller
+  std::chrono::microseconds cpu_usage;   // cpu.stat
+  std::chrono::microseconds cpu_user;
+  std::chrono::microseconds cpu_system;
+  std::vector<io_device>    io;          // io.stat, empty without the io controller
+  CgroupStats() : valid(false), memory_peak(-1), cpu_usage(0), cpu_user(0), cpu_system(0) { }
+};
+class cgroup_state;
+class stderr_ring;
+
 typedef std::forward_list<std::unique_ptr<process_setup> > setup_list_type;
 struct Handle {
 
@@ -54,16 +165,32 @@ struct Handle {
   setup_list_type setups;       // setup hooks
   struct rusage   resources;
   std::string     message;      // error message
+  std::vector<std::unique_ptr<Exit>> attached; // Pipelines started along with this command
+  bool            aborted;      // Killed by pipefail_fast because another command failed
+  bool            cached;       // Status restored from the cache, the command did not run
+  std::shared_ptr<const std::vector<std::string>> argv; // Command line (arguments of a stage function), shared with the Command
+  std::chrono::steady_clock::time_point started, ended; // Fork and wait, epoch if unknown
 
-  Handle() : pid(-1), error(NO_ERROR) { }
+  Handle() : pid(-1), error(NO_ERROR), aborted(false), cached(false), pidfd_(-1) { }
   Handle(Handle&& rhs) noexcept
     : pid(rhs.pid)
     , error(rhs.error)
     , data(rhs.data)
     , setups(std::move(rhs.setups))
+    , resources(rhs.resources)
     , message(std::move(rhs.message))
-  { }
+    , attached(std::move(rhs.attached))
+    , aborted(rhs.aborted)
+    , cached(rhs.cached)
+    , argv(std::move(rhs.argv))
+    , started(rhs.started)
+    , ended(rhs.ended)
+    , pidfd_(rhs.pidfd_)
+    , monitor_(std::move(rhs.monitor_))
+    , stderr_(std::move(rhs.stderr_))
+  { rhs.pidfd_ = -1; }
   Handle(Command&& rhs);
+  ~Handle();
 
   bool setup_error() const { return error == SETUP_ERROR; }
   const Errno& err() const { return data.err; }
@@ -75,6 +202,8 @@ struct Handle {
       ((status().exited() && status().exit_status() == 0) ||
        (ignore_sigpipe && status().signaled() && status().term_sig() == SIGPIPE));
   }
+  // Same, and all the attached pipelines succeeded
+  bool success_all(const bool ignore_sigpipe = false) const;
 
   Handle& set_error(error_types et) { error = et; return *this; }
   Handle&& return_error(error_types et) { return std::move(set_error(et)); }
@@ -91,11 +220,46 @@ struct Handle {
   long major_faults() const { return resources.ru_majflt; }
 
   void wait();
+  // Wait at most timeout for the child to exit. Return true if it exited.
+  bool wait_for(std::chrono::milliseconds timeout);
+  // True while the child runs or is not waited for
+  bool running() const { return error == NO_ERROR && pid > 0; }
+  // Send the signal sig to the child (and the attached pipelines), if
+  // still running. Return false if sending failed.
+  bool kill(int sig = SIGTERM);
+  // A pidfd referring to the child, opened on first use. -1 if not
+  // running or not supported. It is closed once the child is waited for.
+  int pidfd();
+  // Collect the status of the child if it exited, without blocking.
+  // Return true if the status (and resources) is available.
+  bool reap() { return wait_for(std::chrono::milliseconds(0)); }
+  // The pidfd (while running) and the parent ends of the pipes to
+  // the child. See native_handle.
+  std::vector<native_handle> native_handles();
+
+  // The last sample of the resource usage of the child, taken while it
+  // was running. All zeros if not monitored.
+  live_resources current_resources() const;
+  // The limit of the budget the child went over, NONE if it did not.
+  resource_budget::limit budget_exceeded() const;
+  // The last bytes the child wrote to its standard error, complete
+  // once waited for. Empty unless started with PipeLine::stderr_tail(),
+  // or if the standard error was redirected.
+  std::string stderr_tail() const;
+
+private:
+  int                           pidfd_;
+  std::shared_ptr<monitor_slot> monitor_;
+  std::shared_ptr<stderr_ring>  stderr_;
+  void close_pidfd();
+  void finish_stderr(); // Collect the end of the standard error once exited
+  friend class Exit;
 };
 
 std::ostream& operator<<(std::ostream& os, const Handle& handle);
 
 class PipeLine;
+class failure_watcher;
 class Failures {
   const std::vector<Handle>& handles;
 
@@ -110,11 +274,12 @@ class Failures {
     typedef Handle& reference;
     typedef ptrdiff_t difference_type;
 
-    iterator(const std::vector<Handle>& h) : it(h.cbegin()), handles(h) { }
+    iterator(const std::vector<Handle>& h) : it(h.cbegin()), handles(h) { skip(); }
     iterator(const std::vector<Handle>& h, handle_iterator i) : it(i), handles(h) { }
     //    iterator(const handle_iterator i) : it(i) { }
     iterator(const iterator& rhs) : it(rhs.it), handles(rhs.handles) { }
-    iterator& operator++() { for(++it; it != handles.cend() && it->success(); ++it) { } return *this; }
+    void skip() { while(it != handles.cend() && it->success_all()) ++it; }
+    iterator& operator++() { ++it; skip(); return *this; }
     iterator operator++(int) { iterator cit(*this); operator++(); return cit; }
     bool operator==(const iterator& rhs) { return it == rhs.it; }
     bool operator!=(const iterator& rhs) { return it != rhs.it; }
@@ -131,14 +296,65 @@ public:
 // Return status of a pipeline
 class Exit {
   std::vector<Handle>                         handles;
+  pid_t                                       group; // Process group of the pipeline, 0 if none
+  bool                                        kill_on_destroy_;
+  std::shared_ptr<failure_watcher>            watcher; // For pipefail_fast
+  std::shared_ptr<resource_monitor>           monitor_; // For PipeLine::monitor
+  std::shared_ptr<pipeline_profiler>          profiler_; // For PipeLine::profile
+  std::shared_ptr<link_meter>                 meter_; // For PipeLine::metered
+  std::shared_ptr<cgroup_state>               cgroup_; // For PipeLine::cgroup
   typedef std::vector<Handle>::const_iterator const_iterator;
 
+  void destroy();
+  void join_watcher(bool stop);
+  void join_monitor();
+  void join_profiler();
+  // Take ownership of link_fds, duplicates of the read ends of the pipes between the commands
+  bool start_profiler(std::chrono::milliseconds interval, std::vector<int>&& link_fds);
+  void join_meter();
+  // Relay from links[i].first to links[i].second, taking ownership of them
+  bool start_meter(std::vector<std::pair<int, int>>&& links);
+  // Open the cgroup at path, or create a sub-cgroup of it if per_exit
+  bool open_cgroup(const std::string& path, bool per_exit);
+  int cgroup_fd() const;
+  // Read the final accounting and remove the cgroup if created by open_cgroup
+  void release_cgroup();
+  // Kill all the processes of the cgroup if created by open_cgroup
+  bool kill_cgroup();
+  // Collect the standard error from fd into a buffer of capacity
+  // bytes, taking ownership of fd. Null if the collector could not
+  // take it.
+  static std::shared_ptr<stderr_ring> collect_stderr(int fd, size_t capacity);
+  void set_stderr(size_t i, std::shared_ptr<stderr_ring>&& ring) { handles[i].stderr_ = std::move(ring); }
+  friend class PipeLine;
+
 public:
-  Exit() = default;
-  Exit(Exit&& rhs) : handles(std::move(rhs.handles)) { }
+  Exit() : group(0), kill_on_destroy_(false) { }
+  Exit(Exit&& rhs)
+    : handles(std::move(rhs.handles)), group(rhs.group), kill_on_destroy_(rhs.kill_on_destroy_), watcher(std::move(rhs.watcher))
+    , monitor_(std::move(rhs.monitor_)), profiler_(std::move(rhs.profiler_))
+    , meter_(std::move(rhs.meter_)), cgroup_(std::move(rhs.cgroup_))
+  {
+    rhs.kill_on_destroy_ = false;
+  }
+  Exit& operator=(Exit&& rhs) {
+    if(this == &rhs) return *this;
+    destroy();
+    handles              = std::move(rhs.handles);
+    group                = rhs.group;
+    kill_on_destroy_     = rhs.kill_on_destroy_;
+    watcher              = std::move(rhs.watcher);
+    monitor_             = std::move(rhs.monitor_);
+    profiler_            = std::move(rhs.profiler_);
+    meter_               = std::move(rhs.meter_);
+    cgroup_              = std::move(rhs.cgroup_);
+    rhs.kill_on_destroy_ = false;
+    return *this;
+  }
   Exit(PipeLine&& pipeline);
+  ~Exit() { destroy(); }
   bool success(const bool ignore_sigpipe = false) const {
-    return std::all_of(handles.begin(), handles.end(), [=](const Handle& h) { return h.success(ignore_sigpipe); });
+    return std::all_of(handles.begin(), handles.end(), [=](const Handle& h) { return h.success_all(ignore_sigpipe); });
   }
   Failures failures() const { return Failures(handles); }
   const Handle& operator[](int i) { return handles[i]; }
@@ -149,9 +365,84 @@ public:
 
 
   void push_handle(Handle&& h) { handles.push_back(std::move(h)); }
-  void wait() { for(auto& h : handles) h.wait(); }
+  void wait();
+  // Wait at most timeout for all the commands to exit. Return true if they did.
+  bool wait_for(std::chrono::milliseconds timeout);
+  // Collect the status of the commands which exited, without
+  // blocking. Return true if all did.
+  bool reap() {
+    bool res = true;
+    for(auto& h : handles)
+      res = h.reap() && res;
+    if(res) wait(); // All exited
+    return res;
+  }
+  // The native handles of all the commands, see native_handle.
+  std::vector<native_handle> native_handles() {
+    std::vector<native_handle> res;
+    for(auto& h : handles) {
+      auto nh = h.native_handles();
+      res.insert(res.end(), nh.begin(), nh.end());
+    }
+    return res;
+  }
+
+  // Send the signal sig to the commands still running. If the
+  // pipeline was started in its own process group (see
+  // PipeLine::process_group()), the signal is sent to the whole group,
+  // including the processes started by the commands. Likewise, SIGKILL
+  // is sent to all the processes of the sub-cgroup created for the
+  // pipeline with cgroup.kill (Linux 5.14), see PipeLine::cgroup(). A
+  // cgroup given as is may be shared, and is not killed.
+  bool kill(int sig = SIGTERM);
+  // Send SIGTERM, wait at most grace for the commands to exit, then
+  // send SIGKILL and wait. Return true if they exited within grace.
+  bool terminate(std::chrono::milliseconds grace);
+  // If true, the commands still running when the Exit object is
+  // destroyed are killed with SIGKILL and waited for. By default,
+  // they are left running.
+  void kill_on_destroy(bool k = true) { kill_on_destroy_ = k; }
+  void set_group(pid_t g) { group = g; }
+  // Watch the commands from a background thread, and send the signal
+  // sig to the ones still running as soon as one fails (exits with a
+  // non-zero status or is killed by a signal, other than SIGPIPE if
+  // ignore_sigpipe). Return false if the watch could not be set up
+  // (no pidfd support). See PipeLine::pipefail_fast().
+  bool watch_failures(bool ignore_sigpipe, int sig);
+  pid_t process_group() const { return group; }
+  // Sample the resource usage of the running commands every interval
+  // from a background thread, and enforce the budget. Return false if
+  // the thread could not be started. See PipeLine::monitor().
+  bool monitor(std::chrono::milliseconds interval, const resource_budget& budget = resource_budget());
+  // Resource usage of all the commands (and attached pipelines), once
+  // waited for. The times and counters are summed, ru_maxrss is the
+  // largest of all.
+  struct rusage total_resources() const;
+  // Profile of the pipeline so far, or when it exited. Empty unless
+  // started with PipeLine::profile().
+  PipelineProfile profile() const;
+  // The status of the pipeline as a JSON object: the success, and for
+  // each command its argv, pid, exit status or signal (or setup error),
+  // wall time if known, full rusage and the attached pipelines.
+  std::string to_json() const;
+  bool write_json(std::ostream& os) const;
+  // Bytes which went through each pipe between the commands, so far
+  // or when the pipeline exited. Empty unless started with
+  // PipeLine::metered().
+  std::vector<link_stat> link_stats() const;
+  // Accounting of the cgroup of the pipeline, read when it was waited
+  // for, or so far if still running. Not valid unless started with
+  // PipeLine::cgroup().
+  CgroupStats cgroup_stats() const;
+  // Path of the cgroup of the pipeline, empty if none.
+  std::string cgroup_path() const;
 };
 
+inline bool Handle::success_all(const bool ignore_sigpipe) const {
+  return success(ignore_sigpipe) &&
+    std::all_of(attached.begin(), attached.end(), [=](const std::unique_ptr<Exit>& e) { return e->success(ignore_sigpipe); });
+}
+
 inline std::ostream& operator<<(std::ostream& os, const Exit& exit) {
   auto it = exit.begin();
   if(it != exit.end()) {
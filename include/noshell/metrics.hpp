@@ -0,0 +1,85 @@
+#ifndef __NOSHELL_METRICS_H__
+#define __NOSHELL_METRICS_H__
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace noshell {
+// Counters of the whole process, always on: the spawn path only does
+// a few relaxed atomic increments. For example, to expose them to
+// Prometheus:
+//
+// noshell::metrics().write_prometheus(std::cout);
+//
+// Commands started with Command::run (and the pipelines and graphs
+// built on it) and Template::run are counted. The file descriptors
+// held are the ones opened by the redirections (files and pipes) and
+// not yet closed by the parent.
+struct metrics_snapshot {
+  uint64_t                              spawns;            // Commands started
+  uint64_t                              spawn_failures;
+  std::vector<std::pair<int, uint64_t>> failures_by_errno; // Errno with a non zero count
+  std::vector<double>                   latency_bounds;    // Upper bounds of the buckets, in seconds
+  std::vector<uint64_t>                 latency_buckets;   // Not cumulative, the last one is +Inf
+  double                                latency_sum;       // In seconds
+  int64_t                               running;           // Started and not yet waited for
+  int64_t                               fds_held;
+  uint64_t                              reaped;            // Children waited for
+};
+
+class metrics_registry {
+public:
+  static constexpr size_t nb_errnos  = 256;
+  static constexpr size_t nb_buckets = 12; // 11 bounds and +Inf
+  // Upper bounds of the exec latency buckets, in nanoseconds
+  static constexpr int64_t bounds[nb_buckets - 1] = {
+    50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000
+  };
+
+  // Time from fork to exec (or to the start of a stage function)
+  void spawned(std::chrono::nanoseconds exec_latency) {
+    const int64_t ns = exec_latency.count();
+    size_t        i  = 0;
+    while(i < nb_buckets - 1 && ns > bounds[i]) ++i;
+    spawns_.fetch_add(1, std::memory_order_relaxed);
+    running_.fetch_add(1, std::memory_order_relaxed);
+    latency_buckets_[i].fetch_add(1, std::memory_order_relaxed);
+    latency_sum_.fetch_add(ns, std::memory_order_relaxed);
+  }
+  void spawn_failed(int err) {
+    spawn_failures_.fetch_add(1, std::memory_order_relaxed);
+    failures_by_errno_[(size_t)err < nb_errnos ? err : 0].fetch_add(1, std::memory_order_relaxed);
+  }
+  void reaped() {
+    reaped_.fetch_add(1, std::memory_order_relaxed);
+    running_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  void fd_opened() { fds_held_.fetch_add(1, std::memory_order_relaxed); }
+  void fd_closed() { fds_held_.fetch_sub(1, std::memory_order_relaxed); }
+
+  metrics_snapshot snapshot() const;
+  // Text exposition format of Prometheus
+  bool write_prometheus(std::ostream& os) const;
+
+private:
+  std::atomic<uint64_t> spawns_;
+  std::atomic<uint64_t> spawn_failures_;
+  std::atomic<uint64_t> failures_by_errno_[nb_errnos]; // 0 for errno out of range
+  std::atomic<uint64_t> latency_buckets_[nb_buckets];
+  std::atomic<int64_t>  latency_sum_; // In nanoseconds
+  std::atomic<int64_t>  running_;
+  std::atomic<int64_t>  fds_held_;
+  std::atomic<uint64_t> reaped_;
+};
+
+// Zero initialized before any constructor runs
+extern metrics_registry global_metrics;
+inline metrics_registry& metrics() { return global_metrics; }
+} // namespace noshell
+
+#endif /* __NOSHELL_METRICS_H__ */
@@ -9,6 +9,7 @@
 #include <forward_list>
 #include <set>
 #include <memory>
+#include <functional>
 #include <initializer_list>
 
 #include <noshell/setters.hpp>
@@ -16,10 +17,41 @@
 
 namespace noshell {
 typedef std::forward_list<std::unique_ptr<process_setter> > setter_list_type;
+
+// A function run in a forked child instead of exec'ing a program. It
+// is passed the command line and its return value is the exit status
+// of the child. The child terminates with _exit(): it should write
+// directly to its file descriptors rather than to buffered stdio or
+// C++ streams.
+typedef std::function<int(const std::vector<std::string>&)> stage_function;
+
+class PipeLine;
+// A pipeline started along with a command and connected to it by a
+// pipe. The child sees its end of the pipe on the file descriptor
+// <fd>, and if <arg> is not -1, the argument <arg> of the command
+// line is replaced by "/dev/fd/<fd>".
+struct attached_pipeline {
+  std::shared_ptr<PipeLine> pipeline;
+  bool                      input; // true if the child reads the output of the pipeline
+  ssize_t                   arg;
+  int                       fd;
+  attached_pipeline(std::shared_ptr<PipeLine> p, bool i, ssize_t a = -1)
+    : pipeline(std::move(p)), input(i), arg(a), fd(-1) { }
+};
+
+// Options of PipeLine::cacheable().
+struct cache_options {
+  std::string              dir;    // Cache directory, $XDG_CACHE_HOME/noshell or ~/.cache/noshell if empty
+  std::vector<std::string> env;    // Names of the environment variables which are part of the key
+  std::vector<std::string> inputs; // Other input files of the commands (named in the arguments for example)
+};
+
 class Command {
-  std::vector<std::string> cmd;
-  setter_list_type         setters;
-  setup_list_type          setups;
+  std::shared_ptr<const std::vector<std::string>> cmd; // Shared with the Handles
+  stage_function                 fun;
+  std::vector<attached_pipeline> attached;
+  setter_list_type               setters;
+  setup_list_type                setups;
 public:
   std::set<int>            redirected; // Set of redirected file descriptors
 
@@ -28,37 +60,170 @@ public:
   Command(const Command& rhs) = delete;
   Command(Command&& rhs) noexcept
     : cmd(std::move(rhs.cmd))
+    , fun(std::move(rhs.fun))
+    , attached(std::move(rhs.attached))
     , setters(std::move(rhs.setters))
     , setups(std::move(rhs.setups))
     , redirected(std::move(rhs.redirected))
   { }
-  explicit Command(std::vector<std::string>&& c) : cmd(std::move(c)) { }
+  explicit Command(std::vector<std::string>&& c) : cmd(std::make_shared<std::vector<std::string>>(std::move(c))) { }
   template<typename Iterator>
-  Command(Iterator begin, Iterator end) : cmd(begin, end) { }
-  Command(std::initializer_list<std::string> l) : cmd(l) { }
+  Command(Iterator begin, Iterator end) : cmd(std::make_shared<std::vector<std::string>>(begin, end)) { }
+  Command(std::initializer_list<std::string> l) : cmd(std::make_shared<std::vector<std::string>>(l)) { }
+  Command(stage_function f, std::vector<std::string>&& c) : cmd(std::make_shared<std::vector<std::string>>(std::move(c))), fun(std::move(f)) { }
+  Command(std::vector<std::string>&& c, std::vector<attached_pipeline>&& a) : cmd(std::make_shared<std::vector<std::string>>(std::move(c))), attached(std::move(a)) { }
 
   void push_setter(process_setter* setter);
   void push_setup(process_setup* setup);
+  void attach(attached_pipeline&& a) { attached.push_back(std::move(a)); }
+  bool auto_wait() const; // False if any attached pipeline is not automatically waited for
 
   Handle run(process_setup* setup = nullptr);
+  // Run with extra setups, applied after the setups of the redirections
+  Handle run(setup_list_type&& extra);
+  // Same, starting the child in the cgroup open on cgroup_fd
+  Handle run(setup_list_type&& extra, int cgroup_fd);
   Handle run_wait();
+
+private:
+  bool start_attached(Handle& handle);
+  friend class PipeLine;
 };
 
 class PipeLine {
   std::vector<Command> commands;
   bool                 auto_wait;
+  bool                 group; // Run in a new process group
+  int                  fail_fast_sig; // Signal sent by pipefail_fast, 0 if off
+  bool                 fail_fast_ignore_sigpipe;
+  std::shared_ptr<const cache_options> cache; // Set by cacheable()
+  std::chrono::milliseconds monitor_interval; // Set by monitor(), 0 if off
+  resource_budget           budget;
+  std::chrono::milliseconds profile_interval; // Set by profile(), 0 if off
+  bool                      meter; // Set by metered()
+  std::string               cgroup_dir; // Set by cgroup(), empty if off
+  bool                      cgroup_per_exit;
+  size_t                    tail_bytes; // Set by stderr_tail(), 0 if off
+
+  Exit start(int fd_in, int fd_out);
+  Exit run_cached(int fd_in, int fd_out);
 
 public:
-  PipeLine() : auto_wait(true) {
+  PipeLine() : auto_wait(true), group(false), fail_fast_sig(0), fail_fast_ignore_sigpipe(false), monitor_interval(0), profile_interval(0), meter(false), cgroup_per_exit(false), tail_bytes(0) {
     static_assert(std::is_nothrow_move_constructible<Command>::value, "Command must be movable noexcept");
   }
-  PipeLine(Command&& c) : auto_wait(true) { push_command(std::move(c)); }
-  Exit run();
+  PipeLine(Command&& c) : auto_wait(c.auto_wait()), group(false), fail_fast_sig(0), fail_fast_ignore_sigpipe(false), monitor_interval(0), profile_interval(0), meter(false), cgroup_per_exit(false), tail_bytes(0) {
+    push_command(std::move(c));
+  }
+  Exit run() { return run(-1, -1); }
+  // Run with the standard input of the first command from fd_in and
+  // the standard output of the last command to fd_out, unless -1. The
+  // file descriptors are not closed.
+  Exit run(int fd_in, int fd_out);
   Exit run_wait();
   Exit run_wait_auto();
 
   void push_command(Command&& c) { commands.push_back(std::move(c)); }
 
+  // Start all the commands in a new process group, led by the first
+  // command. Exit::kill() then signals the whole group.
+  PipeLine& process_group() & { group = true; return *this; }
+  PipeLine&& process_group() && { group = true; return std::move(*this); }
+  // The commands receive the signal sig when the current thread
+  // exits (PR_SET_PDEATHSIG).
+  PipeLine& death_signal(int sig = SIGKILL) &;
+  PipeLine&& death_signal(int sig = SIGKILL) && { return std::move(death_signal(sig)); }
+  // As soon as one command fails, send the signal sig to the others
+  // instead of letting them run to the end of their input. A command
+  // killed by SIGPIPE is not a failure if ignore_sigpipe. The commands
+  // signaled have their Handle::aborted set. This uses a background
+  // thread per running pipeline, and requires pidfd support (Linux
+  // 5.3): otherwise, the pipeline runs as usual.
+  PipeLine& pipefail_fast(bool ignore_sigpipe = false, int sig = SIGTERM) & {
+    fail_fast_sig            = sig;
+    fail_fast_ignore_sigpipe = ignore_sigpipe;
+    return *this;
+  }
+  PipeLine&& pipefail_fast(bool ignore_sigpipe = false, int sig = SIGTERM) && {
+    return std::move(pipefail_fast(ignore_sigpipe, sig));
+  }
+  // The pipeline is deterministic: its outputs depend only on its
+  // command lines, the input files redirected with '<', the files and
+  // environment variables listed in opts. On the first run, the
+  // standard output and the files redirected with '>' are saved in the
+  // cache directory. The next runs restore them from the cache without
+  // starting any command, and the Exit has the recorded statuses and
+  // resource usage (Handle::cached is true). Only successful runs are
+  // saved. Pipelines whose first command does not read its standard
+  // input from a file, with stages, process substitutions, '>>' or
+  // redirections to file descriptors are not cached, nor are runs with
+  // an explicit fd_in. A cacheable pipeline is waited for by run().
+  PipeLine& cacheable(cache_options opts = cache_options()) & {
+    cache = std::make_shared<const cache_options>(std::move(opts));
+    return *this;
+  }
+  PipeLine&& cacheable(cache_options opts = cache_options()) && { return std::move(cacheable(std::move(opts))); }
+  // Sample the resource usage of the commands every interval while
+  // they run (see Handle::current_resources()), and signal the ones
+  // going over the budget (see Handle::budget_exceeded()). This uses a
+  // background thread per running pipeline, reading /proc.
+  PipeLine& monitor(std::chrono::milliseconds interval, const resource_budget& b = resource_budget()) & {
+    monitor_interval = interval;
+    budget           = b;
+    return *this;
+  }
+  PipeLine&& monitor(std::chrono::milliseconds interval, const resource_budget& b = resource_budget()) && {
+    return std::move(monitor(interval, b));
+  }
+  // Find the bottleneck of a long running pipeline: keep a duplicate
+  // of the read end of each pipe between the commands, and sample
+  // every interval how full they are (FIONREAD) along with the CPU
+  // usage of the commands. See Exit::profile(). A pipe is closed by
+  // the profiler as soon as its reader exits, so the writer still gets
+  // SIGPIPE, up to one interval later if pidfd is not supported.
+  // Profiling changes the behavior of a reader which closes its stdin
+  // early but keeps running: its writer blocks on the full pipe until
+  // the reader exits, instead of getting SIGPIPE right away.
+  PipeLine& profile(std::chrono::milliseconds interval = std::chrono::milliseconds(10)) & {
+    profile_interval = interval;
+    return *this;
+  }
+  PipeLine&& profile(std::chrono::milliseconds interval = std::chrono::milliseconds(10)) && {
+    return std::move(profile(interval));
+  }
+  // Count the bytes going through each pipe between the commands (see
+  // Exit::link_stats()). The parent relays the data from one pipe to
+  // another with splice(2), from a background thread, without copying
+  // it. The relay stops when the pipeline is waited for or its Exit
+  // destroyed: keep the Exit until the commands are done.
+  PipeLine& metered() & { meter = true; return *this; }
+  PipeLine&& metered() && { meter = true; return std::move(*this); }
+  // Start the commands directly in the cgroup v2 whose directory is
+  // path, with clone3(CLONE_INTO_CGROUP) (Linux 5.7), so that they and
+  // all their descendants are accounted for and limited from the
+  // start. If per_exit, each run creates a new sub-cgroup of path
+  // (which must be delegated to the user), removed once the pipeline
+  // is waited for. See Exit::cgroup_stats(). If the cgroup can't be
+  // opened, no command is started and all have a setup error. Stage
+  // functions are forked and moved to the cgroup before they run.
+  PipeLine& cgroup(std::string path, bool per_exit = false) & {
+    cgroup_dir      = std::move(path);
+    cgroup_per_exit = per_exit;
+    return *this;
+  }
+  PipeLine&& cgroup(std::string path, bool per_exit = false) && {
+    return std::move(cgroup(std::move(path), per_exit));
+  }
+  // Keep the last bytes written by each command to its standard error
+  // (see Handle::stderr_tail()). The standard errors are read into
+  // ring buffers by a single background thread for the whole process,
+  // so a command never blocks on a full pipe. Commands redirecting
+  // their standard error are left alone.
+  PipeLine& stderr_tail(size_t bytes = 4096) & { tail_bytes = bytes; return *this; }
+  PipeLine&& stderr_tail(size_t bytes = 4096) && { tail_bytes = bytes; return std::move(*this); }
+
+  friend class Command;
+  friend class Graph;
   friend PipeLine& operator|(PipeLine& p1, PipeLine&& p2);
   template<typename T>
   friend PipeLine& operator|(PipeLine& pl, from_to_ref<T>&& ft);
@@ -75,6 +240,10 @@ public:
   PipeLine&& operator()(F&& fun) &&;
 };
 
+// Create a new pipeline each time a pipeline needs to be started
+// (parallel workers, co-processes restarted after they exit, etc.).
+typedef std::function<PipeLine()> pipeline_factory;
+
 // Structure to create pipeline object. Works with arbitrary number of
 // arguments, either string, const char* or anything that can be
 // transformed to a string with std::to_string.
@@ -87,27 +256,57 @@ inline std::string convert_to_string(char* x) { return std::string(x); }
 template<>
 inline std::string convert_to_string(const char* x) { return std::string(x); }
 
+// Process substitution. As an argument of a command, it is replaced
+// by a path "/dev/fd/N" which is connected to the output (input_of)
+// or the input (output_to) of the pipeline. The pipeline is started
+// along with the command and its Exit is attached to the Handle of
+// the command.
+struct process_substitution {
+  std::shared_ptr<PipeLine> pipeline;
+  bool                      input;
+};
+
+template<typename T>
+inline void push_arg(std::vector<std::string>& cmds, std::vector<attached_pipeline>& attached, T x) {
+  cmds.push_back(convert_to_string(x));
+}
+inline void push_arg(std::vector<std::string>& cmds, std::vector<attached_pipeline>& attached, process_substitution x) {
+  attached.push_back(attached_pipeline(std::move(x.pipeline), x.input, cmds.size()));
+  cmds.push_back(std::string());
+}
+
 template<typename T, typename... Args>
 struct create_pipe {
-  static PipeLine append(std::vector<std::string>& cmds, T x, Args... args) {
-    cmds.push_back(convert_to_string(x));
-    return create_pipe<Args...>::append(cmds, args...);
+  static PipeLine append(std::vector<std::string>& cmds, std::vector<attached_pipeline>& attached, T x, Args... args) {
+    push_arg(cmds, attached, x);
+    return create_pipe<Args...>::append(cmds, attached, args...);
   }
 };
 template<typename T>
 struct create_pipe<T> {
-  static PipeLine append(std::vector<std::string>& cmds, T x) {
-    cmds.push_back(convert_to_string(x));
-    return PipeLine(Command(std::move(cmds)));
+  static PipeLine append(std::vector<std::string>& cmds, std::vector<attached_pipeline>& attached, T x) {
+    push_arg(cmds, attached, x);
+    return PipeLine(Command(std::move(cmds), std::move(attached)));
   }
 };
 
 inline PipeLine C(const std::vector<std::string>& l) { return PipeLine(Command(l.cbegin(), l.cend())); }
+// A pipeline made of a function stage. See stage_function.
+inline PipeLine stage(stage_function f, std::vector<std::string> args = std::vector<std::string>()) {
+  return PipeLine(Command(std::move(f), std::move(args)));
+}
 inline PipeLine C(std::initializer_list<std::string> l) { return PipeLine(Command(l)); }
 template<typename... Args>
 PipeLine C(Args... args) {
-  std::vector<std::string> cmds;
-  return create_pipe<Args...>::append(cmds, args...);
+  std::vector<std::string>       cmds;
+  std::vector<attached_pipeline> attached;
+  return create_pipe<Args...>::append(cmds, attached, args...);
+}
+
+inline process_substitution input_of(PipeLine&& pl) { return process_substitution{std::make_shared<PipeLine>(std::move(pl)), true}; }
+inline process_substitution output_to(PipeLine&& pl) { return process_substitution{std::make_shared<PipeLine>(std::move(pl)), false}; }
+inline bool Command::auto_wait() const {
+  return std::all_of(attached.cbegin(), attached.cend(), [](const attached_pipeline& a) { return a.pipeline->auto_wait; });
 }
 
 
@@ -154,10 +353,11 @@ from_to_generic R(Args... args) {
 // Define a literal operator
 namespace literal {
 struct literal_create_pipe {
-  std::vector<std::string> cmds;
+  std::vector<std::string>       cmds;
+  std::vector<attached_pipeline> attached;
   literal_create_pipe(std::string&& c) { cmds.push_back(std::move(c)); }
   template<typename... Args>
-  PipeLine operator()(Args... args) { return create_pipe<Args...>::append(cmds, args...); }
+  PipeLine operator()(Args... args) { return create_pipe<Args...>::append(cmds, attached, args...); }
   PipeLine operator()() { return PipeLine(Command(std::move(cmds))); }
 };
 inline literal_create_pipe operator"" _C(const char* c, size_t s) { return literal_create_pipe(std::string(c, s)); }
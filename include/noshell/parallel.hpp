@@ -0,0 +1,45 @@
+#ifndef __NOSHELL_PARALLEL_H__
+#define __NOSHELL_PARALLEL_H__
+
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+struct parallel_options {
+  enum worker_type {
+    PER_CHUNK, // One pipeline per chunk, outputs in the order of the input
+    STREAMING  // N long-lived pipelines, each receives many chunks. Outputs
+               // are merged by whole records, in no particular order
+  };
+  worker_type type;
+  char        delim;      // Record delimiter
+  int         out_fd;     // Where to write the outputs
+  size_t      max_buffer; // Maximum output buffered for a chunk waiting for its turn
+  parallel_options(worker_type t = PER_CHUNK)
+    : type(t), delim('\n'), out_fd(1), max_buffer(1 << 22)
+  { }
+};
+
+struct parallel_result {
+  std::vector<Exit> exits; // One per chunk (PER_CHUNK) or per worker (STREAMING)
+  int               error; // errno if reading the input or writing the output failed
+  parallel_result() : error(0) { }
+  bool success(const bool ignore_sigpipe = false) const {
+    return error == 0 && std::all_of(exits.begin(), exits.end(), [=](const Exit& e) { return e.success(ignore_sigpipe); });
+  }
+};
+
+// Equivalent of `parallel --pipe --keep-order`. Split the data read
+// from source_fd into chunks of about chunk_bytes (cut on a record
+// boundary), pipe each chunk through a pipeline created by factory,
+// keeping up to jobs of them running at once, and write the outputs
+// to opts.out_fd in the order of the input. For example:
+//
+// auto res = noshell::parallel_pipe(fd, 1 << 20, 8, []() { return "gzip"_C("-c"); });
+//
+// The memory used is bounded by about jobs * (chunk_bytes +
+// opts.max_buffer).
+parallel_result parallel_pipe(int source_fd, size_t chunk_bytes, size_t jobs, pipeline_factory factory,
+                              const parallel_options& opts = parallel_options());
+} // namespace noshell
+
+#endif /* __NOSHELL_PARALLEL_H__ */
@@ -0,0 +1,156 @@
+#ifndef __NOSHELL_RECORDS_H__
+#define __NOSHELL_RECORDS_H__
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+// A record in the buffer of a Records object. It is valid until the
+// next record is read.
+class record_view {
+  const char* ptr;
+  size_t      len;
+public:
+  record_view() : ptr(nullptr), len(0) { }
+  record_view(const char* p, size_t l) : ptr(p), len(l) { }
+  const char* data() const { return ptr; }
+  size_t size() const { return len; }
+  bool empty() const { return len == 0; }
+  const char* begin() const { return ptr; }
+  const char* end() const { return ptr + len; }
+  char operator[](size_t i) const { return ptr[i]; }
+  std::string str() const { return std::string(ptr, len); }
+  explicit operator std::string() const { return str(); }
+#if __cplusplus >= 201703L
+  operator std::string_view() const { return std::string_view(ptr, len); }
+#endif
+  bool operator==(const char* s) const { return strlen(s) == len && memcmp(s, ptr, len) == 0; }
+  bool operator!=(const char* s) const { return !(*this == s); }
+};
+
+struct record_format {
+  enum format_type {
+    DELIMITER,    // Records terminated by a delimiter character (not part of the record)
+    FIXED,        // Records of a fixed size
+    LENGTH_PREFIX // Records preceded by their length, big-endian
+  };
+  format_type type;
+  size_t      size;  // Record size for FIXED, size of the length (1, 2, 4 or 8) for LENGTH_PREFIX
+  char        delim; // For DELIMITER
+  size_t      max;   // Longest record accepted, see Records::error()
+
+  static const size_t default_max = (size_t)1 << 30;
+
+  static record_format delimiter(char d = '\n') { return record_format{DELIMITER, 0, d, default_max}; }
+  static record_format fixed(size_t s) { return record_format{FIXED, std::max(s, (size_t)1), '\0', default_max}; }
+  static record_format length_prefix(size_t s = 4) {
+    assert(s == 1 || s == 2 || s == 4 || s == 8);
+    return record_format{LENGTH_PREFIX, s, '\0', default_max};
+  }
+  // Same format, accepting records of at most m bytes
+  record_format max_size(size_t m) const { return record_format{type, size, delim, m}; }
+
+  // False for a length prefix of an unsupported size
+  bool valid() const { return type != LENGTH_PREFIX || size == 1 || size == 2 || size == 4 || size == 8; }
+};
+
+// Iterate over the records output by a pipeline (or read from a file
+// descriptor) without copying them into strings. The data is read in
+// a large buffer and the records are returned as views into this
+// buffer. For example:
+//
+// for(auto line : noshell::lines("zcat"_C("large.gz"))) {
+//   // line is a record_view, valid until the next iteration
+// }
+//
+// When all the records have been read, or when the Records object is
+// destroyed, the pipeline is waited for and its status is available
+// with exit().
+class Records {
+  PipeLine          pipeline;
+  record_format     format;
+  Exit              status;
+  std::vector<char> buffer;
+  size_t            data_start, data_end; // Unread data in buffer
+  size_t            scanned;    // Bytes after data_start known not to contain a delimiter
+  int               fd;
+  bool              own_fd;     // Close and wait on the pipeline when done
+  bool              started;
+  bool              eof;
+  bool              done;
+  bool              truncated_;
+  int               error_;
+  record_view       current;
+
+  bool fill(size_t need);
+  void finish();
+
+public:
+  static const size_t default_buffer_size = 1 << 20;
+
+  Records(PipeLine&& pl, record_format f, size_t buffer_size = default_buffer_size)
+    : pipeline(std::move(pl)), format(f), buffer(std::max(buffer_size, (size_t)1)), data_start(0), data_end(0), scanned(0)
+    , fd(-1), own_fd(true), started(false), eof(false), done(false), truncated_(false), error_(0)
+  { }
+  // Read from an open file descriptor, which is not closed
+  Records(int in, record_format f, size_t buffer_size = default_buffer_size)
+    : format(f), buffer(std::max(buffer_size, (size_t)1)), data_start(0), data_end(0), scanned(0)
+    , fd(in), own_fd(false), started(true), eof(false), done(false), truncated_(false), error_(0)
+  { }
+  Records(Records&& rhs)
+    : pipeline(std::move(rhs.pipeline)), format(rhs.format), status(std::move(rhs.status)), buffer(std::move(rhs.buffer))
+    , data_start(rhs.data_start), data_end(rhs.data_end), scanned(rhs.scanned), fd(rhs.fd), own_fd(rhs.own_fd), started(rhs.started)
+    , eof(rhs.eof), done(rhs.done), truncated_(rhs.truncated_), error_(rhs.error_), current(rhs.current)
+  {
+    rhs.fd   = -1;
+    rhs.done = true;
+  }
+  ~Records() { finish(); }
+
+  // Read the next record. Returns false at the end of the input.
+  bool next();
+  const record_view& record() const { return current; }
+
+  // Exit status of the pipeline, once all records are read.
+  Exit& exit() { return status; }
+  // The input ended in the middle of a record (FIXED or LENGTH_PREFIX)
+  bool truncated() const { return truncated_; }
+  // errno value if reading failed, 0 otherwise. EINVAL for an invalid
+  // format, EMSGSIZE if a record is longer than the maximum of the
+  // format: reading stops there.
+  int error() const { return error_; }
+
+  class iterator {
+    Records* records;
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef record_view             value_type;
+    typedef const record_view*      pointer;
+    typedef const record_view&      reference;
+    typedef ptrdiff_t               difference_type;
+
+    explicit iterator(Records* r = nullptr) : records(r) { }
+    const record_view& operator*() const { return records->current; }
+    const record_view* operator->() const { return &records->current; }
+    iterator& operator++() { if(!records->next()) records = nullptr; return *this; }
+    bool operator==(const iterator& rhs) const { return records == rhs.records; }
+    bool operator!=(const iterator& rhs) const { return records != rhs.records; }
+  };
+  iterator begin() { return next() ? iterator(this) : iterator(); }
+  iterator end() { return iterator(); }
+};
+
+inline Records lines(PipeLine&& pl, char delim = '\n') { return Records(std::move(pl), record_format::delimiter(delim)); }
+inline Records lines(int fd, char delim = '\n') { return Records(fd, record_format::delimiter(delim)); }
+inline Records records(PipeLine&& pl, record_format f) { return Records(std::move(pl), f); }
+inline Records records(int fd, record_format f) { return Records(fd, f); }
+} // namespace noshell
+
+#endif /* __NOSHELL_RECORDS_H__ */
@@ -0,0 +1,95 @@
+#ifndef __NOSHELL_SCRIPT_H__
+#define __NOSHELL_SCRIPT_H__
+
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+class ScriptExit;
+class script_scheduler;
+
+// Lists of pipelines, as in the shell: "a && b" runs b if a succeeded,
+// "a || b" runs b if a failed, a.then(b) ("a; b") runs b after a, and
+// "a & b" runs a and b concurrently, succeeding if both do. For
+// example, with three concurrent jobs between a preparation and a
+// merge:
+//
+// noshell::ScriptExit e = ("prep"_C() && ("x"_C() & "y"_C() & "z"_C()) && "merge"_C()).run();
+// e.wait();
+//
+// The operators follow the C++ precedence: & before && before ||, so
+// that "a || b && c" is "a || (b && c)", unlike in the shell. A
+// pipeline succeeds if all its commands do. A successor is started
+// from a background thread, as soon as the pipelines it depends on
+// exit (watched with pidfds when supported).
+class Script {
+public:
+  enum list_type { PIPELINE, AND, OR, SEQUENCE, CONCURRENT };
+
+private:
+  list_type                            type;
+  std::shared_ptr<PipeLine>            pipeline; // For PIPELINE
+  std::vector<std::shared_ptr<Script>> items;    // For the lists
+
+  // a and b in a list of type t. Nested lists of the same type are
+  // flattened: "a && b && c" is one list of three items.
+  static Script join(list_type t, Script&& a, Script&& b);
+  friend class script_scheduler;
+
+public:
+  Script(PipeLine&& pl) : type(PIPELINE), pipeline(std::make_shared<PipeLine>(std::move(pl))) { }
+
+  // Run next after this list, whatever its status ("this; next")
+  Script& then(Script next) & { return *this = join(SEQUENCE, std::move(*this), std::move(next)); }
+  Script&& then(Script next) && { return std::move(then(std::move(next))); }
+
+  ScriptExit run();
+  ScriptExit run_wait();
+
+  friend Script operator&&(Script a, Script b);
+  friend Script operator||(Script a, Script b);
+  friend Script operator&(Script a, Script b);
+};
+
+// Also found for two pipelines, converted to scripts
+inline Script operator&&(Script a, Script b) { return Script::join(Script::AND, std::move(a), std::move(b)); }
+inline Script operator||(Script a, Script b) { return Script::join(Script::OR, std::move(a), std::move(b)); }
+inline Script operator&(Script a, Script b) { return Script::join(Script::CONCURRENT, std::move(a), std::move(b)); }
+
+// Status of a running Script: the same tree, where each node is a
+// list or a pipeline with its Exit. The nodes are numbered depth first,
+// the root is node 0. For "prep && (x & y) && merge": 0 is the &&
+// list, 1 is prep, 2 is the & list, 3 and 4 are x and y, and 5 is
+// merge. The nodes may change until the script is waited for.
+class ScriptExit {
+public:
+  enum state_type { PENDING, RUNNING, DONE, SKIPPED };
+  struct node {
+    Script::list_type   type;
+    state_type          state;
+    bool                success;  // Once DONE
+    ssize_t             parent;   // -1 for the root
+    std::vector<size_t> children;
+    Exit                exit;     // For a PIPELINE which was started
+    node(Script::list_type t, ssize_t p) : type(t), state(PENDING), success(false), parent(p) { }
+  };
+
+private:
+  std::shared_ptr<script_scheduler> scheduler;
+  friend class Script;
+
+public:
+  ScriptExit() { }
+  // Wait for the pipelines which are started, and for the script to end.
+  void wait();
+  // Do not start any more pipeline, and send the signal sig to the
+  // running ones. The lists waiting for them are skipped.
+  bool kill(int sig = SIGTERM);
+  // True once all the pipelines to run exited
+  bool done() const;
+  bool success() const { return size() > 0 && (*this)[0].success; }
+  size_t size() const;
+  const node& operator[](size_t i) const;
+};
+} // namespace noshell
+
+#endif /* __NOSHELL_SCRIPT_H__ */
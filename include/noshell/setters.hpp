@@ -5,6 +5,7 @@
 #include <config.h>
 #endif
 
+#include <sys/types.h>
 #include <vector>
 #include <set>
 
@@ -92,14 +93,21 @@ struct fd_redirection_setter : public process_setter {
   virtual process_setup* make_setup(std::string& err, std::set<int>& rfds);
 };
 
-// Setup a redirection to a named file, either in input or output.
-struct path_redirection : public fd_redirection {
-  path_redirection(int f, int t) : fd_redirection(f, t) { }
-  path_redirection(const fd_list_type& f, int t) : fd_redirection(f, t) { }
-  virtual ~path_redirection();
+// Same as fd_redirection, but the file descriptor is owned by the
+// setup: it is closed in the parent once the child is started.
+struct owned_fd_redirection : public fd_redirection {
+  owned_fd_redirection(int f, int t);
+  owned_fd_redirection(const fd_list_type& f, int t);
+  virtual ~owned_fd_redirection();
   virtual bool parent_setup(std::string& err);
 };
 
+// Setup a redirection to a named file, either in input or output.
+struct path_redirection : public owned_fd_redirection {
+  path_redirection(int f, int t) : owned_fd_redirection(f, t) { }
+  path_redirection(const fd_list_type& f, int t) : owned_fd_redirection(f, t) { }
+};
+
 struct path_redirection_setter : public process_setter {
   enum path_type { READ, WRITE, APPEND };
   const from_to_path     ft;
@@ -132,9 +140,10 @@ struct pipeline_redirection : public process_setup {
 struct fd_pipe_redirection : public process_setup {
   fd_list_type from;
   int          pipe_dup;
-  int          pipe_close;
-  fd_pipe_redirection(int f, int d, int c) : from(1, f), pipe_dup(d), pipe_close(c) { }
-  fd_pipe_redirection(const fd_list_type f, int d, int c) : from(f), pipe_dup(d), pipe_close(c) { }
+  int          pipe_close;  // The parent end of the pipe
+  bool         parent_read; // The parent reads from pipe_close
+  fd_pipe_redirection(int f, int d, int c, bool r = true);
+  fd_pipe_redirection(const fd_list_type f, int d, int c, bool r = true);
   virtual ~fd_pipe_redirection();
   virtual bool child_setup();
   virtual bool parent_setup(std::string& err);
@@ -151,6 +160,41 @@ struct fd_pipe_redirection_setter : public process_setter {
   virtual process_setup* make_setup(std::string& err, std::set<int>& rfds);
 };
 
+// Redirect the standard error of the child to the write end of a
+// pipe, owned by the setup, unless the command redirects it itself.
+struct stderr_tail_redirection : public owned_fd_redirection {
+  bool redirected;
+  stderr_tail_redirection(int w) : owned_fd_redirection(2, w), redirected(false) { }
+  virtual bool fix_collisions(const std::set<int>& r) {
+    redirected = r.count(2) > 0;
+    return owned_fd_redirection::fix_collisions(r);
+  }
+  virtual bool child_setup() { return redirected || owned_fd_redirection::child_setup(); }
+};
+
+// Put the child in the process group <group>, or in a new group if 0.
+struct process_group_setup : public process_setup {
+  pid_t group;
+  process_group_setup(pid_t g) : group(g) { }
+  virtual bool child_setup();
+};
+
+// Send the signal <sig> to the child when its parent dies
+// (PR_SET_PDEATHSIG). Note that the parent is the thread which forked
+// the child: the signal is sent when this thread exits.
+struct death_signal_setup : public process_setup {
+  int   sig;
+  pid_t parent;
+  death_signal_setup(int s, pid_t p) : sig(s), parent(p) { }
+  virtual bool child_setup();
+};
+
+struct death_signal_setter : public process_setter {
+  const int sig;
+  death_signal_setter(int s) : sig(s) { }
+  virtual process_setup* make_setup(std::string& err, std::set<int>& rfds);
+};
+
 // Same as above but with a stdio FILE*.
 struct stdio_pipe_redirection_setter : public fd_pipe_redirection_setter {
   int    fd;
@@ -168,6 +212,30 @@ struct stdio_pipe_redirection_setter : public fd_pipe_redirection_setter {
   virtual process_setup* make_setup(std::string& err, std::set<int>& rfds);
 };
 
+// A file descriptor for the parent end of a pipe, in non-blocking
+// mode (O_NONBLOCK). The end in the child is blocking, as usual. For
+// example:
+//
+// noshell::nonblocking_fd fd;
+// noshell::Exit e = "zcat"_C("data.gz") | fd;
+// // fd.fd is ready to be added to an event loop
+struct nonblocking_fd {
+  int fd;
+  nonblocking_fd() : fd(-1) { }
+  operator int() const { return fd; }
+};
+
+struct nonblocking_pipe_redirection_setter : public fd_pipe_redirection_setter {
+  int             fd;
+  nonblocking_fd& nb;
+  nonblocking_pipe_redirection_setter(from_to_ref<nonblocking_fd>&& ft, fd_pipe_redirection_setter::pipe_type p)
+    : fd_pipe_redirection_setter(std::move(ft.from), fd, p)
+    , fd(-1)
+    , nb(ft.to)
+  { }
+  virtual process_setup* make_setup(std::string& err, std::set<int>& rfds);
+};
+
 #if defined(__GLIBCXX__) || defined(HAVE_STDIO_FILEBUF_H)
 // Same as above but with a C++ stream
 template<typename T>
@@ -250,6 +318,11 @@ struct setter_traits<FILE*> {
   typedef stdio_pipe_redirection_setter setter_type;
 };
 
+template<>
+struct setter_traits<nonblocking_fd> {
+  typedef nonblocking_pipe_redirection_setter setter_type;
+};
+
 #if defined(__GLIBCXX__) || defined(HAVE_STDIO_FILEBUF_H)
 template<>
 struct setter_traits<istream> {
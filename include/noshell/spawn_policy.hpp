@@ -0,0 +1,52 @@
+#ifndef __NOSHELL_SPAWN_POLICY_H__
+#define __NOSHELL_SPAWN_POLICY_H__
+
+#include <sys/types.h>
+#include <chrono>
+
+namespace noshell {
+// What to do when starting a command fails with a transient error,
+// for the whole process. Under load, fork() fails with EAGAIN
+// (RLIMIT_NPROC, pids.max of a cgroup) and pipe2() with EMFILE or
+// ENFILE until other commands exit. By default, there is no retry and
+// the error is reported right away in the Handle (see
+// Handle::setup_error()). For example, for a batch scheduler:
+//
+// noshell::spawn_policy policy;
+// policy.retries = 5; // Sleeping about 1, 2, 4, 8 then 16ms
+// policy.fd_wait = std::chrono::milliseconds(500);
+// noshell::set_spawn_policy(policy);
+struct spawn_policy {
+  unsigned                  retries;         // Retries of fork() on EAGAIN
+  std::chrono::microseconds initial_backoff; // Doubled after each retry
+  std::chrono::microseconds max_backoff;
+  double                    jitter;          // Sleep a random part of up to jitter * backoff less, in [0, 1]
+  // Budget of time to wait for file descriptors: pipe2() failing with
+  // EMFILE or ENFILE is retried, with the same backoff, for up to
+  // fd_wait. 0 to fail right away.
+  std::chrono::milliseconds fd_wait;
+
+  spawn_policy()
+    : retries(0), initial_backoff(1000), max_backoff(100000), jitter(0.5), fd_wait(0)
+  { }
+};
+
+void set_spawn_policy(const spawn_policy& policy);
+spawn_policy get_spawn_policy();
+
+// fork() and pipe2() retrying on transient errors according to the
+// spawn policy. Same return values as the system calls, with errno
+// from the last attempt.
+pid_t retry_fork();
+int retry_pipe2(int fds[2], int flags);
+// Same as retry_fork(), with the child started in the cgroup whose
+// directory is open on cgroup_fd (clone3() with CLONE_INTO_CGROUP).
+// The child does not go through the fork handlers of the C library:
+// it must only call async-signal-safe functions until it execs. Fail
+// with ENOSYS if not supported by the kernel (before Linux 5.7).
+pid_t retry_clone_into_cgroup(int cgroup_fd);
+// Move the calling process to the cgroup open on cgroup_fd
+bool join_cgroup(int cgroup_fd);
+} // namespace noshell
+
+#endif /* __NOSHELL_SPAWN_POLICY_H__ */
@@ -0,0 +1,254 @@
+#ifndef __NOSHELL_STATIC_PIPELINE_H__
+#define __NOSHELL_STATIC_PIPELINE_H__
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+
+#include <array>
+#include <tuple>
+
+#include <noshell/handle.hpp>
+#include <noshell/fork_exclusions.hpp>
+#include <noshell/spawn_policy.hpp>
+
+namespace noshell {
+// Pipelines whose shape (number of commands, kind of redirections) is
+// known at compile time. Everything is stored inline in std::array and
+// std::tuple, the redirections are applied without virtual calls, and
+// starting the pipeline does no heap allocation. The arguments are not
+// copied: they must outlive the pipeline (string literals, for
+// example). For example:
+//
+// auto p = noshell::static_command("zcat", "data.gz") | noshell::static_command("sort") > "sorted";
+// auto e = p.run_wait();
+// if(!e.success()) ...
+//
+// The operators have the same meaning and precedence as for PipeLine.
+
+// Redirections, applied in the child after the pipes
+namespace static_redirection {
+// Open a path on file descriptor fd
+struct path {
+  int         fd;
+  const char* file;
+  int         flags;
+  bool child_setup() const {
+    const int f = open(file, flags, 0666);
+    if(f == -1) return false;
+    if(f == fd) return true;
+    const bool res = dup2(f, fd) != -1;
+    close(f);
+    return res;
+  }
+};
+
+// Make file descriptor from a copy of to
+struct fd {
+  int from;
+  int to;
+  bool child_setup() const { return dup2(to, from) != -1; }
+};
+} // namespace static_redirection
+
+namespace static_detail {
+template<size_t I, size_t N>
+struct apply_redirections {
+  template<typename Tuple>
+  static bool child_setup(const Tuple& t) {
+    return std::get<I>(t).child_setup() && apply_redirections<I + 1, N>::child_setup(t);
+  }
+};
+template<size_t N>
+struct apply_redirections<N, N> {
+  template<typename Tuple>
+  static bool child_setup(const Tuple&) { return true; }
+};
+} // namespace static_detail
+
+// A command with N arguments (including the command name) and its redirections
+template<size_t N, typename... Redirections>
+struct static_stage {
+  std::array<const char*, N + 1> argv; // Terminated by nullptr
+  std::tuple<Redirections...>    redirections;
+
+  static_stage(const std::array<const char*, N + 1>& a, const std::tuple<Redirections...>& r) : argv(a), redirections(r) { }
+  bool child_setup() const {
+    return static_detail::apply_redirections<0, sizeof...(Redirections)>::child_setup(redirections);
+  }
+  template<typename R>
+  static_stage<N, Redirections..., R> redirect(const R& r) const {
+    return static_stage<N, Redirections..., R>(argv, std::tuple_cat(redirections, std::make_tuple(r)));
+  }
+};
+
+template<typename... Args>
+static_stage<sizeof...(Args) + 1> static_command(const char* cmd, Args... args) {
+  return static_stage<sizeof...(Args) + 1>(std::array<const char*, sizeof...(Args) + 2>{{cmd, args..., nullptr}}, std::tuple<>());
+}
+
+template<size_t N, typename... R>
+static_stage<N, R..., static_redirection::path> operator>(const static_stage<N, R...>& s, const char* file) {
+  return s.redirect(static_redirection::path{1, file, O_WRONLY|O_CREAT|O_TRUNC});
+}
+template<size_t N, typename... R>
+static_stage<N, R..., static_redirection::path> operator>>(const static_stage<N, R...>& s, const char* file) {
+  return s.redirect(static_redirection::path{1, file, O_WRONLY|O_CREAT|O_APPEND});
+}
+template<size_t N, typename... R>
+static_stage<N, R..., static_redirection::path> operator<(const static_stage<N, R...>& s, const char* file) {
+  return s.redirect(static_redirection::path{0, file, O_RDONLY});
+}
+template<size_t N, typename... R>
+static_stage<N, R..., static_redirection::fd> operator>(const static_stage<N, R...>& s, static_redirection::fd r) {
+  return s.redirect(r);
+}
+
+// Exit status of a static pipeline of N commands
+template<size_t N>
+struct static_exit {
+  std::array<pid_t, N> pids;
+  std::array<int, N>   statuses; // Status from wait, valid if waited[i]
+  std::array<int, N>   errors;   // errno if command i failed to start, 0 otherwise
+  std::array<bool, N>  waited;
+
+  static_exit() {
+    pids.fill(-1);
+    statuses.fill(0);
+    errors.fill(0);
+    waited.fill(false);
+  }
+  Status status(size_t i) const { return Status{statuses[i]}; }
+  bool command_success(size_t i, bool ignore_sigpipe = false) const {
+    const Status st = status(i);
+    return errors[i] == 0 && waited[i] &&
+      ((st.exited() && st.exit_status() == 0) || (ignore_sigpipe && st.signaled() && st.term_sig() == SIGPIPE));
+  }
+  bool success(bool ignore_sigpipe = false) const {
+    for(size_t i = 0; i < N; ++i)
+      if(!command_success(i, ignore_sigpipe)) return false;
+    return true;
+  }
+  void wait() {
+    for(size_t i = 0; i < N; ++i) {
+      if(waited[i] || errors[i]) continue;
+      while(waitpid(pids[i], &statuses[i], 0) == -1) {
+        if(errno != EINTR) {
+          errors[i] = errno;
+          break;
+        }
+      }
+      waited[i] = errors[i] == 0;
+    }
+  }
+};
+
+namespace static_detail {
+inline void close_fd(int& fd) {
+  if(fd != -1) close(fd);
+  fd = -1;
+}
+
+// Fork and exec one stage with stdin from in and stdout to out (unless
+// -1). The exec errors are reported through a close-on-exec pipe, as
+// with Command::run().
+template<typename Stage>
+pid_t spawn(const Stage& stage, int in, int out, int& err) {
+  int epipe[2];
+  if(retry_pipe2(epipe, O_CLOEXEC) == -1) {
+    err = errno;
+    return -1;
+  }
+  const bool  excluded = fork_exclusions::enter();
+  const pid_t pid      = retry_fork();
+  if(excluded && pid != 0) fork_exclusions::leave();
+  if(pid == -1) {
+    err = errno;
+    close(epipe[0]);
+    close(epipe[1]);
+    return -1;
+  }
+  if(pid == 0) {
+    close(epipe[0]);
+    if((in == -1 || dup2(in, 0) != -1) && (out == -1 || dup2(out, 1) != -1) && stage.child_setup())
+      execvp(stage.argv[0], (char* const*)stage.argv.data());
+    const int e = errno;
+    while(write(epipe[1], &e, sizeof(e)) == -1 && errno == EINTR) { }
+    _exit(127);
+  }
+  close(epipe[1]);
+  int     e;
+  ssize_t res;
+  while((res = read(epipe[0], &e, sizeof(e))) == -1 && errno == EINTR) { }
+  close(epipe[0]);
+  if(res > 0) {
+    err = e;
+    while(waitpid(pid, nullptr, 0) == -1 && errno == EINTR) { }
+  }
+  return pid;
+}
+
+template<size_t I, size_t N>
+struct spawn_stages {
+  template<typename Tuple>
+  static void run(const Tuple& stages, int in, int fd_out, static_exit<N>& res) {
+    int fds[2] = { -1, -1 };
+    if(I + 1 < N && retry_pipe2(fds, O_CLOEXEC) == -1) {
+      for(size_t i = I; i < N; ++i) res.errors[i] = errno;
+      close_fd(in);
+      return;
+    }
+    int err = 0;
+    res.pids[I]   = spawn(std::get<I>(stages), in, I + 1 < N ? fds[1] : fd_out, err);
+    res.errors[I] = err;
+    close_fd(in);
+    close_fd(fds[1]);
+    spawn_stages<I + 1, N>::run(stages, fds[0], fd_out, res);
+  }
+};
+template<size_t N>
+struct spawn_stages<N, N> {
+  template<typename Tuple>
+  static void run(const Tuple&, int in, int, static_exit<N>&) { close_fd(in); }
+};
+} // namespace static_detail
+
+template<typename... Stages>
+struct static_pipeline {
+  static const size_t    size = sizeof...(Stages);
+  std::tuple<Stages...>  stages;
+
+  explicit static_pipeline(const std::tuple<Stages...>& s) : stages(s) { }
+
+  // Start the commands. The standard input of the first command and
+  // the standard output of the last are not changed.
+  static_exit<size> run() const {
+    static_exit<size> res;
+    static_detail::spawn_stages<0, size>::run(stages, -1, -1, res);
+    return res;
+  }
+  static_exit<size> run_wait() const {
+    static_exit<size> res = run();
+    res.wait();
+    return res;
+  }
+};
+
+template<size_t N1, typename... R1, size_t N2, typename... R2>
+static_pipeline<static_stage<N1, R1...>, static_stage<N2, R2...>>
+operator|(const static_stage<N1, R1...>& s1, const static_stage<N2, R2...>& s2) {
+  return static_pipeline<static_stage<N1, R1...>, static_stage<N2, R2...>>(std::make_tuple(s1, s2));
+}
+template<typename... Stages, size_t N, typename... R>
+static_pipeline<Stages..., static_stage<N, R...>>
+operator|(const static_pipeline<Stages...>& p, const static_stage<N, R...>& s) {
+  return static_pipeline<Stages..., static_stage<N, R...>>(std::tuple_cat(p.stages, std::make_tuple(s)));
+}
+// A pipeline of one command
+template<size_t N, typename... R>
+static_pipeline<static_stage<N, R...>> make_static_pipeline(const static_stage<N, R...>& s) {
+  return static_pipeline<static_stage<N, R...>>(std::make_tuple(s));
+}
+} // namespace noshell
+
+#endif /* __NOSHELL_STATIC_PIPELINE_H__ */
@@ -0,0 +1,105 @@
+#ifndef __NOSHELL_TEMPLATE_H__
+#define __NOSHELL_TEMPLATE_H__
+
+#include <fcntl.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <noshell/handle.hpp>
+
+namespace noshell {
+// A command prepared once to be started many times with only a few
+// arguments changing. The arguments "{}" or "{name}" are placeholders,
+// replaced by the values given to run() in the order they appear. The
+// argv array, the environment, the redirections and the path of the
+// executable (looked up in PATH) are all prepared by the constructor:
+// run() only patches the placeholder slots and forks. For example:
+//
+// noshell::Template t({"samtools", "view", "-b", "{region}", "in.bam"});
+// t.output("out.bam");
+// for(const auto& region : regions) {
+//   auto h = t.run(region);
+//   ...
+// }
+//
+// Running patches the Template in place: it must not be run from
+// multiple threads at once.
+class Template {
+  struct redirection {
+    int         fd;
+    std::string path;  // Path to open, unless empty
+    int         flags;
+    int         to;    // Duplicate this file descriptor if path is empty
+  };
+
+  std::vector<std::string> args;
+  std::vector<const char*> argv;  // nullptr terminated, points into args or the values
+  std::vector<size_t>      slots; // Position of the placeholders in argv
+  std::string              path;  // Executable
+  int                      path_errno;
+  std::vector<std::string> env;
+  std::vector<const char*> envp;  // Empty to inherit the environment
+  std::vector<redirection> redirections;
+  bool                     keep_argv; // Copy the argv of each run in its Handle
+
+  static const char* c_str(const char* s) { return s; }
+  static const char* c_str(const std::string& s) { return s.c_str(); }
+
+public:
+  // Without placeholders, "{}" and "{name}" are regular arguments
+  explicit Template(std::vector<std::string> cmd, bool placeholders = true);
+  Template(const Template& rhs) = delete;
+  Template(Template&& rhs) = default;
+
+  size_t placeholders() const { return slots.size(); }
+  // Executable path found in PATH, empty if not found
+  const std::string& executable() const { return path; }
+
+  // Replace the environment by vars, of the form "NAME=value"
+  Template& environment(std::vector<std::string> vars);
+  // Redirections, applied in the order given
+  Template& input(std::string file, int fd = 0) {
+    redirections.push_back(redirection{fd, std::move(file), O_RDONLY, -1});
+    return *this;
+  }
+  Template& output(std::string file, int fd = 1, bool append = false) {
+    redirections.push_back(redirection{fd, std::move(file), O_WRONLY|O_CREAT|(append ? O_APPEND : O_TRUNC), -1});
+    return *this;
+  }
+  Template& dup(int from, int to) {
+    redirections.push_back(redirection{from, std::string(), 0, to});
+    return *this;
+  }
+  // Record the arguments of each run in Handle::argv, at the cost of a
+  // copy per run. Off by default.
+  Template& record_argv(bool on = true) {
+    keep_argv = on;
+    return *this;
+  }
+
+  // Start the command with the values for the placeholders. The number
+  // of values must match placeholders(), otherwise the Handle has a
+  // setup error EINVAL.
+  Handle run(const char* const* values, size_t nb_values) { return run_append(values, nb_values, nullptr, 0); }
+  // Same, with the nb_extra arguments extra appended to the command
+  // line. They are not copied, and only need to live until run_append
+  // returns.
+  Handle run_append(const char* const* values, size_t nb_values, const char* const* extra, size_t nb_extra);
+  template<typename... Values>
+  Handle run(const Values&... values) {
+    const std::array<const char*, sizeof...(Values)> a{{c_str(values)...}};
+    return run(a.data(), a.size());
+  }
+  template<typename... Values>
+  Handle run_wait(const Values&... values) {
+    Handle res = run(values...);
+    if(!res.setup_error())
+      res.wait();
+    return res;
+  }
+};
+} // namespace noshell
+
+#endif /* __NOSHELL_TEMPLATE_H__ */
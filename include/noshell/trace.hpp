@@ -0,0 +1,68 @@
+#ifndef __NOSHELL_TRACE_H__
+#define __NOSHELL_TRACE_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <ostream>
+#include <string>
+
+namespace noshell {
+// Timeline of the execution of the commands, to load in Perfetto or
+// chrome://tracing. Off by default. Once started, every command
+// records when it was forked, when it exec'ed and when it was waited
+// for, and the readers of noshell (Records, CoProcess, parallel_pipe)
+// record their reads and writes. For example:
+//
+// noshell::trace::start();
+// ... run pipelines ...
+// noshell::trace::write_chrome_trace("trace.json");
+//
+// The events are kept in a ring buffer per thread, written without
+// locks: only the last events_per_thread events of each thread are
+// kept.
+namespace trace {
+enum event_type {
+  SPAWN, // Parent about to fork, pid of the child
+  EXEC,  // Child exec'ed (or started its stage function)
+  EXIT,  // Child waited for, value is the status
+  READ,  // Parent read value bytes from fd
+  WRITE  // Parent wrote value bytes to fd
+};
+
+struct event {
+  uint64_t   ts;       // CLOCK_MONOTONIC, in nanoseconds
+  int64_t    value;
+  pid_t      pid;      // Child, or -1
+  int        fd;       // For READ and WRITE, -1 otherwise
+  pid_t      tid;      // Thread recording the event
+  event_type type;
+  char       name[16]; // Command name for SPAWN, without its directory
+};
+
+extern std::atomic<bool> tracing;
+inline bool enabled() { return tracing.load(std::memory_order_relaxed); }
+
+void start(size_t events_per_thread = 1 << 16);
+void stop();
+// Discard the events recorded so far
+void clear();
+
+uint64_t now();
+void record(event_type type, pid_t pid, int fd, int64_t value, const char* name = nullptr, uint64_t ts = 0);
+inline void record_io(event_type type, int fd, ssize_t bytes) {
+  if(enabled() && bytes > 0) record(type, -1, fd, bytes);
+}
+
+// Write the events in the Chrome trace event format (JSON). Each
+// command is a slice from fork to exit on its own track, named by the
+// command and its pid. The exec, the reads and writes (and the first
+// byte read on each file descriptor) are instant events. Best called
+// when no thread is recording.
+bool write_chrome_trace(std::ostream& os);
+bool write_chrome_trace(const std::string& path);
+} // namespace trace
+} // namespace noshell
+
+#endif /* __NOSHELL_TRACE_H__ */
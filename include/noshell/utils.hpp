@@ -2,6 +2,9 @@
 #define __NOSHELL_UTILS_H__
 
 #include <cerrno>
+#include <cstddef>
+#include <signal.h>
+#include <sys/types.h>
 
 namespace noshell {
 // Save the current value of errno and restores it on destruction.
@@ -26,6 +29,35 @@ bool safe_dup2_no_close(int to, int from);
 // descriptor <to> and sets it to -1. Returns true if successful.
 bool safe_dup2(int& to, int from);
 
+// Write all len bytes of buf to fd, retrying on partial writes and
+// EINTR. Return true if successful.
+bool write_all(int fd, const void* buf, size_t len);
+
+// Move up to len bytes from in to out, with splice(2) if possible
+// (one of them must be a pipe), and with read/write otherwise. Return
+// the number of bytes moved, 0 on end of file or -1 on error.
+ssize_t move_data(int in, int out, size_t len);
+
+// Set the O_NONBLOCK flag on fd. Return true if successful.
+bool set_nonblock(int fd);
+
+// Close every file descriptor which has the close-on-exec flag set, as
+// a call to exec would do. Used by children which run a function
+// instead of exec'ing a program.
+void close_cloexec_fds();
+
+// Block SIGPIPE in the current thread for the lifetime of the object,
+// so that writing to a pipe with no reader fails with EPIPE instead of
+// killing the process. A SIGPIPE generated in the meantime is
+// discarded.
+class block_sigpipe {
+  sigset_t old_mask;
+  bool     was_pending;
+public:
+  block_sigpipe();
+  ~block_sigpipe();
+};
+
 // Automatically close a file descriptor on destruction
 struct auto_close {
   int fd;
@@ -0,0 +1,81 @@
+#ifndef __NOSHELL_XARGS_H__
+#define __NOSHELL_XARGS_H__
+
+#include <cstring>
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+// Arguments stored back to back in one buffer, each terminated by
+// '\0', instead of one std::string each.
+class argument_arena {
+  std::vector<char>   data;
+  std::vector<size_t> offsets;
+
+public:
+  void push_back(const char* s, size_t len) {
+    offsets.push_back(data.size());
+    data.insert(data.end(), s, s + len);
+    data.push_back('\0');
+  }
+  void push_back(const char* s) { push_back(s, strlen(s)); }
+  void push_back(const std::string& s) { push_back(s.data(), s.size()); }
+  void reserve(size_t nb_args, size_t nb_bytes) {
+    offsets.reserve(nb_args);
+    data.reserve(nb_bytes);
+  }
+
+  size_t size() const { return offsets.size(); }
+  bool empty() const { return offsets.empty(); }
+  const char* operator[](size_t i) const { return data.data() + offsets[i]; }
+  // Length of argument i, without the terminating '\0'
+  size_t length(size_t i) const { return (i + 1 < offsets.size() ? offsets[i + 1] : data.size()) - offsets[i] - 1; }
+};
+
+struct xargs_options {
+  size_t jobs;      // Number of batches running at once
+  size_t max_args;  // Maximum number of arguments per batch, 0 for no limit (xargs -n)
+  size_t max_bytes; // Maximum size of the arguments and environment, 0 for
+                    // the system limit sysconf(_SC_ARG_MAX) (xargs -s)
+  xargs_options(size_t j = 1) : jobs(std::max(j, (size_t)1)), max_args(0), max_bytes(0) { }
+};
+
+struct xargs_result {
+  std::vector<Exit>   exits;   // One per batch, in the order of the arguments
+  std::vector<size_t> batches; // Index of the first argument of each batch
+  int                 error;   // E2BIG if an argument does not fit on a command line,
+                               // errno if waiting for the batches failed
+  xargs_result() : error(0) { }
+  bool success(const bool ignore_sigpipe = false) const {
+    return error == 0 && std::all_of(exits.begin(), exits.end(), [=](const Exit& e) { return e.success(ignore_sigpipe); });
+  }
+};
+
+// Equivalent of `xargs -P jobs`. Run the command base with as many of
+// the arguments appended as fit on a command line, as many times as
+// needed to use all of them, with up to opts.jobs commands running at
+// once. The size of a command line counts the arguments and the
+// environment as execve(2) does. For example:
+//
+// auto res = noshell::xargs({"gzip", "-9"}, paths, noshell::xargs_options(8));
+//
+// If an argument alone does not fit, no command is run and error is
+// set to E2BIG. The commands inherit the standard file descriptors.
+xargs_result xargs(const std::vector<std::string>& base, const argument_arena& args,
+                   const xargs_options& opts = xargs_options());
+
+template<typename Iterator>
+xargs_result xargs(const std::vector<std::string>& base, Iterator begin, Iterator end,
+                   const xargs_options& opts = xargs_options()) {
+  argument_arena args;
+  for( ; begin != end; ++begin)
+    args.push_back(*begin);
+  return xargs(base, args, opts);
+}
+
+inline xargs_result xargs(const std::vector<std::string>& base, const std::vector<std::string>& args,
+                          const xargs_options& opts = xargs_options()) {
+  return xargs(base, args.cbegin(), args.cend(), opts);
+}
+} // namespace noshell
+
+#endif /* __NOSHELL_XARGS_H__ */
@@ -0,0 +1,253 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <cstdlib>
+
+#include <noshell/utils.hpp>
+#include <noshell/builtin.hpp>
+
+namespace noshell {
+namespace builtin {
+namespace {
+const size_t block_size = 1 << 16;
+
+// Die of SIGPIPE, as a program writing to a closed pipe would.
+void sigpipe_exit() {
+  sigset_t pipe_set;
+  sigemptyset(&pipe_set);
+  sigaddset(&pipe_set, SIGPIPE);
+  signal(SIGPIPE, SIG_DFL);
+  sigprocmask(SIG_UNBLOCK, &pipe_set, nullptr);
+  raise(SIGPIPE);
+  _exit(1);
+}
+
+// Report an error on fd 2 and return the exit status for it.
+int failure(const std::vector<std::string>& args, const std::string& what) {
+  if(errno == EPIPE) sigpipe_exit();
+  dprintf(2, "%s: %s: %s\n", args[0].c_str(), what.c_str(), strerror(errno));
+  return 1;
+}
+
+size_t parse_size(const std::string& s) { return strtoull(s.c_str(), nullptr, 10); }
+
+// Move everything from in to out. Return true if successful.
+bool pump(int in, int out) {
+  ssize_t res;
+  while((res = move_data(in, out, block_size)) > 0) { }
+  return res == 0;
+}
+
+// Read up to len bytes, retrying on EINTR
+ssize_t read_some(int fd, char* buf, size_t len) {
+  while(true) {
+    const ssize_t res = read(fd, buf, len);
+    if(res != -1 || errno != EINTR) return res;
+  }
+}
+
+int run_cat(const std::vector<std::string>& args) {
+  std::vector<std::string> files(args.begin() + 1, args.end());
+  if(files.empty()) files.push_back("-");
+
+  int ret = 0;
+  for(const auto& file : files) {
+    int fd = file == "-" ? 0 : open(file.c_str(), O_RDONLY|O_CLOEXEC);
+    if(fd == -1) {
+      ret = failure(args, file);
+      continue;
+    }
+    if(!pump(fd, 1))
+      ret = failure(args, file);
+    if(fd != 0) safe_close(fd);
+  }
+  return ret;
+}
+
+// The files are args[1..]: append is not passed as an argument, so that
+// any file name is allowed.
+int run_tee(const std::vector<std::string>& args, bool append) {
+  int                      ret = 0;
+  std::vector<int>         fds;
+  std::vector<std::string> paths;
+  for(size_t i = 1; i < args.size(); ++i) {
+    const int fd = open(args[i].c_str(), O_WRONLY|O_CREAT|O_CLOEXEC|(append ? O_APPEND : O_TRUNC), 0666);
+    if(fd == -1) {
+      ret = failure(args, args[i]);
+    } else {
+      fds.push_back(fd);
+      paths.push_back(args[i]);
+    }
+  }
+  if(fds.empty())
+    return pump(0, 1) ? ret : failure(args, "error");
+
+  std::vector<char> buf(block_size);
+  auto write_files = [&](size_t len) {
+    for(size_t j = 0; j < fds.size(); ++j) {
+      if(fds[j] == -1 || write_all(fds[j], buf.data(), len)) continue;
+      ret = failure(args, paths[j]);
+      safe_close(fds[j]);
+    }
+  };
+
+  // With pipes on stdin and stdout, duplicate the data to stdout with
+  // tee(2), then consume it from stdin to the files, with splice(2) if
+  // there is only one. Otherwise, read and write to everybody.
+  bool use_tee = true;
+  while(true) {
+    if(use_tee) {
+      ssize_t len = ::tee(0, 1, block_size, 0);
+      if(len == -1 && errno == EINTR) continue;
+      if(len == -1 && errno == EINVAL) {
+        use_tee = false;
+        continue;
+      }
+      if(len == -1) return failure(args, "write error");
+      if(len == 0) break;
+      while(len > 0) {
+        if(fds.size() == 1 && fds[0] != -1) {
+          const ssize_t res = move_data(0, fds[0], len);
+          if(res > 0) {
+            len -= res;
+            continue;
+          }
+          ret = failure(args, paths[0]);
+          safe_close(fds[0]);
+        }
+        const ssize_t res = read_some(0, buf.data(), len);
+        if(res <= 0) return failure(args, "read error");
+        write_files(res);
+        len -= res;
+      }
+    } else {
+      const ssize_t len = read_some(0, buf.data(), buf.size());
+      if(len == -1) return failure(args, "read error");
+      if(len == 0) break;
+      if(!write_all(1, buf.data(), len)) return failure(args, "write error");
+      write_files(len);
+    }
+  }
+  for(auto& fd : fds)
+    if(!safe_close(fd)) ret = 1;
+  return ret;
+}
+
+int run_head(const std::vector<std::string>& args) {
+  size_t left = parse_size(args[2]);
+  if(args[1] == "-c") {
+    while(left > 0) {
+      const ssize_t res = move_data(0, 1, std::min(left, block_size));
+      if(res == -1) return failure(args, "error");
+      if(res == 0) break;
+      left -= res;
+    }
+    return 0;
+  }
+
+  char buf[block_size];
+  while(left > 0) {
+    const ssize_t len = read_some(0, buf, sizeof(buf));
+    if(len == -1) return failure(args, "read error");
+    if(len == 0) break;
+    const char* end = buf;
+    for( ; left > 0 && end < buf + len; --left) {
+      const char* nl = (const char*)memchr(end, '\n', buf + len - end);
+      end = nl ? nl + 1 : buf + len;
+      if(!nl) break;
+    }
+    if(!write_all(1, buf, end - buf)) return failure(args, "write error");
+  }
+  return 0;
+}
+
+int run_wc_l(const std::vector<std::string>& args) {
+  char   buf[block_size];
+  size_t lines = 0;
+  while(true) {
+    const ssize_t len = read_some(0, buf, sizeof(buf));
+    if(len == -1) return failure(args, "read error");
+    if(len == 0) break;
+    for(const char* p = buf; (p = (const char*)memchr(p, '\n', buf + len - p)); ++p)
+      ++lines;
+  }
+  const std::string res = std::to_string(lines) + '\n';
+  return write_all(1, res.data(), res.size()) ? 0 : failure(args, "write error");
+}
+
+int run_split(const std::vector<std::string>& args) {
+  const size_t      lines  = std::max(parse_size(args[2]), (size_t)1);
+  const std::string prefix = args[4];
+  std::string       suffix("aa");
+  int               fd     = -1;
+  size_t            left   = 0; // Lines left in the current file
+  char              buf[block_size];
+
+  while(true) {
+    const ssize_t len = read_some(0, buf, sizeof(buf));
+    if(len == -1) return failure(args, "read error");
+    if(len == 0) break;
+    for(const char* start = buf; start < buf + len; ) {
+      if(left == 0) { // Open the next file
+        if(fd != -1 && !safe_close(fd)) return failure(args, "close error");
+        if(suffix.empty()) {
+          errno = EOVERFLOW;
+          return failure(args, "output file suffixes exhausted");
+        }
+        const std::string path = prefix + suffix;
+        fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+        if(fd == -1) return failure(args, path);
+        left = lines;
+        for(size_t i = suffix.size(); i > 0; --i) { // Next suffix, empty when exhausted
+          if(suffix[i - 1] != 'z') {
+            ++suffix[i - 1];
+            break;
+          }
+          suffix[i - 1] = 'a';
+          if(i == 1) suffix.clear();
+        }
+      }
+      const char* end = start;
+      for( ; left > 0 && end < buf + len; --left) {
+        const char* nl = (const char*)memchr(end, '\n', buf + len - end);
+        end = nl ? nl + 1 : buf + len;
+        if(!nl) break;
+      }
+      if(!write_all(fd, start, end - start)) return failure(args, "write error");
+      start = end;
+    }
+  }
+  if(fd != -1 && !safe_close(fd)) return failure(args, "close error");
+  return 0;
+}
+} // namespace
+
+PipeLine cat(std::vector<std::string> files) {
+  files.insert(files.begin(), "cat");
+  return stage(run_cat, std::move(files));
+}
+
+PipeLine tee(std::vector<std::string> files, bool append) {
+  files.insert(files.begin(), "tee");
+  return stage([append](const std::vector<std::string>& args) { return run_tee(args, append); }, std::move(files));
+}
+
+PipeLine head(size_t lines) {
+  return stage(run_head, std::vector<std::string>{"head", "-n", std::to_string(lines)});
+}
+
+PipeLine head_bytes(size_t bytes) {
+  return stage(run_head, std::vector<std::string>{"head", "-c", std::to_string(bytes)});
+}
+
+PipeLine wc_l() {
+  return stage(run_wc_l, std::vector<std::string>{"wc", "-l"});
+}
+
+PipeLine split(size_t lines, std::string prefix) {
+  return stage(run_split, std::vector<std::string>{"split", "-l", std::to_string(lines), "-", std::move(prefix)});
+}
+} // namespace builtin
+} // namespace noshell
@@ -0,0 +1,252 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include <cstdlib>
+
+#include <noshell/utils.hpp>
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+namespace {
+// Key of a cache entry: two 64 bit FNV-1a style hashes
+class key_hasher {
+  uint64_t h1, h2;
+public:
+  key_hasher() : h1(0xcbf29ce484222325ULL), h2(0x84222325cbf29ce4ULL) { }
+  void add(const void* data, size_t len) {
+    const unsigned char* ptr = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < len; ++i) {
+      h1 = (h1 ^ ptr[i]) * 0x100000001b3ULL;
+      h2 = (h2 ^ ptr[i]) * 0x9e3779b97f4a7c15ULL;
+    }
+  }
+  void add(uint64_t x) { add(&x, sizeof(x)); }
+  // Length prefixed, so that ("ab", "c") and ("a", "bc") differ
+  void add(const std::string& s) {
+    add((uint64_t)s.size());
+    add(s.data(), s.size());
+  }
+  std::string hex() const {
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)h1, (unsigned long long)h2);
+    return buf;
+  }
+};
+
+// Identify the content of a file by its inode, size and modification
+// time. Return false if the file does not exist.
+bool add_file(key_hasher& hasher, const std::string& path) {
+  struct stat st;
+  if(stat(path.c_str(), &st) == -1) return false;
+  hasher.add(path);
+  hasher.add((uint64_t)st.st_dev);
+  hasher.add((uint64_t)st.st_ino);
+  hasher.add((uint64_t)st.st_size);
+  hasher.add((uint64_t)st.st_mtim.tv_sec);
+  hasher.add((uint64_t)st.st_mtim.tv_nsec);
+  return true;
+}
+
+std::string default_cache_dir() {
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  if(xdg && *xdg) return std::string(xdg) + "/noshell";
+  const char* home = getenv("HOME");
+  return std::string(home && *home ? home : "/tmp") + "/.cache/noshell";
+}
+
+bool make_dirs(const std::string& path) {
+  size_t pos = 0;
+  do {
+    pos = path.find('/', pos + 1);
+    const std::string dir = path.substr(0, pos);
+    if(mkdir(dir.c_str(), 0777) == -1 && errno != EEXIST) return false;
+  } while(pos != std::string::npos);
+  return true;
+}
+
+void remove_dir(const std::string& path) {
+  DIR* dir = opendir(path.c_str());
+  if(dir) {
+    while(struct dirent* ent = readdir(dir)) {
+      const std::string name = ent->d_name;
+      if(name != "." && name != "..")
+        unlink((path + '/' + name).c_str());
+    }
+    closedir(dir);
+  }
+  rmdir(path.c_str());
+}
+
+bool copy_fd(int in, int out) {
+  ssize_t res;
+  while((res = move_data(in, out, 1 << 20)) > 0) { }
+  return res == 0;
+}
+
+// Copy the file from into to, sharing the blocks (reflink) if the file
+// system supports it.
+bool copy_file(const std::string& from, const std::string& to) {
+  int in = open(from.c_str(), O_RDONLY|O_CLOEXEC);
+  if(in == -1) return false;
+  auto_close close_in(in);
+  int out = open(to.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+  if(out == -1) return false;
+  auto_close close_out(out);
+#ifdef FICLONE
+  if(ioctl(out, FICLONE, in) == 0) return true;
+#endif
+  return copy_fd(in, out);
+}
+
+bool read_all(int fd, void* buf, size_t len) {
+  char* ptr = static_cast<char*>(buf);
+  while(len > 0) {
+    const ssize_t res = read(fd, ptr, len);
+    if(res == -1 && errno == EINTR) continue;
+    if(res <= 0) return false;
+    ptr += res;
+    len -= res;
+  }
+  return true;
+}
+
+// The record of a run: the number of commands, then the status and
+// resource usage of each command.
+bool write_record(const std::string& path, const Exit& e) {
+  int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+  if(fd == -1) return false;
+  auto_close close_fd(fd);
+  const uint64_t nb = std::distance(e.begin(), e.end());
+  if(!write_all(fd, &nb, sizeof(nb))) return false;
+  for(const auto& h : e) {
+    if(!write_all(fd, &h.status().value, sizeof(int)) || !write_all(fd, &h.resources, sizeof(h.resources)))
+      return false;
+  }
+  return true;
+}
+
+bool read_record(const std::string& path, size_t nb, Exit& e) {
+  int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+  if(fd == -1) return false;
+  auto_close close_fd(fd);
+  uint64_t nb_read;
+  if(!read_all(fd, &nb_read, sizeof(nb_read)) || nb_read != nb) return false;
+  for(size_t i = 0; i < nb; ++i) {
+    Handle h;
+    int    status;
+    if(!read_all(fd, &status, sizeof(status)) || !read_all(fd, &h.resources, sizeof(h.resources)))
+      return false;
+    h.set_status(status);
+    h.cached = true;
+    e.push_handle(std::move(h));
+  }
+  return true;
+}
+} // namespace
+
+Exit PipeLine::run_cached(int fd_in, int fd_out) {
+  // Compute the key, and check that the pipeline can be cached
+  key_hasher               hasher;
+  std::vector<std::string> outputs; // Files redirected with '>'
+  bool                     capture = true; // Save the standard output
+  bool                     stdin_file = false; // Standard input redirected from a file, part of the key
+  char                     cwd[PATH_MAX];
+  if(fd_in != -1 || !getcwd(cwd, sizeof(cwd))) return start(fd_in, fd_out);
+  hasher.add(std::string(cwd));
+  for(size_t i = 0; i < commands.size(); ++i) {
+    const Command& cmd = commands[i];
+    if(cmd.fun || !cmd.attached.empty() || !cmd.setups.empty()) return start(fd_in, fd_out);
+    hasher.add((uint64_t)cmd.cmd->size());
+    for(const auto& arg : *cmd.cmd)
+      hasher.add(arg);
+    for(const auto& setter : cmd.setters) {
+      if(dynamic_cast<const death_signal_setter*>(setter.get())) continue;
+      auto path = dynamic_cast<const path_redirection_setter*>(setter.get());
+      if(!path || path->type == path_redirection_setter::APPEND) return start(fd_in, fd_out);
+      hasher.add((uint64_t)path->type);
+      for(const auto& fd : path->ft.from) {
+        hasher.add((uint64_t)fd.fd);
+        if(path->type == path_redirection_setter::READ && fd.fd == 0 && i == 0)
+          stdin_file = true;
+        if(path->type == path_redirection_setter::WRITE && fd.fd == 1 && i + 1 == commands.size())
+          capture = false;
+      }
+      if(path->type == path_redirection_setter::READ) {
+        if(!add_file(hasher, path->ft.to)) return start(fd_in, fd_out);
+      } else {
+        hasher.add(path->ft.to);
+        outputs.push_back(path->ft.to);
+      }
+    }
+  }
+  // The output may depend on whatever the inherited standard input holds
+  if(!stdin_file) return start(fd_in, fd_out);
+  for(const auto& var : cache->env) {
+    const char* value = getenv(var.c_str());
+    hasher.add(var);
+    hasher.add((uint64_t)(value != nullptr));
+    if(value) hasher.add(std::string(value));
+  }
+  for(const auto& input : cache->inputs)
+    if(!add_file(hasher, input)) return start(fd_in, fd_out);
+  hasher.add((uint64_t)capture);
+
+  const std::string dir       = cache->dir.empty() ? default_cache_dir() : cache->dir;
+  const std::string entry     = dir + '/' + hasher.hex();
+  const int         stdout_fd = fd_out == -1 ? 1 : fd_out;
+
+  // Hit: restore the outputs and the statuses
+  {
+    Exit ret;
+    bool hit = read_record(entry + "/exit", commands.size(), ret);
+    for(size_t i = 0; hit && i < outputs.size(); ++i)
+      hit = copy_file(entry + "/out." + std::to_string(i), outputs[i]);
+    if(hit && capture) {
+      int fd = open((entry + "/stdout").c_str(), O_RDONLY|O_CLOEXEC);
+      hit    = fd != -1 && copy_fd(fd, stdout_fd);
+      safe_close(fd);
+    }
+    if(hit) return ret;
+  }
+
+  // Miss: run, and save the outputs in a new entry
+  std::string tmp = dir + "/tmp.XXXXXX";
+  if(!make_dirs(dir) || !mkdtemp(&tmp[0])) {
+    Exit ret = start(-1, fd_out);
+    ret.wait();
+    return ret;
+  }
+  int out = -1;
+  if(capture) {
+    out = open((tmp + "/stdout").c_str(), O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+    if(out == -1) {
+      remove_dir(tmp);
+      Exit ret = start(-1, fd_out);
+      ret.wait();
+      return ret;
+    }
+  }
+  Exit ret = start(-1, capture ? out : fd_out);
+  ret.wait();
+  bool save = true;
+  if(capture) {
+    save = lseek(out, 0, SEEK_SET) == 0 && copy_fd(out, stdout_fd);
+    safe_close(out);
+  }
+  save = save && ret.success();
+  for(size_t i = 0; save && i < outputs.size(); ++i)
+    save = copy_file(outputs[i], tmp + "/out." + std::to_string(i));
+  save = save && write_record(tmp + "/exit", ret);
+  if(!save || rename(tmp.c_str(), entry.c_str()) == -1)
+    remove_dir(tmp);
+  return ret;
+}
+} // namespace noshell
@@ -0,0 +1,167 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+
+#include <noshell/handle.hpp>
+
+namespace noshell {
+namespace {
+// Content of the file name in the directory dirfd, empty on error
+std::string read_at(int dirfd, const char* name) {
+  std::string res;
+  const int   fd = openat(dirfd, name, O_RDONLY|O_CLOEXEC);
+  if(fd == -1) return res;
+  char buf[4096];
+  while(true) {
+    const ssize_t bytes = read(fd, buf, sizeof(buf));
+    if(bytes == -1 && errno == EINTR) continue;
+    if(bytes <= 0) break;
+    res.append(buf, bytes);
+  }
+  close(fd);
+  return res;
+}
+
+bool write_at(int dirfd, const char* name, const char* value) {
+  const int fd = openat(dirfd, name, O_WRONLY|O_CLOEXEC);
+  if(fd == -1) return false;
+  const size_t len = strlen(value);
+  const bool   res = write(fd, value, len) == (ssize_t)len;
+  const int    e   = errno;
+  close(fd);
+  errno = e;
+  return res;
+}
+
+CgroupStats read_stats(int dirfd) {
+  CgroupStats res;
+  const std::string cpu = read_at(dirfd, "cpu.stat"); // Always there
+  if(cpu.empty()) return res;
+  res.valid = true;
+
+  std::istringstream is(cpu);
+  std::string        key;
+  uint64_t           value;
+  while(is >> key >> value) {
+    if(key == "usage_usec")
+      res.cpu_usage = std::chrono::microseconds(value);
+    else if(key == "user_usec")
+      res.cpu_user = std::chrono::microseconds(value);
+    else if(key == "system_usec")
+      res.cpu_system = std::chrono::microseconds(value);
+  }
+
+  const std::string peak = read_at(dirfd, "memory.peak");
+  if(!peak.empty())
+    res.memory_peak = strtoll(peak.c_str(), nullptr, 10);
+
+  // Lines like "8:0 rbytes=1459200 wbytes=314773504 rios=192 wios=353 dbytes=0 dios=0"
+  std::istringstream io(read_at(dirfd, "io.stat"));
+  std::string        line;
+  while(std::getline(io, line)) {
+    CgroupStats::io_device dev = { 0, 0, 0, 0, 0, 0 };
+    std::istringstream     fields(line);
+    std::string            field;
+    if(!(fields >> field) || sscanf(field.c_str(), "%u:%u", &dev.major, &dev.minor) != 2) continue;
+    while(fields >> field) {
+      const size_t eq = field.find('=');
+      if(eq == std::string::npos) continue;
+      const uint64_t v    = strtoull(field.c_str() + eq + 1, nullptr, 10);
+      const auto     name = field.substr(0, eq);
+      if(name == "rbytes") dev.rbytes = v;
+      else if(name == "wbytes") dev.wbytes = v;
+      else if(name == "rios") dev.rios = v;
+      else if(name == "wios") dev.wios = v;
+    }
+    res.io.push_back(dev);
+  }
+  return res;
+}
+
+std::atomic<unsigned> sub_cgroups(0);
+} // namespace
+
+// The cgroup of an Exit. A sub-cgroup created for it is removed once
+// empty, after reading its final accounting.
+class cgroup_state {
+  std::string         path;
+  int                 fd;
+  bool                owned; // Created by open()
+  mutable std::mutex  mutex;
+  bool                released;
+  CgroupStats         final_stats;
+
+public:
+  cgroup_state(std::string p, int f, bool o) : path(std::move(p)), fd(f), owned(o), released(false) { }
+  ~cgroup_state() {
+    if(owned && !released) rmdir(path.c_str()); // Fails if some processes are left
+    close(fd);
+  }
+
+  static cgroup_state* open(const std::string& path, bool per_exit) {
+    std::string dir = path;
+    if(per_exit) {
+      dir += "/noshell-" + std::to_string(getpid()) + '-' + std::to_string(sub_cgroups++);
+      if(mkdir(dir.c_str(), 0755) == -1) return nullptr;
+    }
+    const int fd = ::open(dir.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(fd == -1) {
+      const int e = errno;
+      if(per_exit) rmdir(dir.c_str());
+      errno = e;
+      return nullptr;
+    }
+    return new cgroup_state(std::move(dir), fd, per_exit);
+  }
+
+  int dirfd() const { return fd; }
+  const std::string& dir() const { return path; }
+
+  CgroupStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return released ? final_stats : read_stats(fd);
+  }
+
+  // Only for a sub-cgroup of our own: a shared cgroup may hold other
+  // processes.
+  bool kill() { return owned && write_at(fd, "cgroup.kill", "1"); }
+
+  void release() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(released || !owned) return;
+    final_stats = read_stats(fd);
+    released    = rmdir(path.c_str()) == 0;
+  }
+};
+
+bool Exit::open_cgroup(const std::string& path, bool per_exit) {
+  cgroup_state* state = cgroup_state::open(path, per_exit);
+  if(!state) return false;
+  cgroup_.reset(state);
+  return true;
+}
+
+int Exit::cgroup_fd() const { return cgroup_ ? cgroup_->dirfd() : -1; }
+
+void Exit::release_cgroup() {
+  if(cgroup_) cgroup_->release();
+}
+
+bool Exit::kill_cgroup() { return cgroup_ && cgroup_->kill(); }
+
+CgroupStats Exit::cgroup_stats() const {
+  return cgroup_ ? cgroup_->stats() : CgroupStats();
+}
+
+std::string Exit::cgroup_path() const {
+  return cgroup_ ? cgroup_->dir() : std::string();
+}
+} // namespace noshell
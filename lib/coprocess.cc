@@ -0,0 +1,257 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <cstdint>
+
+#include <noshell/utils.hpp>
+#include <noshell/coprocess.hpp>
+#include <noshell/trace.hpp>
+
+namespace noshell {
+CoProcess::CoProcess(pipeline_factory f, framing fr)
+  : factory(std::move(f)), frame(std::move(fr)), in_fd(-1), out_fd(-1), alive(false)
+  , buffer(65536), data_start(0), data_end(0), scanned(0), starts(0), error_(0)
+{
+  start();
+}
+
+bool CoProcess::start() {
+  if(!frame.valid()) {
+    error_ = EINVAL;
+    return false;
+  }
+  PipeLine pl = factory();
+  status = (in_fd | pl | out_fd).run();
+  alive  = true;
+  ++starts;
+  for(const auto& h : status) {
+    if(h.setup_error()) {
+      error_ = h.err().value;
+      stop();
+      return false;
+    }
+  }
+  if(in_fd == -1 || out_fd == -1 || !set_nonblock(in_fd) || !set_nonblock(out_fd)) {
+    error_ = errno;
+    stop();
+    return false;
+  }
+  return true;
+}
+
+void CoProcess::stop() {
+  safe_close(in_fd);
+  safe_close(out_fd);
+  if(alive) {
+    status.wait();
+    alive = false;
+  }
+  data_start = data_end = scanned = 0;
+}
+
+// Extract a complete response from the buffer, if any. Return 1 if
+// found, 0 if incomplete, -1 if longer than frame.max.
+int CoProcess::parse_response(std::string& response) {
+  const char*  data  = buffer.data() + data_start;
+  const size_t avail = data_end - data_start;
+
+  switch(frame.type) {
+  case framing::DELIMITER: {
+    const char* delim = (const char*)memchr(data + scanned, frame.delim, avail - scanned);
+    if(!delim) {
+      scanned = avail;
+      return avail > frame.max ? too_long() : 0;
+    }
+    if((size_t)(delim - data) > frame.max) return too_long();
+    response.assign(data, delim - data);
+    data_start += delim - data + 1;
+    break;
+  }
+
+  case framing::LENGTH_PREFIX: {
+    if(avail < frame.size) return 0;
+    uint64_t len = 0;
+    for(size_t i = 0; i < frame.size; ++i)
+      len = (len << 8) | (unsigned char)data[i];
+    if(len > frame.max) return too_long();
+    if(avail - frame.size < len) return 0;
+    response.assign(data + frame.size, len);
+    data_start += frame.size + len;
+    break;
+  }
+
+  case framing::SENTINEL: // scanned is always at the start of a line
+    while(true) {
+      const char* line = data + scanned;
+      const char* nl   = (const char*)memchr(line, '\n', avail - scanned);
+      if(!nl) return scanned > frame.max ? too_long() : 0;
+      if((size_t)(nl - line) == frame.sentinel.size() && memcmp(line, frame.sentinel.data(), nl - line) == 0) {
+        if((size_t)(line - data) > frame.max) return too_long();
+        response.assign(data, line - data);
+        data_start += nl - data + 1;
+        break;
+      }
+      scanned = nl - data + 1;
+    }
+    break;
+  }
+
+  scanned = 0;
+  if(data_start == data_end)
+    data_start = data_end = 0;
+  return 1;
+}
+
+// Read more output from the co-process. Return false on end of file
+// or error.
+bool CoProcess::read_response() {
+  if(data_start > 0) {
+    memmove(buffer.data(), buffer.data() + data_start, data_end - data_start);
+    data_end   -= data_start;
+    data_start = 0;
+  }
+  if(data_end == buffer.size()) {
+    // Larger than any response of at most frame.max bytes with its framing
+    if(data_end > frame.max + frame.size + frame.sentinel.size() + 1) {
+      too_long();
+      return false;
+    }
+    buffer.resize(2 * buffer.size());
+  }
+  const ssize_t res = read(out_fd, buffer.data() + data_end, buffer.size() - data_end);
+  trace::record_io(trace::READ, out_fd, res);
+  if(res == -1 && (errno == EINTR || errno == EAGAIN)) return true;
+  if(res <= 0) {
+    error_ = res == 0 ? EPIPE : errno;
+    return false;
+  }
+  data_end += res;
+  return true;
+}
+
+// Write the request while reading the response, so that neither side
+// blocks on a full pipe. Return 1 on success, 0 if the co-process
+// exited before any of the request was written, -1 otherwise.
+int CoProcess::exchange(const char* data, size_t len, std::string& response) {
+  unsigned char prefix[8];
+  char          trailer = frame.delim;
+  struct iovec  iov[2];
+  int           iovcnt = 1;
+  iov[0].iov_base = const_cast<char*>(data);
+  iov[0].iov_len  = len;
+  switch(frame.type) {
+  case framing::LENGTH_PREFIX:
+    for(size_t i = 0; i < frame.size; ++i)
+      prefix[i] = (uint64_t)len >> (8 * (frame.size - 1 - i));
+    iov[1]          = iov[0];
+    iov[0].iov_base = prefix;
+    iov[0].iov_len  = frame.size;
+    iovcnt          = 2;
+    break;
+  case framing::SENTINEL:
+    if(len > 0 && data[len - 1] == '\n') break;
+    // Fall through
+  case framing::DELIMITER:
+    iov[1].iov_base = &trailer;
+    iov[1].iov_len  = 1;
+    iovcnt          = 2;
+    break;
+  }
+
+  struct iovec* cur     = iov;
+  bool          written = false; // Some of the request was written
+  while(true) {
+    while(iovcnt > 0 && cur->iov_len == 0) {
+      ++cur;
+      --iovcnt;
+    }
+    if(iovcnt > 0) {
+      const ssize_t res = writev(in_fd, cur, iovcnt);
+      trace::record_io(trace::WRITE, in_fd, res);
+      if(res == -1 && errno == EINTR) continue;
+      if(res == -1 && errno != EAGAIN) {
+        error_ = errno;
+        return written || errno != EPIPE ? -1 : 0;
+      }
+      if(res > 0) {
+        written = true;
+        for(size_t left = res; left > 0; ) {
+          const size_t n = std::min(left, cur->iov_len);
+          cur->iov_base  = (char*)cur->iov_base + n;
+          cur->iov_len  -= n;
+          left          -= n;
+          if(cur->iov_len == 0) {
+            ++cur;
+            --iovcnt;
+          }
+        }
+        continue;
+      }
+    } else if(const int res = parse_response(response)) {
+      return res;
+    }
+
+    struct pollfd pfds[2] = { { out_fd, POLLIN, 0 }, { in_fd, POLLOUT, 0 } };
+    if(poll(pfds, iovcnt > 0 ? 2 : 1, -1) == -1) {
+      if(errno == EINTR) continue;
+      error_ = errno;
+      return -1;
+    }
+    if(pfds[0].revents && !read_response())
+      return written || error_ == EMSGSIZE ? -1 : 0;
+  }
+}
+
+bool CoProcess::request(const char* data, size_t len, std::string& response) {
+  if(!frame.fits(len)) {
+    error_ = EMSGSIZE;
+    return false;
+  }
+  for(int attempt = 0; attempt < 2; ++attempt) {
+    if(!alive && !start()) return false; // Not under block_sigpipe: inherited by the children
+    int res;
+    {
+      block_sigpipe sigpipe;
+      res = exchange(data, len, response);
+    }
+    if(res == 1) {
+      error_ = 0;
+      return true;
+    }
+    stop();
+    if(res == -1) return false;
+    // The co-process was gone before reading the request: retry once
+    // on a new one.
+  }
+  return false;
+}
+
+CoProcessPool::CoProcessPool(size_t n, pipeline_factory f, framing fr) {
+  for(size_t i = 0; i < std::max(n, (size_t)1); ++i)
+    slots.push_back(std::unique_ptr<slot>(new slot(f, fr)));
+}
+
+bool CoProcessPool::request(const char* data, size_t len, std::string& response) {
+  slot* s;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    s = slots.front().get();
+    for(const auto& it : slots)
+      if(it->busy < s->busy)
+        s = it.get();
+    ++s->busy;
+  }
+
+  bool res;
+  {
+    std::lock_guard<std::mutex> guard(s->lock);
+    res = s->process.request(data, len, response);
+  }
+
+  std::lock_guard<std::mutex> guard(mutex);
+  --s->busy;
+  return res;
+}
+} // namespace noshell
@@ -0,0 +1,149 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include <thread>
+
+#include <noshell/utils.hpp>
+#include <noshell/noshell.hpp>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+namespace noshell {
+// Background thread polling the pidfds of the commands of a pipeline.
+// It has its own pidfds and never reaps the children (WNOWAIT): the
+// status is still collected by Exit::wait().
+class failure_watcher {
+  std::vector<int>  pidfds;
+  std::vector<bool> exited;
+  const bool        ignore_sigpipe;
+  const int         sig;
+  int               stop_pipe[2];
+  std::thread       thread;
+
+  // Peek at the status of command i. Return true if it exited.
+  bool peek(size_t i, siginfo_t& info) {
+    memset(&info, 0, sizeof(info));
+    while(waitid((idtype_t)P_PIDFD, pidfds[i], &info, WEXITED|WNOWAIT|WNOHANG) == -1) {
+      if(errno != EINTR) return true; // Already reaped
+    }
+    return info.si_pid != 0;
+  }
+
+  bool failed(const siginfo_t& info) const {
+    switch(info.si_code) {
+    case CLD_EXITED: return info.si_status != 0;
+    case CLD_KILLED:
+    case CLD_DUMPED: return !(ignore_sigpipe && info.si_status == SIGPIPE);
+    default: return false;
+    }
+  }
+
+  void run() {
+    std::vector<pollfd> pfds;
+    std::vector<size_t> ids;
+    while(true) {
+      pfds.assign(1, pollfd{stop_pipe[0], POLLIN, 0});
+      ids.clear();
+      for(size_t i = 0; i < pidfds.size(); ++i) {
+        if(exited[i]) continue;
+        pfds.push_back(pollfd{pidfds[i], POLLIN, 0});
+        ids.push_back(i);
+      }
+      if(ids.empty()) return;
+      if(poll(pfds.data(), pfds.size(), -1) == -1) {
+        if(errno == EINTR) continue;
+        return;
+      }
+      if(pfds[0].revents) return;
+
+      for(size_t j = 0; j < ids.size(); ++j) {
+        siginfo_t info;
+        if(!pfds[j + 1].revents || !peek(ids[j], info)) continue;
+        exited[ids[j]] = true;
+        if(failed(info)) {
+          abort_others();
+          return;
+        }
+      }
+    }
+  }
+
+  void abort_others() {
+#ifdef SYS_pidfd_send_signal
+    for(size_t i = 0; i < pidfds.size(); ++i) {
+      siginfo_t info;
+      if(exited[i] || peek(i, info)) continue;
+      if(syscall(SYS_pidfd_send_signal, pidfds[i], sig, nullptr, 0) != -1)
+        aborted[i] = true;
+    }
+#endif
+  }
+
+public:
+  std::vector<bool> aborted;
+
+  failure_watcher(bool i, int s) : ignore_sigpipe(i), sig(s), stop_pipe{-1, -1} { }
+  ~failure_watcher() {
+    for(auto& fd : pidfds)
+      safe_close(fd);
+    safe_close(stop_pipe[0]);
+    safe_close(stop_pipe[1]);
+  }
+
+  // Open the pidfds and start the thread. Return false on failure.
+  bool start(const std::vector<pid_t>& pids) {
+#if defined(SYS_pidfd_open) && defined(SYS_pidfd_send_signal)
+    for(auto pid : pids) {
+      const int fd = pid > 0 ? syscall(SYS_pidfd_open, pid, 0) : -1;
+      if(pid > 0 && fd == -1) return false;
+      pidfds.push_back(fd);
+      exited.push_back(fd == -1);
+    }
+    aborted.assign(pids.size(), false);
+    if(pipe2(stop_pipe, O_CLOEXEC) == -1) return false;
+    try {
+      thread = std::thread(&failure_watcher::run, this);
+    } catch(...) {
+      return false;
+    }
+    return true;
+#else
+    errno = ENOSYS;
+    return false;
+#endif
+  }
+
+  void join(bool stop) {
+    if(!thread.joinable()) return;
+    if(stop) {
+      const char c = 0;
+      write_all(stop_pipe[1], &c, 1);
+    }
+    thread.join();
+  }
+};
+
+bool Exit::watch_failures(bool ignore_sigpipe, int sig) {
+  std::vector<pid_t> pids;
+  for(const auto& h : handles)
+    pids.push_back(h.running() ? h.pid : -1);
+  std::shared_ptr<failure_watcher> w(new failure_watcher(ignore_sigpipe, sig));
+  if(!w->start(pids)) return false;
+  watcher = std::move(w);
+  return true;
+}
+
+void Exit::join_watcher(bool stop) {
+  if(!watcher) return;
+  watcher->join(stop);
+  for(size_t i = 0; i < handles.size(); ++i)
+    handles[i].aborted = handles[i].aborted || watcher->aborted[i];
+  watcher.reset();
+}
+} // namespace noshell
@@ -0,0 +1,133 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <cstdlib>
+
+#include <noshell/utils.hpp>
+#include <noshell/fan_in.hpp>
+
+namespace noshell {
+namespace {
+// Move exactly len bytes, which are known to be available in in.
+bool move_all(int in, int out, size_t len) {
+  while(len > 0) {
+    const ssize_t res = move_data(in, out, len);
+    if(res <= 0) return false;
+    len -= res;
+  }
+  return true;
+}
+
+int merge_concat(const std::vector<int>& fds) {
+  for(auto fd : fds) {
+    ssize_t res;
+    while((res = move_data(fd, 1, 1 << 16)) > 0) { }
+    if(res == -1) return 1;
+  }
+  return 0;
+}
+
+struct merge_input {
+  int               fd;
+  std::vector<char> buf;
+  size_t            len;
+  merge_input(int f, size_t size) : fd(f), buf(size), len(0) { }
+};
+
+// Handle data available on input in. Return 1 if data was
+// transferred, 0 on end of file and -1 on error.
+int merge_lines(merge_input& in) {
+  if(in.len == in.buf.size())
+    in.buf.resize(2 * in.buf.size()); // Line longer than the buffer
+  const ssize_t res = read(in.fd, in.buf.data() + in.len, in.buf.size() - in.len);
+  if(res == -1) return errno == EINTR ? 1 : -1;
+  if(res == 0) { // Output partial last line, if any, with a newline
+    if(in.len > 0) // Room left by the resize above
+      in.buf[in.len++] = '\n';
+    return write_all(1, in.buf.data(), in.len) ? 0 : -1;
+  }
+
+  const char* nl = (const char*)memrchr(in.buf.data() + in.len, '\n', res);
+  in.len += res;
+  if(!nl) return 1;
+  const size_t full = nl - in.buf.data() + 1;
+  if(!write_all(1, in.buf.data(), full)) return -1;
+  memmove(in.buf.data(), in.buf.data() + full, in.len - full);
+  in.len -= full;
+  return 1;
+}
+
+int merge_records(merge_input& in, size_t record_size) {
+  int available = 0;
+  if(in.len == 0 && ioctl(in.fd, FIONREAD, &available) != -1 && (size_t)available >= record_size) {
+    // Whole records available in the pipe: move without copy
+    const size_t full = ((size_t)available / record_size) * record_size;
+    return move_all(in.fd, 1, full) ? 1 : -1;
+  }
+
+  // Accumulate a partial record
+  const ssize_t res = read(in.fd, in.buf.data() + in.len, record_size - in.len);
+  if(res == -1) return errno == EINTR ? 1 : -1;
+  if(res == 0)
+    return write_all(1, in.buf.data(), in.len) ? 0 : -1;
+  in.len += res;
+  if(in.len == record_size) {
+    if(!write_all(1, in.buf.data(), in.len)) return -1;
+    in.len = 0;
+  }
+  return 1;
+}
+
+int merge_interleave(const std::vector<int>& fds, FanIn::merge_type type, size_t record_size) {
+  std::vector<merge_input> inputs;
+  for(auto fd : fds)
+    inputs.push_back(merge_input(fd, type == FanIn::LINES ? 65536 : record_size));
+
+  std::vector<pollfd> pfds;
+  while(!inputs.empty()) {
+    pfds.resize(inputs.size());
+    for(size_t i = 0; i < inputs.size(); ++i) {
+      pfds[i].fd     = inputs[i].fd;
+      pfds[i].events = POLLIN;
+    }
+    if(poll(pfds.data(), pfds.size(), -1) == -1) {
+      if(errno == EINTR) continue;
+      return 1;
+    }
+
+    for(size_t i = pfds.size(); i > 0; --i) {
+      if(!pfds[i - 1].revents) continue;
+      auto& in = inputs[i - 1];
+      const int res = type == FanIn::LINES ? merge_lines(in) : merge_records(in, record_size);
+      if(res == -1) return 1;
+      if(res == 0) {
+        safe_close(in.fd);
+        inputs.erase(inputs.begin() + (i - 1));
+      }
+    }
+  }
+  return 0;
+}
+} // namespace
+
+PipeLine FanIn::pipeline() const {
+  const merge_type type        = this->type;
+  const size_t     record_size = this->record_size;
+  auto merge = [=](const std::vector<std::string>& args) -> int {
+    static const size_t prefix = strlen("/dev/fd/");
+    std::vector<int> fds;
+    for(size_t i = 1; i < args.size(); ++i)
+      fds.push_back(atoi(args[i].c_str() + prefix));
+    return type == CONCAT ? merge_concat(fds) : merge_interleave(fds, type, record_size);
+  };
+
+  std::vector<std::string> args(1, "fan_in");
+  args.resize(inputs.size() + 1);
+  Command cmd(merge, std::move(args));
+  for(size_t i = 0; i < inputs.size(); ++i)
+    cmd.attach(attached_pipeline(inputs[i], true, i + 1));
+  return PipeLine(std::move(cmd));
+}
+} // namespace noshell
@@ -0,0 +1,91 @@
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+#include <vector>
+
+#include <noshell/fork_exclusions.hpp>
+
+namespace noshell {
+namespace {
+struct region {
+  void*                 user_addr; // As registered
+  void*                 addr;      // Page aligned
+  size_t                len;
+  fork_exclusions::mode mode;
+};
+
+std::mutex          mutex;
+std::vector<region> regions;
+std::atomic<size_t> nb_regions(0); // Fast path when none
+size_t              active = 0;    // Forks in progress
+
+int advice(fork_exclusions::mode m, bool exclude) {
+  if(m == fork_exclusions::WIPEONFORK) {
+#if defined(MADV_WIPEONFORK) && defined(MADV_KEEPONFORK)
+    return exclude ? MADV_WIPEONFORK : MADV_KEEPONFORK;
+#else
+    return -1;
+#endif
+  }
+  return exclude ? MADV_DONTFORK : MADV_DOFORK;
+}
+
+bool apply(const region& r, bool exclude) {
+  const int a = advice(r.mode, exclude);
+  if(a == -1) {
+    errno = EINVAL;
+    return false;
+  }
+  return madvise(r.addr, r.len, a) == 0;
+}
+} // namespace
+
+bool fork_exclusions::add(void* addr, size_t len, mode m) {
+  const uintptr_t page  = sysconf(_SC_PAGESIZE);
+  const uintptr_t start = ((uintptr_t)addr + page - 1) & ~(page - 1);
+  const uintptr_t end   = ((uintptr_t)addr + len) & ~(page - 1);
+  if(end <= start) return true; // Less than a page, nothing to exclude
+  const region r = { addr, (void*)start, end - start, m };
+
+  std::lock_guard<std::mutex> lock(mutex);
+  // Check that the advice applies to the region
+  if(!apply(r, true)) return false;
+  if(!active) apply(r, false);
+  regions.push_back(r);
+  ++nb_regions;
+  return true;
+}
+
+bool fork_exclusions::remove(void* addr) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = std::find_if(regions.begin(), regions.end(), [=](const region& r) { return r.user_addr == addr; });
+  if(it == regions.end()) return false;
+  if(active) apply(*it, false);
+  regions.erase(it);
+  --nb_regions;
+  return true;
+}
+
+size_t fork_exclusions::size() { return nb_regions.load(std::memory_order_relaxed); }
+
+bool fork_exclusions::enter() {
+  if(nb_regions.load(std::memory_order_relaxed) == 0) return false;
+  std::lock_guard<std::mutex> lock(mutex);
+  if(active++ == 0)
+    for(const auto& r : regions)
+      apply(r, true);
+  return true;
+}
+
+void fork_exclusions::leave() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if(--active == 0)
+    for(const auto& r : regions)
+      apply(r, false);
+}
+} // namespace noshell
@@ -0,0 +1,69 @@
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <noshell/utils.hpp>
+#include <noshell/graph.hpp>
+#include <noshell/spawn_policy.hpp>
+
+namespace noshell {
+size_t Graph::add(PipeLine&& pl) {
+  const size_t first = nodes.size();
+  for(auto& it : pl.commands) {
+    if(nodes.size() > first)
+      edges.push_back(edge{nodes.size() - 1, 1, nodes.size(), 0});
+    nodes.push_back(std::move(it));
+  }
+  pl.commands.clear();
+  return first;
+}
+
+bool Graph::connect(size_t from, int from_fd, size_t to, int to_fd) {
+  if(from >= nodes.size() || to >= nodes.size()) return false;
+  for(const auto& it : edges) {
+    if((it.from_node == from && it.from_fd == from_fd) || (it.to_node == to && it.to_fd == to_fd))
+      return false;
+  }
+  edges.push_back(edge{from, from_fd, to, to_fd});
+  return true;
+}
+
+Exit Graph::run() {
+  std::vector<setup_list_type> setups(nodes.size());
+  std::vector<Handle>          failed(nodes.size());
+
+  // Create all the pipes. Each end is owned by the setup of its node
+  // and closed in the parent as soon as the node is started.
+  for(const auto& it : edges) {
+    int fds[2];
+    if(retry_pipe2(fds, O_CLOEXEC) == -1) {
+      const int e = errno;
+      for(auto n : { it.from_node, it.to_node }) {
+        failed[n].message = "Failed to create pipe for graph edge";
+        failed[n].set_errno(e);
+      }
+      continue;
+    }
+    setups[it.from_node].push_front(std::unique_ptr<process_setup>(new owned_fd_redirection(it.from_fd, fds[1])));
+    setups[it.to_node].push_front(std::unique_ptr<process_setup>(new owned_fd_redirection(it.to_fd, fds[0])));
+    nodes[it.from_node].redirected.insert(it.from_fd);
+    nodes[it.to_node].redirected.insert(it.to_fd);
+  }
+
+  Exit ret;
+  for(size_t i = 0; i < nodes.size(); ++i) {
+    if(failed[i].setup_error()) {
+      setups[i].clear(); // Close the ends of the other pipes of the node
+      ret.push_handle(std::move(failed[i]));
+    } else {
+      ret.push_handle(nodes[i].run(std::move(setups[i])));
+    }
+  }
+  return ret;
+}
+
+Exit Graph::run_wait() {
+  Exit ret = run();
+  ret.wait();
+  return ret;
+}
+} // namespace noshell
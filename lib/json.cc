@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <ostream>
+#include <string>
+
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+namespace {
+// Append JSON to a string, without intermediate allocations
+struct json_writer {
+  std::string& out;
+  explicit json_writer(std::string& o) : out(o) { }
+
+  void str(const char* s, size_t len) {
+    out += '"';
+    for(size_t i = 0; i < len; ++i) {
+      const unsigned char c = s[i];
+      switch(c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if(c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else {
+          out += c;
+        }
+      }
+    }
+    out += '"';
+  }
+  void str(const char* s) { str(s, strlen(s)); }
+  void str(const std::string& s) { str(s.data(), s.size()); }
+  void key(const char* k) {
+    out += '"';
+    out += k;
+    out += "\":";
+  }
+  void num(long long v) {
+    char buf[24];
+    out.append(buf, snprintf(buf, sizeof(buf), "%lld", v));
+  }
+  void boolean(bool b) { out += b ? "true" : "false"; }
+  void field(const char* k, long long v) { key(k); num(v); out += ','; }
+  void field(const char* k, bool v) { key(k); boolean(v); out += ','; }
+  // Remove the trailing comma of the last field
+  void close(char c) {
+    if(out.back() == ',') out.back() = c;
+    else out += c;
+  }
+};
+
+void write_signal_name(json_writer& w, int sig) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 32))
+  const char* abbrev = sigabbrev_np(sig);
+  if(abbrev) {
+    w.out += "\"SIG";
+    w.out += abbrev;
+    w.out += '"';
+    return;
+  }
+#endif
+  w.str(strsignal(sig));
+}
+
+void write_exit(json_writer& w, const Exit& e);
+
+void write_handle(json_writer& w, const Handle& h) {
+  w.out += '{';
+  w.key("argv");
+  w.out += '[';
+  if(h.argv) {
+    for(const auto& a : *h.argv) {
+      w.str(a);
+      w.out += ',';
+    }
+  }
+  w.close(']');
+  w.out += ',';
+  w.field("pid", (long long)h.pid);
+  w.field("success", h.success());
+  if(h.setup_error()) {
+    w.key("error");
+    w.out += '{';
+    w.field("errno", (long long)h.err().value);
+    w.key("message");
+    w.str(h.what());
+    w.out += "},";
+  } else if(h.have_status()) {
+    if(h.status().exited()) {
+      w.field("exit_status", (long long)h.status().exit_status());
+    } else if(h.status().signaled()) {
+      w.field("signal", (long long)h.status().term_sig());
+      w.key("signal_name");
+      write_signal_name(w, h.status().term_sig());
+      w.out += ',';
+      w.field("core_dump", h.status().core_dump());
+    }
+  }
+  if(h.aborted) w.field("aborted", true);
+  if(h.cached) w.field("cached", true);
+  const std::chrono::steady_clock::time_point epoch;
+  if(h.started != epoch && h.ended != epoch)
+    w.field("wall_us", (long long)std::chrono::duration_cast<std::chrono::microseconds>(h.ended - h.started).count());
+
+  if(h.have_status()) {
+    const struct rusage& r = h.resources;
+    w.key("rusage");
+    w.out += '{';
+    w.field("user_us", (long long)h.user_time().count());
+    w.field("system_us", (long long)h.system_time().count());
+    w.field("max_rss_kb", (long long)r.ru_maxrss);
+    w.field("minor_faults", (long long)r.ru_minflt);
+    w.field("major_faults", (long long)r.ru_majflt);
+    w.field("in_blocks", (long long)r.ru_inblock);
+    w.field("out_blocks", (long long)r.ru_oublock);
+    w.field("voluntary_switches", (long long)r.ru_nvcsw);
+    w.field("involuntary_switches", (long long)r.ru_nivcsw);
+    w.close('}');
+    w.out += ',';
+  }
+
+  if(!h.attached.empty()) {
+    w.key("attached");
+    w.out += '[';
+    for(const auto& a : h.attached) {
+      write_exit(w, *a);
+      w.out += ',';
+    }
+    w.close(']');
+    w.out += ',';
+  }
+  w.close('}');
+}
+
+void write_exit(json_writer& w, const Exit& e) {
+  w.out += '{';
+  w.field("success", e.success());
+  w.key("stages");
+  w.out += '[';
+  for(const auto& h : e) {
+    write_handle(w, h);
+    w.out += ',';
+  }
+  w.close(']');
+  w.out += '}';
+}
+} // namespace
+
+std::string Exit::to_json() const {
+  std::string res;
+  res.reserve(512 * handles.size() + 32);
+  json_writer w(res);
+  write_exit(w, *this);
+  return res;
+}
+
+bool Exit::write_json(std::ostream& os) const {
+  const std::string json = to_json();
+  os.write(json.data(), json.size());
+  return os.good();
+}
+} // namespace noshell
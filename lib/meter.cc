@@ -0,0 +1,182 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#include <noshell/utils.hpp>
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+// Background thread relaying the data between the commands of a
+// pipeline with splice(2), counting the bytes. Both ends of a relay are
+// non blocking, and the thread polls all of them. When the reader of a
+// relay exits, its input is closed so the writer gets SIGPIPE.
+class link_meter {
+  typedef std::chrono::steady_clock clock;
+  struct relay {
+    int               in, out;
+    link_stat         stat;
+    clock::time_point first, window_start;
+    uint64_t          window_bytes;
+  };
+  static constexpr std::chrono::milliseconds window = std::chrono::milliseconds(100);
+
+  std::vector<relay> relays;
+  int                stop_pipe[2];
+  std::thread        thread;
+  mutable std::mutex mutex; // Protects the stats
+
+  void account(relay& r, size_t bytes) {
+    const auto now = clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    if(r.stat.bytes == 0)
+      r.first = r.window_start = now;
+    r.stat.bytes   += bytes;
+    r.stat.duration = std::chrono::duration_cast<std::chrono::microseconds>(now - r.first);
+    r.window_bytes += bytes;
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - r.window_start);
+    if(elapsed >= window) {
+      r.stat.peak_rate = std::max(r.stat.peak_rate, (double)r.window_bytes / elapsed.count());
+      r.window_start   = now;
+      r.window_bytes   = 0;
+    }
+  }
+
+  void finish(relay& r) {
+    safe_close(r.in);
+    safe_close(r.out);
+    std::lock_guard<std::mutex> lock(mutex);
+    r.stat.done = true;
+    if(r.stat.peak_rate == 0) // Shorter than a window
+      r.stat.peak_rate = r.stat.rate();
+  }
+
+  // Move as much data as possible from in to out
+  void pump(relay& r) {
+    while(true) {
+      const ssize_t res = splice(r.in, nullptr, r.out, nullptr, 1 << 20, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+      if(res > 0) {
+        account(r, res);
+        continue;
+      }
+      if(res == -1 && errno == EINTR) continue;
+      if(res == -1 && errno == EAGAIN) return;
+      if(res == -1 && errno == EPIPE) { // Consume the SIGPIPE sent to this thread
+        sigset_t        set;
+        struct timespec zero = { 0, 0 };
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        sigtimedwait(&set, nullptr, &zero);
+      }
+      finish(r); // End of file, or error
+      return;
+    }
+  }
+
+  void run() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    std::vector<struct pollfd> pfds;
+    std::vector<relay*>        active;
+    while(true) {
+      pfds.assign(1, pollfd{stop_pipe[0], POLLIN, 0});
+      active.clear();
+      for(auto& r : relays) {
+        if(r.in == -1) continue;
+        pump(r);
+        if(r.in == -1) continue;
+        // Wait for data if the input is empty, otherwise for room in the
+        // output. POLLERR is reported on out when its reader exits. The
+        // input is left out while data is pending, as POLLHUP would be
+        // reported on it once the writer exits.
+        int avail = 0;
+        const bool pending = ioctl(r.in, FIONREAD, &avail) == 0 && avail > 0;
+        pfds.push_back(pollfd{pending ? -1 : r.in, POLLIN, 0});
+        pfds.push_back(pollfd{r.out, (short)(pending ? POLLOUT : 0), 0});
+        active.push_back(&r);
+      }
+      if(active.empty()) return;
+
+      int res;
+      while((res = poll(pfds.data(), pfds.size(), -1)) == -1 && errno == EINTR) { }
+      if(res == -1 || pfds[0].revents) return; // Stopped, or error
+      for(size_t i = 0; i < active.size(); ++i)
+        if(pfds[2 * i + 2].revents & POLLERR) // The reader exited: drop the data
+          finish(*active[i]);
+    }
+  }
+
+public:
+  link_meter() : stop_pipe{-1, -1} { }
+  ~link_meter() {
+    join();
+    safe_close(stop_pipe[0]);
+    safe_close(stop_pipe[1]);
+  }
+
+  void add(int in, int out) {
+    fcntl(in, F_SETFL, fcntl(in, F_GETFL) | O_NONBLOCK);
+    fcntl(out, F_SETFL, fcntl(out, F_GETFL) | O_NONBLOCK);
+    relays.push_back(relay{in, out, link_stat(), clock::time_point(), clock::time_point(), 0});
+  }
+
+  bool start() {
+    if(pipe2(stop_pipe, O_CLOEXEC) == -1) return false;
+    try {
+      thread = std::thread(&link_meter::run, this);
+    } catch(...) {
+      return false;
+    }
+    return true;
+  }
+
+  // Stop relaying and close the pipes
+  void join() {
+    if(thread.joinable()) {
+      const char c = 0;
+      write_all(stop_pipe[1], &c, 1);
+      thread.join();
+    }
+    for(auto& r : relays)
+      if(r.in != -1) finish(r);
+  }
+
+  std::vector<link_stat> stats() const {
+    std::vector<link_stat>      res;
+    std::lock_guard<std::mutex> lock(mutex);
+    for(const auto& r : relays)
+      res.push_back(r.stat);
+    return res;
+  }
+};
+constexpr std::chrono::milliseconds link_meter::window;
+
+bool Exit::start_meter(std::vector<std::pair<int, int>>&& links) {
+  join_meter();
+  std::shared_ptr<link_meter> m(new link_meter);
+  for(const auto& l : links)
+    m->add(l.first, l.second);
+  links.clear();
+  const bool res = m->start();
+  if(!res) m->join(); // Close the pipes now
+  meter_         = std::move(m);
+  return res;
+}
+
+void Exit::join_meter() {
+  if(meter_) meter_->join();
+}
+
+std::vector<link_stat> Exit::link_stats() const {
+  return meter_ ? meter_->stats() : std::vector<link_stat>();
+}
+} // namespace noshell
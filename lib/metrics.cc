@@ -0,0 +1,73 @@
+#include <string.h>
+
+#include <string>
+
+#include <noshell/metrics.hpp>
+
+namespace noshell {
+metrics_registry global_metrics;
+constexpr int64_t metrics_registry::bounds[];
+
+namespace {
+// Symbolic name of an errno, or its number
+std::string errno_name(int err) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 32))
+  const char* name = strerrorname_np(err);
+  if(name) return name;
+#endif
+  return std::to_string(err);
+}
+} // namespace
+
+metrics_snapshot metrics_registry::snapshot() const {
+  metrics_snapshot res;
+  res.spawns         = spawns_.load(std::memory_order_relaxed);
+  res.spawn_failures = spawn_failures_.load(std::memory_order_relaxed);
+  for(size_t i = 0; i < nb_errnos; ++i) {
+    const uint64_t nb = failures_by_errno_[i].load(std::memory_order_relaxed);
+    if(nb) res.failures_by_errno.emplace_back((int)i, nb);
+  }
+  for(size_t i = 0; i < nb_buckets; ++i) {
+    if(i < nb_buckets - 1) res.latency_bounds.push_back(bounds[i] / 1e9);
+    res.latency_buckets.push_back(latency_buckets_[i].load(std::memory_order_relaxed));
+  }
+  res.latency_sum = latency_sum_.load(std::memory_order_relaxed) / 1e9;
+  res.running     = running_.load(std::memory_order_relaxed);
+  res.fds_held    = fds_held_.load(std::memory_order_relaxed);
+  res.reaped      = reaped_.load(std::memory_order_relaxed);
+  return res;
+}
+
+bool metrics_registry::write_prometheus(std::ostream& os) const {
+  const metrics_snapshot s = snapshot();
+  auto header = [&](const char* name, const char* type, const char* help) {
+    os << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+  };
+
+  header("noshell_spawns_total", "counter", "Commands started.");
+  os << "noshell_spawns_total " << s.spawns << '\n';
+  header("noshell_spawn_failures_total", "counter", "Commands which failed to start, by errno.");
+  for(const auto& f : s.failures_by_errno)
+    os << "noshell_spawn_failures_total{errno=\"" << errno_name(f.first) << "\"} " << f.second << '\n';
+  header("noshell_exec_latency_seconds", "histogram", "Time from fork to exec.");
+  uint64_t count = 0;
+  for(size_t i = 0; i < s.latency_buckets.size(); ++i) {
+    count += s.latency_buckets[i];
+    os << "noshell_exec_latency_seconds_bucket{le=\"";
+    if(i < s.latency_bounds.size())
+      os << s.latency_bounds[i];
+    else
+      os << "+Inf";
+    os << "\"} " << count << '\n';
+  }
+  os << "noshell_exec_latency_seconds_sum " << s.latency_sum << '\n'
+     << "noshell_exec_latency_seconds_count " << count << '\n';
+  header("noshell_running_children", "gauge", "Children started and not yet waited for.");
+  os << "noshell_running_children " << s.running << '\n';
+  header("noshell_fds_held", "gauge", "File descriptors opened for redirections and not yet closed.");
+  os << "noshell_fds_held " << s.fds_held << '\n';
+  header("noshell_reaped_total", "counter", "Children waited for.");
+  os << "noshell_reaped_total " << s.reaped << '\n';
+  return os.good();
+}
+} // namespace noshell
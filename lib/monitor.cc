@@ -0,0 +1,480 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#include <noshell/utils.hpp>
+#include <noshell/noshell.hpp>
+
+namespace noshell {
+// Last sample of a command, shared by its Handle and the monitor
+struct monitor_slot {
+  std::mutex             mutex;
+  live_resources         resources;
+  resource_budget::limit exceeded;
+  monitor_slot() : exceeded(resource_budget::NONE) { }
+};
+
+namespace {
+// Content of /proc/<pid>/<name>, empty on error
+std::string read_proc(pid_t pid, const char* name) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, name);
+  int fd = open(path, O_RDONLY|O_CLOEXEC);
+  if(fd == -1) return std::string();
+  auto_close  close_fd(fd);
+  std::string res;
+  char        buf[4096];
+  while(true) {
+    const ssize_t len = read(fd, buf, sizeof(buf));
+    if(len == -1 && errno == EINTR) continue;
+    if(len <= 0) break;
+    res.append(buf, len);
+  }
+  return res;
+}
+
+// Value of the field "name: value" in the content of a /proc file
+uint64_t proc_field(const std::string& content, const char* name) {
+  const size_t pos = content.find(name);
+  return pos == std::string::npos ? 0 : strtoull(content.c_str() + pos + strlen(name), nullptr, 10);
+}
+
+// Sample the resource usage of pid from /proc. Return false if it
+// exited (or is a zombie). cpu_percent is left untouched.
+bool sample_proc(pid_t pid, long clock_ticks, long page_size, live_resources& res) {
+  const std::string stat  = read_proc(pid, "stat");
+  const size_t      paren = stat.rfind(')');
+  char              state;
+  unsigned long     utime, stime;
+  long              rss;
+  if(paren == std::string::npos ||
+     sscanf(stat.c_str() + paren + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+            &state, &utime, &stime, &rss) != 4 || state == 'Z')
+    return false;
+  const std::string status = read_proc(pid, "status");
+  const std::string io     = read_proc(pid, "io");
+
+  res.cpu_time    = std::chrono::microseconds((int64_t)(utime + stime) * 1000000 / clock_ticks);
+  res.rss         = status.empty() ? rss * (page_size / 1024) : (long)proc_field(status, "VmRSS:");
+  res.read_bytes  = proc_field(io, "rchar:");
+  res.write_bytes = proc_field(io, "wchar:");
+  return true;
+}
+
+int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  return -1;
+#endif
+}
+
+void add_time(struct timeval& total, const struct timeval& tv) {
+  total.tv_sec  += tv.tv_sec;
+  total.tv_usec += tv.tv_usec;
+  if(total.tv_usec >= 1000000) {
+    total.tv_sec  += 1;
+    total.tv_usec -= 1000000;
+  }
+}
+
+void add_resources(struct rusage& total, const Exit& e) {
+  for(const auto& h : e) {
+    if(h.have_status()) {
+      const struct rusage& r = h.resources;
+      add_time(total.ru_utime, r.ru_utime);
+      add_time(total.ru_stime, r.ru_stime);
+      total.ru_maxrss   = std::max(total.ru_maxrss, r.ru_maxrss);
+      total.ru_minflt  += r.ru_minflt;
+      total.ru_majflt  += r.ru_majflt;
+      total.ru_inblock += r.ru_inblock;
+      total.ru_oublock += r.ru_oublock;
+      total.ru_nvcsw   += r.ru_nvcsw;
+      total.ru_nivcsw  += r.ru_nivcsw;
+    }
+    for(const auto& a : h.attached)
+      add_resources(total, *a);
+  }
+}
+} // namespace
+
+// Background thread sampling /proc for the commands of a pipeline. A
+// command is sampled until it exits. Its pidfd ensures that a pid
+// reused after the command was reaped is not sampled.
+class resource_monitor {
+  struct target {
+    pid_t                         pid;
+    int                           pidfd;
+    std::shared_ptr<monitor_slot> slot;
+    bool                          done;
+    int64_t                       last_cpu; // In microseconds
+  };
+  std::vector<target>                   targets;
+  const std::chrono::milliseconds       interval;
+  const resource_budget                 budget;
+  const long                            clock_ticks;
+  const long                            page_size;
+  int                                   stop_pipe[2];
+  std::thread                           thread;
+  std::chrono::steady_clock::time_point start_time, last_time;
+
+  bool alive(const target& t) const {
+#ifdef SYS_pidfd_send_signal
+    if(t.pidfd != -1) return syscall(SYS_pidfd_send_signal, t.pidfd, 0, nullptr, 0) != -1;
+#endif
+    return true;
+  }
+
+  void signal(const target& t) const {
+#ifdef SYS_pidfd_send_signal
+    if(t.pidfd != -1) {
+      syscall(SYS_pidfd_send_signal, t.pidfd, budget.sig, nullptr, 0);
+      return;
+    }
+#endif
+    ::kill(t.pid, budget.sig);
+  }
+
+  // Sample target t. Return false if it exited.
+  bool sample(target& t, live_resources& res) const {
+    return sample_proc(t.pid, clock_ticks, page_size, res) && alive(t); // The pid may have been reused
+  }
+
+  resource_budget::limit check(const live_resources& res, std::chrono::steady_clock::time_point now) const {
+    if(budget.rss > 0 && res.rss > budget.rss) return resource_budget::RSS;
+    if(budget.cpu_time.count() > 0 && res.cpu_time > budget.cpu_time) return resource_budget::CPU_TIME;
+    if(budget.wall_time.count() > 0 && now - start_time > budget.wall_time) return resource_budget::WALL_TIME;
+    return resource_budget::NONE;
+  }
+
+  void run() {
+    while(true) {
+      struct pollfd pfd = { stop_pipe[0], POLLIN, 0 };
+      const int     res = poll(&pfd, 1, interval.count());
+      if(res == -1 && errno == EINTR) continue;
+      if(res != 0) return; // Stopped, or error
+
+      const auto now     = std::chrono::steady_clock::now();
+      const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - last_time).count();
+      last_time          = now;
+      bool       any     = false;
+      for(auto& t : targets) {
+        live_resources lr;
+        if(t.done) continue;
+        if(!sample(t, lr)) {
+          t.done = true;
+          continue;
+        }
+        any            = true;
+        lr.cpu_percent = elapsed > 0 ? 100.0 * (lr.cpu_time.count() - t.last_cpu) / elapsed : 0.0;
+        t.last_cpu     = lr.cpu_time.count();
+
+        const auto limit = check(lr, now);
+        bool       first = false;
+        {
+          std::lock_guard<std::mutex> lock(t.slot->mutex);
+          t.slot->resources = lr;
+          if(limit != resource_budget::NONE && t.slot->exceeded == resource_budget::NONE) {
+            t.slot->exceeded = limit;
+            first            = true;
+          }
+        }
+        if(first) signal(t);
+      }
+      if(!any) return;
+    }
+  }
+
+public:
+  resource_monitor(std::chrono::milliseconds i, const resource_budget& b)
+    : interval(std::max(i, std::chrono::milliseconds(1)))
+    , budget(b)
+    , clock_ticks(std::max(sysconf(_SC_CLK_TCK), 1L))
+    , page_size(std::max(sysconf(_SC_PAGESIZE), 1024L))
+    , stop_pipe{-1, -1}
+  { }
+  ~resource_monitor() {
+    join();
+    for(auto& t : targets)
+      safe_close(t.pidfd);
+    safe_close(stop_pipe[0]);
+    safe_close(stop_pipe[1]);
+  }
+
+  void add(pid_t pid, std::shared_ptr<monitor_slot> slot) {
+    targets.push_back(target{pid, open_pidfd(pid), std::move(slot), false, 0});
+  }
+
+  bool start() {
+    if(pipe2(stop_pipe, O_CLOEXEC) == -1) return false;
+    start_time = last_time = std::chrono::steady_clock::now();
+    try {
+      thread = std::thread(&resource_monitor::run, this);
+    } catch(...) {
+      return false;
+    }
+    return true;
+  }
+
+  void join() {
+    if(!thread.joinable()) return;
+    const char c = 0;
+    write_all(stop_pipe[1], &c, 1);
+    thread.join();
+  }
+};
+
+// Background thread sampling the fill level of the pipes between the
+// commands of a pipeline, and the CPU usage of the commands. The read
+// end of the pipe into a command is closed as soon as the command
+// exits (its pidfd is readable), so its writer gets SIGPIPE.
+class pipeline_profiler {
+  struct stage {
+    pid_t          pid;
+    int            pidfd;
+    bool           done;
+    live_resources last;
+    std::chrono::steady_clock::time_point last_time;
+  };
+  struct link {
+    int    fd;
+    size_t capacity;
+    double fill_sum;
+    size_t full, empty, samples;
+  };
+  std::vector<stage>                    stages;
+  std::vector<link>                     links; // links[i] is read by stages[i + 1]
+  const std::chrono::milliseconds       interval;
+  const long                            clock_ticks;
+  const long                            page_size;
+  int                                   stop_pipe[2];
+  std::thread                           thread;
+  std::chrono::steady_clock::time_point start_time;
+  mutable std::mutex                    mutex; // Protects stages and links
+
+  void close_input(size_t i) {
+    if(i == 0 || i > links.size()) return;
+    safe_close(links[i - 1].fd);
+    links[i - 1].fd = -1;
+  }
+
+  void sample() {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    for(size_t i = 0; i < stages.size(); ++i) {
+      stage& s = stages[i];
+      if(s.done) continue;
+      live_resources res;
+      if(!sample_proc(s.pid, clock_ticks, page_size, res)) {
+        s.done = true;
+        close_input(i);
+        continue;
+      }
+      s.last      = res;
+      s.last_time = now;
+    }
+    for(auto& l : links) {
+      int bytes;
+      if(l.fd == -1 || l.capacity == 0 || ioctl(l.fd, FIONREAD, &bytes) == -1) continue;
+      const double fill = (double)bytes / l.capacity;
+      l.fill_sum += std::min(fill, 1.0);
+      l.full     += fill >= 0.75;
+      l.empty    += fill < 0.125;
+      ++l.samples;
+    }
+  }
+
+  void run() {
+    auto next = std::chrono::steady_clock::now() + interval;
+    while(true) {
+      std::vector<struct pollfd> pfds;
+      std::vector<size_t>        ids;
+      pfds.push_back(pollfd{stop_pipe[0], POLLIN, 0});
+      for(size_t i = 0; i < stages.size(); ++i) {
+        if(stages[i].done || stages[i].pidfd == -1) continue;
+        pfds.push_back(pollfd{stages[i].pidfd, POLLIN, 0});
+        ids.push_back(i);
+      }
+      const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(next - std::chrono::steady_clock::now());
+      const int  res  = poll(pfds.data(), pfds.size(), std::max(left.count(), (decltype(left.count()))0));
+      if(res == -1 && errno == EINTR) continue;
+      if(res == -1 || pfds[0].revents) return; // Stopped, or error
+      if(res > 0) { // Some commands exited
+        std::lock_guard<std::mutex> lock(mutex);
+        for(size_t j = 1; j < pfds.size(); ++j) {
+          if(!pfds[j].revents) continue;
+          stages[ids[j - 1]].done = true;
+          close_input(ids[j - 1]);
+        }
+        continue;
+      }
+      sample();
+      next += interval;
+      if(std::all_of(stages.begin(), stages.end(), [](const stage& s) { return s.done; })) return;
+    }
+  }
+
+public:
+  pipeline_profiler(std::chrono::milliseconds i)
+    : interval(std::max(i, std::chrono::milliseconds(1)))
+    , clock_ticks(std::max(sysconf(_SC_CLK_TCK), 1L))
+    , page_size(std::max(sysconf(_SC_PAGESIZE), 1024L))
+    , stop_pipe{-1, -1}
+  { }
+  ~pipeline_profiler() {
+    join();
+    for(auto& s : stages)
+      safe_close(s.pidfd);
+    safe_close(stop_pipe[0]);
+    safe_close(stop_pipe[1]);
+  }
+
+  void add_stage(pid_t pid) {
+    const int fd = pid > 0 ? open_pidfd(pid) : -1;
+    stages.push_back(stage{pid, fd, pid <= 0, live_resources(), std::chrono::steady_clock::time_point()});
+  }
+  void add_link(int fd) {
+    const int capacity = fd == -1 ? -1 : fcntl(fd, F_GETPIPE_SZ);
+    links.push_back(link{fd, capacity > 0 ? (size_t)capacity : 0, 0, 0, 0, 0});
+  }
+
+  bool start() {
+    if(pipe2(stop_pipe, O_CLOEXEC) == -1) return false;
+    start_time = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < stages.size(); ++i)
+      if(stages[i].done) close_input(i);
+    try {
+      thread = std::thread(&pipeline_profiler::run, this);
+    } catch(...) {
+      return false;
+    }
+    return true;
+  }
+
+  // Stop sampling, and close the pipes
+  void join() {
+    if(thread.joinable()) {
+      const char c = 0;
+      write_all(stop_pipe[1], &c, 1);
+      thread.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& l : links) {
+      safe_close(l.fd);
+      l.fd = -1;
+    }
+  }
+
+  PipelineProfile profile() const {
+    PipelineProfile res;
+    std::lock_guard<std::mutex> lock(mutex);
+    for(const auto& s : stages) {
+      stage_profile sp;
+      const double elapsed = std::chrono::duration<double>(s.last_time - start_time).count();
+      sp.cpu_time    = s.last.cpu_time;
+      sp.write_bytes = s.last.write_bytes;
+      if(elapsed > 0) {
+        sp.cpu_percent = 100.0 * s.last.cpu_time.count() / 1e6 / elapsed;
+        sp.throughput  = s.last.write_bytes / elapsed;
+      }
+      res.stages.push_back(sp);
+    }
+    for(const auto& l : links) {
+      link_profile lp;
+      lp.capacity = l.capacity;
+      lp.samples  = l.samples;
+      if(l.samples > 0) {
+        lp.mean_fill   = l.fill_sum / l.samples;
+        lp.full_ratio  = (double)l.full / l.samples;
+        lp.empty_ratio = (double)l.empty / l.samples;
+        if(lp.full_ratio > 0.5)
+          lp.state = link_profile::MOSTLY_FULL;
+        else if(lp.empty_ratio > 0.5)
+          lp.state = link_profile::MOSTLY_EMPTY;
+      }
+      res.links.push_back(lp);
+    }
+
+    // A stage slower than its neighbors has its input pipe full and its
+    // output pipe empty. Among several, take the busiest.
+    for(size_t i = 0; i < res.stages.size(); ++i) {
+      const bool has_in    = i > 0 && i - 1 < res.links.size();
+      const bool has_out   = i < res.links.size();
+      const bool in_full   = !has_in || res.links[i - 1].state == link_profile::MOSTLY_FULL;
+      const bool out_empty = !has_out || res.links[i].state == link_profile::MOSTLY_EMPTY;
+      if(!(has_in || has_out) || !in_full || !out_empty) continue;
+      if(res.bottleneck == -1 || res.stages[i].cpu_percent > res.stages[res.bottleneck].cpu_percent)
+        res.bottleneck = i;
+    }
+    return res;
+  }
+};
+
+bool Exit::start_profiler(std::chrono::milliseconds interval, std::vector<int>&& link_fds) {
+  join_profiler();
+  std::shared_ptr<pipeline_profiler> p(new pipeline_profiler(interval));
+  for(const auto& h : handles)
+    p->add_stage(h.running() ? h.pid : -1);
+  for(int fd : link_fds)
+    p->add_link(fd);
+  link_fds.clear();
+  const bool res = p->start();
+  if(!res) p->join(); // Close the pipes now
+  profiler_      = std::move(p);
+  return res;
+}
+
+void Exit::join_profiler() {
+  if(profiler_) profiler_->join();
+}
+
+PipelineProfile Exit::profile() const {
+  return profiler_ ? profiler_->profile() : PipelineProfile();
+}
+
+bool Exit::monitor(std::chrono::milliseconds interval, const resource_budget& budget) {
+  join_monitor();
+  std::shared_ptr<resource_monitor> m(new resource_monitor(interval, budget));
+  for(auto& h : handles) {
+    if(!h.running()) continue;
+    h.monitor_ = std::make_shared<monitor_slot>();
+    m->add(h.pid, h.monitor_);
+  }
+  if(!m->start()) return false;
+  monitor_ = std::move(m);
+  return true;
+}
+
+void Exit::join_monitor() {
+  if(!monitor_) return;
+  monitor_->join();
+  monitor_.reset();
+}
+
+struct rusage Exit::total_resources() const {
+  struct rusage res;
+  memset(&res, 0, sizeof(res));
+  add_resources(res, *this);
+  return res;
+}
+
+live_resources Handle::current_resources() const {
+  if(!monitor_) return live_resources();
+  std::lock_guard<std::mutex> lock(monitor_->mutex);
+  return monitor_->resources;
+}
+
+resource_budget::limit Handle::budget_exceeded() const {
+  if(!monitor_) return resource_budget::NONE;
+  std::lock_guard<std::mutex> lock(monitor_->mutex);
+  return monitor_->exceeded;
+}
+} // namespace noshell
@@ -1,11 +1,18 @@
 #include <iterator>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
 #include <cstdlib>
 
 #include <noshell/utils.hpp>
 #include <noshell/noshell.hpp>
+#include <noshell/fork_exclusions.hpp>
+#include <noshell/metrics.hpp>
+#include <noshell/spawn_policy.hpp>
+#include <noshell/trace.hpp>
 
 namespace noshell {
 // Select the correct version (GNU or XSI) version of
@@ -35,7 +42,10 @@ void send_errno_to_pipe(int fd) {
   }
 }
 
-bool setup_exec_child(const std::set<int>& redirected, setup_list_type& setups, setup_list_type& user_setups, const std::vector<std::string>& cmd) {
+// argv is built by the parent: a child started by clone3() must not allocate
+bool setup_exec_child(const std::set<int>& redirected, setup_list_type& setups, setup_list_type& user_setups,
+                      const std::vector<std::string>& cmd, const stage_function& fun,
+                      const std::vector<const char*>& argv) {
   for(auto& it : setups)
     if(!it->fix_collisions(redirected))
       return false;
@@ -48,40 +58,87 @@ bool setup_exec_child(const std::set<int>& redirected, setup_list_type& setups,
       return false;
   }
 
-  std::vector<const char*> argv(cmd.size() + 1);
-  for(size_t i = 0; i < cmd.size(); ++i)
-    argv[i] = cmd[i].data();
-  argv[cmd.size()] = nullptr;
+  if(fun) {
+    close_cloexec_fds(); // Also signals the parent that the setup was successful
+    _exit(fun(cmd));
+  }
+
   execvp(argv[0], (char**)argv.data());
   return false;
 }
 
 Handle Command::run(process_setup* last_setup) {
+  setup_list_type extra;
+  if(last_setup)
+    extra.push_front(std::unique_ptr<process_setup>(last_setup));
+  return run(std::move(extra));
+}
+
+Handle Command::run(setup_list_type&& extra) {
+  return run(std::move(extra), -1);
+}
+
+Handle Command::run(setup_list_type&& extra, int cgroup_fd) {
   Handle ret;
+  ret.argv = cmd;
+  // On error before the child is started, release the setups and the
+  // file descriptors they hold.
+  auto setup_failed = [&](int e) -> Handle&& {
+    metrics().spawn_failed(e);
+    ret.setups.clear();
+    return ret.return_errno(e);
+  };
 
   // Create the setups
   // TODO: error catching
-  if(last_setup)
-    ret.setups.push_front(std::unique_ptr<process_setup>(last_setup));
+  ret.setups = std::move(extra);
   for(auto& it : setters) {
     process_setup* new_setup = it->make_setup(ret.message, redirected);
-    if(!new_setup) return ret.return_errno();
+    if(!new_setup) return setup_failed(errno);
     ret.setups.push_front(std::unique_ptr<process_setup>(new_setup));
   }
+  if(!start_attached(ret))
+    return setup_failed(errno);
 
   // Create communication pipe and fork, setup and exec child
   int pipe_fds[2];
-  if(pipe2(pipe_fds, O_CLOEXEC) == -1)
-    return ret.return_errno();
+  if(retry_pipe2(pipe_fds, O_CLOEXEC) == -1)
+    return setup_failed(errno);
+
+  const uint64_t spawn_ts    = trace::enabled() ? trace::now() : 0;
+  const auto     spawn_start = std::chrono::steady_clock::now();
+  std::vector<const char*> argv;
+  if(!fun) {
+    argv.resize(cmd->size() + 1);
+    for(size_t i = 0; i < cmd->size(); ++i)
+      argv[i] = (*cmd)[i].data();
+    argv[cmd->size()] = nullptr;
+  }
 
-  switch(ret.pid = fork()) {
-  case -1: return ret.return_errno();
+  const bool excluded = fork_exclusions::enter();
+  // Start the child directly in its cgroup. Stage functions need the
+  // fork handlers of the C library, and move to the cgroup once forked,
+  // as does any child if clone3() does not support it.
+  const bool clone  = cgroup_fd != -1 && !fun;
+  ret.pid           = clone ? retry_clone_into_cgroup(cgroup_fd) : -1;
+  const bool cloned = clone && !(ret.pid == -1 && errno == ENOSYS);
+  if(!cloned)
+    ret.pid = retry_fork();
+  if(excluded && ret.pid != 0) fork_exclusions::leave();
+  switch(ret.pid) {
+  case -1: {
+    const int e = errno;
+    safe_close(pipe_fds[0]);
+    safe_close(pipe_fds[1]);
+    return setup_failed(e);
+  }
 
   case 0:
     safe_close(pipe_fds[0]);
-    setup_exec_child(redirected, ret.setups, setups, cmd);
+    if(cgroup_fd == -1 || cloned || join_cgroup(cgroup_fd))
+      setup_exec_child(redirected, ret.setups, setups, *cmd, fun, argv);
     send_errno_to_pipe(pipe_fds[1]);
-    exit(0);
+    _exit(0);
 
   default: break;
   }
@@ -89,10 +146,14 @@ Handle Command::run(process_setup* last_setup) {
   // Parent setup and wait for child exec
   safe_close(pipe_fds[1]);
   auto_close close_pipe0(pipe_fds[0]);
+  if(spawn_ts)
+    trace::record(trace::SPAWN, ret.pid, -1, 0, cmd->empty() ? "" : (*cmd)[0].c_str(), spawn_ts);
 
   for(auto& it : ret.setups) {
-    if(!it->parent_setup(ret.message))
+    if(!it->parent_setup(ret.message)) {
+      metrics().spawn_failed(errno);
       return ret.return_errno();
+    }
   }
 
   int recv_errno;
@@ -102,13 +163,19 @@ Handle Command::run(process_setup* last_setup) {
     switch(bytes) {
     case -1:
       if(errno == EINTR) break;
+      metrics().spawn_failed(errno);
       return ret.return_errno();
 
-    case 0: return ret;
+    case 0:
+      if(spawn_ts) trace::record(trace::EXEC, ret.pid, -1, 0);
+      metrics().spawned(std::chrono::steady_clock::now() - spawn_start);
+      ret.started = spawn_start;
+      return ret;
 
     default:
       ret.message = "Child process setup error";
       waitpid(ret.pid, &status, 0);
+      metrics().spawn_failed(recv_errno);
       return ret.return_errno(recv_errno);
     }
   }
@@ -121,6 +188,32 @@ Handle Command::run_wait() {
   return res;
 }
 
+bool Command::start_attached(Handle& handle) {
+  for(auto& it : attached) {
+    if(it.fd == -1) { // First run: pick a file descriptor not otherwise redirected
+      it.fd = redirected.empty() ? 3 : std::max(3, *redirected.crbegin() + 1);
+      redirected.insert(it.fd);
+      if(it.arg >= 0 && (size_t)it.arg < cmd->size()) { // Copied: the Handles of earlier runs keep theirs
+        std::shared_ptr<std::vector<std::string>> c = std::make_shared<std::vector<std::string>>(*cmd);
+        (*c)[it.arg] = "/dev/fd/" + std::to_string(it.fd);
+        cmd = std::move(c);
+      }
+    }
+
+    int fds[2];
+    if(retry_pipe2(fds, O_CLOEXEC) == -1) {
+      save_restore_errno sre;
+      handle.message = "Failed to create pipe for attached pipeline";
+      return false;
+    }
+    const int child_end = it.input ? 0 : 1;
+    auto_close pipeline_end(fds[1 - child_end]);
+    handle.setups.push_front(std::unique_ptr<process_setup>(new owned_fd_redirection(it.fd, fds[child_end])));
+    handle.attached.emplace_back(new Exit(it.input ? it.pipeline->run(-1, fds[1]) : it.pipeline->run(fds[0], -1)));
+  }
+  return true;
+}
+
 void Command::push_setter(process_setter* setter) {
   setters.push_front(std::unique_ptr<process_setter>(setter));
 }
@@ -131,7 +224,23 @@ void Command::push_setup(process_setup* setup) {
 
 Handle::Handle(Command&& rhs) : Handle(rhs.run_wait()) { }
 
+Handle::~Handle() { close_pidfd(); }
+
+void Handle::close_pidfd() {
+  safe_close(pidfd_);
+}
+
+int Handle::pidfd() {
+#ifdef SYS_pidfd_open
+  if(pidfd_ == -1 && running())
+    pidfd_ = syscall(SYS_pidfd_open, pid, 0);
+#endif
+  return pidfd_;
+}
+
 void Handle::wait() {
+  for(auto& it : attached)
+    it->wait();
   if(error != NO_ERROR) return;
   pid_t res;
   int   status;
@@ -144,7 +253,138 @@ void Handle::wait() {
     set_errno();
   } else {
     set_status(status);
+    ended = std::chrono::steady_clock::now();
+    metrics().reaped();
+    if(trace::enabled()) trace::record(trace::EXIT, pid, -1, status);
   }
+  close_pidfd();
+  finish_stderr();
+}
+
+namespace {
+std::chrono::milliseconds time_left(std::chrono::steady_clock::time_point deadline) {
+  const auto now = std::chrono::steady_clock::now();
+  return now < deadline ? std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) : std::chrono::milliseconds(0);
+}
+} // namespace
+
+bool Handle::wait_for(std::chrono::milliseconds timeout) {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  for(auto& it : attached)
+    if(!it->wait_for(time_left(deadline))) return false;
+  if(error != NO_ERROR) return true;
+
+  while(true) {
+    int         status;
+    const pid_t res = wait4(pid, &status, WNOHANG, &resources);
+    if(res == -1 && errno == EINTR) continue;
+    if(res == -1) {
+      message = "Waiting failed for child '" + std::to_string(pid) + "'";
+      set_errno();
+    } else if(res != 0) {
+      set_status(status);
+      ended = std::chrono::steady_clock::now();
+      metrics().reaped();
+      if(trace::enabled()) trace::record(trace::EXIT, pid, -1, status);
+    } else {
+      const auto left = time_left(deadline);
+      if(left.count() == 0) return false;
+      const int fd = pidfd();
+      if(fd != -1) { // Readable once the child exits
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        poll(&pfd, 1, left.count());
+      } else {
+        const struct timespec ts = { 0, 1000000 * std::min(left.count(), (decltype(left.count()))10) };
+        nanosleep(&ts, nullptr);
+      }
+      continue;
+    }
+    close_pidfd();
+    finish_stderr();
+    return true;
+  }
+}
+
+std::vector<native_handle> Handle::native_handles() {
+  std::vector<native_handle> res;
+  if(pidfd() != -1)
+    res.push_back(native_handle{native_handle::PROCESS, pidfd_, -1});
+  for(auto& it : setups) {
+    auto pipe = dynamic_cast<fd_pipe_redirection*>(it.get());
+    if(!pipe || pipe->pipe_close == -1 || pipe->from.empty()) continue;
+    res.push_back(native_handle{pipe->parent_read ? native_handle::READ : native_handle::WRITE, pipe->pipe_close, pipe->from.front()});
+  }
+  return res;
+}
+
+bool Handle::kill(int sig) {
+  bool success = true;
+  for(auto& it : attached)
+    success = it->kill(sig) && success;
+  if(!running()) return success;
+#ifdef SYS_pidfd_send_signal
+  if(pidfd_ != -1)
+    return syscall(SYS_pidfd_send_signal, pidfd_, sig, nullptr, 0) != -1 && success;
+#endif
+  return ::kill(pid, sig) != -1 && success;
+}
+
+void Exit::destroy() {
+  join_watcher(true);
+  join_monitor();
+  join_profiler();
+  join_meter();
+  if(kill_on_destroy_) {
+    kill(SIGKILL);
+    wait();
+  }
+  cgroup_.reset();
+}
+
+void Exit::wait() {
+  join_watcher(false); // Returns once all the commands exited
+  for(auto& h : handles) {
+    h.wait();
+    // Exited on its own before being signaled
+    h.aborted = h.aborted && h.have_status() && h.status().signaled();
+  }
+  join_monitor();
+  join_profiler();
+  join_meter(); // All readers and writers are gone
+  release_cgroup();
+}
+
+bool Exit::wait_for(std::chrono::milliseconds timeout) {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  for(auto& h : handles)
+    if(!h.wait_for(time_left(deadline))) return false;
+  wait(); // All exited: collect the watcher
+  return true;
+}
+
+bool Exit::kill(int sig) {
+  if(sig == SIGKILL) kill_cgroup(); // Also the descendants of the commands
+  // The process group is valid as long as its leader is not waited for
+  const auto leader = std::find_if(handles.begin(), handles.end(), [=](const Handle& h) { return h.pid == group; });
+  if(group > 0 && leader != handles.end() && leader->running()) {
+    bool success = ::killpg(group, sig) != -1;
+    for(auto& h : handles)
+      for(auto& it : h.attached)
+        success = it->kill(sig) && success;
+    return success;
+  }
+  bool success = true;
+  for(auto& h : handles)
+    success = h.kill(sig) && success;
+  return success;
+}
+
+bool Exit::terminate(std::chrono::milliseconds grace) {
+  kill(SIGTERM);
+  if(wait_for(grace)) return true;
+  kill(SIGKILL);
+  wait();
+  return false;
 }
 
 std::ostream& operator<<(std::ostream& os, const Handle& handle) {
@@ -167,22 +407,113 @@ std::ostream& operator<<(std::ostream& os, const Handle& handle) {
 
 Exit::Exit(PipeLine&& rhs) : Exit(rhs.run_wait_auto()) { }
 
-Exit PipeLine::run() {
+Exit PipeLine::run(int fd_in, int fd_out) {
+  return cache ? run_cached(fd_in, fd_out) : start(fd_in, fd_out);
+}
+
+Exit PipeLine::start(int fd_in, int fd_out) {
   Exit ret;
 
   auto it = commands.begin();
   if(it == commands.end()) return ret;
   auto pit = it;
+  int in_fds[2] = { fd_in, -1 }; // Not owned, not closed
+  int* prev_fds = in_fds;
   auto_pipe_close pfds;
+  std::vector<int> link_fds; // For profile()
+  std::vector<std::pair<int, int>> meter_links; // For metered()
+  int cgroup_fd = -1; // Owned by ret
+  auto run_command = [&](Command& cmd, int fds[2]) {
+    setup_list_type extra;
+    extra.push_front(std::unique_ptr<process_setup>(new pipeline_redirection(prev_fds, fds)));
+    if(group)
+      extra.push_front(std::unique_ptr<process_setup>(new process_group_setup(ret.process_group())));
+    std::shared_ptr<stderr_ring> ring;
+    if(tail_bytes > 0) {
+      int tail[2];
+      if(retry_pipe2(tail, O_CLOEXEC) == -1) {
+        Handle h;
+        h.argv    = cmd.cmd;
+        h.message = "Failed to create pipe for stderr tail";
+        metrics().spawn_failed(errno);
+        ret.push_handle(std::move(h.set_errno()));
+        return;
+      }
+      // Registered before the start, so that the command never writes
+      // to a pipe nobody reads. Otherwise it keeps the inherited stderr.
+      ring = Exit::collect_stderr(tail[0], tail_bytes);
+      if(ring)
+        extra.push_front(std::unique_ptr<process_setup>(new stderr_tail_redirection(tail[1])));
+      else
+        safe_close(tail[1]);
+    }
+    ret.push_handle(cmd.run(std::move(extra), cgroup_fd));
+    if(ring && !ret.handles.back().setup_error()) // Else dropped by the collector at end of file
+      ret.set_stderr(ret.handles.size() - 1, std::move(ring));
+    const Handle& last = *(ret.end() - 1);
+    if(group && ret.process_group() == 0 && !last.setup_error())
+      ret.set_group(last.pid);
+  };
+  // The commands from first on are not started, for lack of a pipe
+  auto fail_from = [&](std::vector<Command>::iterator first, int e, const char* msg = "Failed to create pipe for pipeline") {
+    for( ; first != commands.end(); ++first) {
+      Handle h;
+      h.argv    = first->cmd;
+      h.message = msg;
+      metrics().spawn_failed(e);
+      ret.push_handle(std::move(h.set_errno(e)));
+    }
+  };
+  if(!cgroup_dir.empty()) {
+    if(!ret.open_cgroup(cgroup_dir, cgroup_per_exit)) {
+      fail_from(pit, errno, "Failed to open cgroup");
+      return ret;
+    }
+    cgroup_fd = ret.cgroup_fd();
+  }
+  bool piped = true;
   for(++it; it != commands.end(); pit = it, ++it) {
     int fds[2];
-    if(pipe2(fds, O_CLOEXEC) == -1) exit(1); // TODO: handle error
-    ret.push_handle(pit->run(new pipeline_redirection(pfds.fds, fds)));
-    pfds = fds;
+    if(retry_pipe2(fds, O_CLOEXEC) == -1) {
+      fail_from(pit, errno);
+      piped = false;
+      break;
+    }
+    if(profile_interval.count() > 0)
+      link_fds.push_back(fcntl(fds[0], F_DUPFD_CLOEXEC, 3));
+    run_command(*pit, fds);
+    if(meter) {
+      // The next command reads from a second pipe, fed by the parent
+      int relay[2];
+      if(retry_pipe2(relay, O_CLOEXEC) == -1) {
+        const int e = errno;
+        safe_close(fds[0]);
+        safe_close(fds[1]);
+        fail_from(it, e);
+        piped = false;
+        break;
+      }
+      safe_close(fds[1]);
+      meter_links.emplace_back(fds[0], relay[1]);
+      fds[0] = relay[0];
+      fds[1] = -1;
+    }
+    pfds     = fds;
+    prev_fds = pfds.fds;
+  }
+  if(piped) {
+    int fds[2] = { -1, fd_out };
+    run_command(*pit, fds);
   }
-  int fds[2] = { -1, -1 };
-  ret.push_handle(pit->run(new pipeline_redirection(pfds.fds, fds)));
   pfds.close();
+  if(fail_fast_sig)
+    ret.watch_failures(fail_fast_ignore_sigpipe, fail_fast_sig);
+  if(monitor_interval.count() > 0)
+    ret.monitor(monitor_interval, budget);
+  if(profile_interval.count() > 0)
+    ret.start_profiler(profile_interval, std::move(link_fds));
+  if(!meter_links.empty())
+    ret.start_meter(std::move(meter_links));
 
   return ret;
 }
@@ -200,6 +531,12 @@ Exit PipeLine::run_wait_auto() {
   return ret;
 }
 
+PipeLine& PipeLine::death_signal(int sig) & {
+  for(auto& it : commands)
+    it.push_setter(new death_signal_setter(sig));
+  return *this;
+}
+
 // Redirection operators
 PipeLine& operator>(PipeLine& pl, from_to_fd&& ft) {
   if(!pl.commands.empty())
@@ -211,6 +548,25 @@ PipeLine& operator|(PipeLine& p1, PipeLine&& p2) {
   for(auto& it : p2.commands)
     p1.push_command(std::move(it));
   p1.auto_wait = p1.auto_wait && p2.auto_wait;
+  p1.group     = p1.group || p2.group;
+  if(!p1.fail_fast_sig) {
+    p1.fail_fast_sig            = p2.fail_fast_sig;
+    p1.fail_fast_ignore_sigpipe = p2.fail_fast_ignore_sigpipe;
+  }
+  if(!p1.cache)
+    p1.cache = std::move(p2.cache);
+  if(p1.monitor_interval.count() == 0) {
+    p1.monitor_interval = p2.monitor_interval;
+    p1.budget           = p2.budget;
+  }
+  if(p1.profile_interval.count() == 0)
+    p1.profile_interval = p2.profile_interval;
+  p1.meter      = p1.meter || p2.meter;
+  p1.tail_bytes = std::max(p1.tail_bytes, p2.tail_bytes);
+  if(p1.cgroup_dir.empty()) {
+    p1.cgroup_dir      = std::move(p2.cgroup_dir);
+    p1.cgroup_per_exit = p2.cgroup_per_exit;
+  }
   return p1;
 }
 
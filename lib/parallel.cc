@@ -0,0 +1,295 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+
+#include <deque>
+
+#include <noshell/utils.hpp>
+#include <noshell/parallel.hpp>
+#include <noshell/spawn_policy.hpp>
+#include <noshell/trace.hpp>
+
+namespace noshell {
+namespace {
+// Data read from the source, cut into chunks on record boundaries
+struct source_reader {
+  const int         fd;
+  const char        delim;
+  const size_t      chunk_bytes;
+  std::vector<char> pending;
+  bool              eof;
+
+  source_reader(int f, char d, size_t c) : fd(f), delim(d), chunk_bytes(std::max(c, (size_t)1)), eof(false) { }
+
+  // Size of the next chunk available in pending, 0 if more data is needed
+  size_t next_chunk() const {
+    if(pending.size() >= chunk_bytes) {
+      const char* end = (const char*)memchr(pending.data() + chunk_bytes - 1, delim, pending.size() - chunk_bytes + 1);
+      if(end) return end - pending.data() + 1;
+    }
+    return eof ? pending.size() : 0;
+  }
+  bool done() const { return eof && pending.empty(); }
+
+  std::vector<char> take(size_t n) {
+    std::vector<char> res(pending.begin(), pending.begin() + n);
+    pending.erase(pending.begin(), pending.begin() + n);
+    return res;
+  }
+
+  // Read more data. Return false on error
+  bool read_more() {
+    char buf[65536];
+    while(true) {
+      const ssize_t res = read(fd, buf, sizeof(buf));
+      if(res > 0) {
+        pending.insert(pending.end(), buf, buf + res);
+        return true;
+      }
+      if(res == -1 && errno == EINTR) continue;
+      if(res == -1 && errno == EAGAIN) return true;
+      eof = true;
+      return res == 0;
+    }
+  }
+};
+
+struct worker {
+  Exit              exit;
+  int               in_fd;   // Parent end of the pipe to the input of the worker
+  int               out_fd;  // Parent end of the pipe from the output of the worker
+  std::vector<char> input;
+  size_t            written;
+  std::vector<char> output;  // Output not yet written
+
+  worker() : in_fd(-1), out_fd(-1), written(0) { }
+  ~worker() { safe_close(in_fd); safe_close(out_fd); }
+
+  bool start(const pipeline_factory& factory) {
+    int in[2], out[2];
+    if(retry_pipe2(in, O_CLOEXEC) == -1) return false;
+    auto_pipe_close in_close(in);
+    if(retry_pipe2(out, O_CLOEXEC) == -1) return false;
+    auto_pipe_close out_close(out);
+    if(!set_nonblock(in[1]) || !set_nonblock(out[0])) return false;
+
+    PipeLine pl = factory();
+    exit = pl.run(in[0], out[1]);
+    std::swap(in_fd, in_close.fds[1]);
+    std::swap(out_fd, out_close.fds[0]);
+    return true;
+  }
+
+  bool has_input() const { return in_fd != -1 && written < input.size(); }
+
+  // Write some pending input. Close the pipe when all is written (if
+  // close_done) or when the worker does not read anymore.
+  void write_input(bool close_done) {
+    block_sigpipe sigpipe; // Not while forking: the workers would inherit it
+    const ssize_t res = write(in_fd, input.data() + written, input.size() - written);
+    trace::record_io(trace::WRITE, in_fd, res);
+    if(res == -1) {
+      if(errno == EINTR || errno == EAGAIN) return;
+      safe_close(in_fd); // Most likely EPIPE. Drop the input
+      return;
+    }
+    written += res;
+    if(written == input.size() && close_done)
+      safe_close(in_fd);
+  }
+
+  // Read some output, appended to output. Return false on end of file.
+  bool read_output() {
+    char buf[65536];
+    const ssize_t res = read(out_fd, buf, sizeof(buf));
+    trace::record_io(trace::READ, out_fd, res);
+    if(res == -1 && (errno == EINTR || errno == EAGAIN)) return true;
+    if(res <= 0) {
+      safe_close(out_fd);
+      return false;
+    }
+    output.insert(output.end(), buf, buf + res);
+    return true;
+  }
+};
+
+struct poll_set {
+  std::vector<pollfd>  fds;
+  std::vector<worker*> workers; // nullptr for the source
+  void clear() { fds.clear(); workers.clear(); }
+  void add(int fd, short events, worker* w) {
+    fds.push_back(pollfd{fd, events, 0});
+    workers.push_back(w);
+  }
+  bool poll() {
+    while(::poll(fds.data(), fds.size(), -1) == -1) {
+      if(errno != EINTR) return false;
+    }
+    return true;
+  }
+};
+
+class parallel_runner {
+  const pipeline_factory& factory;
+  const size_t            jobs;
+  const parallel_options& opts;
+  source_reader           source;
+  parallel_result         result;
+  poll_set                pset;
+
+  void write_output(std::vector<char>& output, size_t len) {
+    block_sigpipe sigpipe;
+    if(result.error == 0 && !write_all(opts.out_fd, output.data(), len))
+      result.error = errno; // Drop the output, stop at the next iteration
+    output.erase(output.begin(), output.begin() + len);
+  }
+
+  void read_source() {
+    if(!source.read_more() && result.error == 0)
+      result.error = errno;
+  }
+
+public:
+  parallel_runner(int source_fd, size_t chunk_bytes, size_t j, const pipeline_factory& f, const parallel_options& o)
+    : factory(f), jobs(std::max(j, (size_t)1)), opts(o), source(source_fd, o.delim, chunk_bytes)
+  { }
+
+  parallel_result&& per_chunk() {
+    std::deque<std::unique_ptr<worker>> running; // In input order
+
+    while(true) {
+      // Output and retire the head worker once done
+      while(!running.empty()) {
+        worker& head = *running.front();
+        if(!head.output.empty())
+          write_output(head.output, head.output.size());
+        if(head.out_fd != -1) break;
+        safe_close(head.in_fd);
+        head.exit.wait();
+        result.exits.push_back(std::move(head.exit));
+        running.pop_front();
+      }
+
+      // Start workers on the available chunks
+      while(running.size() < jobs) {
+        const size_t size = source.next_chunk();
+        if(size == 0) break;
+        std::unique_ptr<worker> w(new worker);
+        w->input = source.take(size);
+        if(!w->start(factory)) {
+          result.error = errno;
+          break;
+        }
+        running.push_back(std::move(w));
+      }
+      if(result.error || (running.empty() && source.done())) break;
+
+      pset.clear();
+      if(!source.eof && running.size() < jobs)
+        pset.add(source.fd, POLLIN, nullptr);
+      for(auto& w : running) {
+        if(w->has_input())
+          pset.add(w->in_fd, POLLOUT, w.get());
+        if(w->out_fd != -1 && (w == running.front() || w->output.size() < opts.max_buffer))
+          pset.add(w->out_fd, POLLIN, w.get());
+      }
+      if(pset.fds.empty() || !pset.poll()) {
+        result.error = pset.fds.empty() ? EDEADLK : errno;
+        break;
+      }
+
+      for(size_t i = 0; i < pset.fds.size(); ++i) {
+        if(!pset.fds[i].revents) continue;
+        worker* w = pset.workers[i];
+        if(!w) read_source();
+        else if(pset.fds[i].events == POLLOUT) w->write_input(true);
+        else w->read_output();
+      }
+    }
+
+    for(auto& w : running) { // Only on error
+      safe_close(w->in_fd);
+      safe_close(w->out_fd);
+      w->exit.wait();
+      result.exits.push_back(std::move(w->exit));
+    }
+    return std::move(result);
+  }
+
+  parallel_result&& streaming() {
+    std::vector<std::unique_ptr<worker>> workers;
+    for(size_t i = 0; i < jobs; ++i) {
+      std::unique_ptr<worker> w(new worker);
+      if(!w->start(factory)) {
+        result.error = errno;
+        break;
+      }
+      workers.push_back(std::move(w));
+    }
+
+    while(true) {
+      // Give a chunk to every idle worker, or close its input if no more data
+      bool idle = false;
+      for(auto& w : workers) {
+        if(w->in_fd == -1 || w->has_input()) continue;
+        const size_t size = source.next_chunk();
+        if(size > 0) {
+          w->input   = source.take(size);
+          w->written = 0;
+        } else if(source.done() || result.error) {
+          safe_close(w->in_fd);
+        } else {
+          idle = true;
+        }
+      }
+
+      pset.clear();
+      if(!source.eof && idle)
+        pset.add(source.fd, POLLIN, nullptr);
+      for(auto& w : workers) {
+        if(w->has_input())
+          pset.add(w->in_fd, POLLOUT, w.get());
+        if(w->out_fd != -1)
+          pset.add(w->out_fd, POLLIN, w.get());
+      }
+      if(pset.fds.empty()) break; // All done
+      if(!pset.poll()) {
+        result.error = errno;
+        break;
+      }
+
+      for(size_t i = 0; i < pset.fds.size(); ++i) {
+        if(!pset.fds[i].revents) continue;
+        worker* w = pset.workers[i];
+        if(!w) {
+          read_source();
+        } else if(pset.fds[i].events == POLLOUT) {
+          w->write_input(false);
+        } else if(w->read_output()) { // Output whole records only
+          auto last = std::find(w->output.rbegin(), w->output.rend(), opts.delim);
+          if(last != w->output.rend())
+            write_output(w->output, w->output.rend() - last);
+        } else {
+          write_output(w->output, w->output.size());
+        }
+      }
+    }
+
+    for(auto& w : workers) {
+      safe_close(w->in_fd);
+      safe_close(w->out_fd);
+      w->exit.wait();
+      result.exits.push_back(std::move(w->exit));
+    }
+    return std::move(result);
+  }
+};
+} // namespace
+
+parallel_result parallel_pipe(int source_fd, size_t chunk_bytes, size_t jobs, pipeline_factory factory,
+                              const parallel_options& opts) {
+  parallel_runner runner(source_fd, chunk_bytes, jobs, factory, opts);
+  return opts.type == parallel_options::STREAMING ? runner.streaming() : runner.per_chunk();
+}
+} // namespace noshell
@@ -0,0 +1,137 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include <noshell/utils.hpp>
+#include <noshell/records.hpp>
+#include <noshell/spawn_policy.hpp>
+#include <noshell/trace.hpp>
+
+namespace noshell {
+// Read more data in the buffer, making room for at least need bytes
+// of unread data. Return false on end of file or error.
+bool Records::fill(size_t need) {
+  if(data_start > 0) { // Move the partial record to the beginning of the buffer
+    memmove(buffer.data(), buffer.data() + data_start, data_end - data_start);
+    data_end   -= data_start;
+    data_start = 0;
+  }
+  if(data_end == buffer.size() || need > buffer.size())
+    buffer.resize(std::max(2 * buffer.size(), need));
+
+  while(true) {
+    const ssize_t res = read(fd, buffer.data() + data_end, buffer.size() - data_end);
+    trace::record_io(trace::READ, fd, res);
+    if(res > 0) {
+      data_end += res;
+      return true;
+    }
+    if(res == -1 && errno == EINTR) continue;
+    if(res == -1) error_ = errno;
+    eof = true;
+    return false;
+  }
+}
+
+void Records::finish() {
+  if(done) return;
+  done = true;
+  if(own_fd) {
+    safe_close(fd);
+    status.wait();
+  }
+}
+
+bool Records::next() {
+  if(done) return false;
+  if(!format.valid()) {
+    error_ = EINVAL;
+    finish();
+    return false;
+  }
+  if(!started) {
+    started = true;
+    int fds[2];
+    if(retry_pipe2(fds, O_CLOEXEC) == -1) {
+      error_ = errno;
+      done   = true;
+      return false;
+    }
+    status = pipeline.run(-1, fds[1]);
+    safe_close(fds[1]);
+    fd = fds[0];
+  }
+
+  while(true) {
+    const char*  data     = buffer.data() + data_start;
+    const size_t avail    = data_end - data_start;
+    size_t       need     = 0;
+    bool         too_long = false;
+
+    switch(format.type) {
+    case record_format::DELIMITER: {
+      const char* delim = (const char*)memchr(data + scanned, format.delim, avail - scanned);
+      if(delim) {
+        current     = record_view(data, delim - data);
+        data_start += delim - data + 1;
+        scanned     = 0;
+        return true;
+      }
+      scanned  = avail;
+      too_long = avail > format.max;
+      if(eof && avail > 0 && !too_long) { // Last record without delimiter
+        current    = record_view(data, avail);
+        data_start = data_end;
+        scanned    = 0;
+        return true;
+      }
+      break;
+    }
+
+    case record_format::FIXED:
+      if(format.size > format.max) {
+        too_long = true;
+        break;
+      }
+      if(avail >= format.size) {
+        current     = record_view(data, format.size);
+        data_start += format.size;
+        return true;
+      }
+      need = format.size;
+      break;
+
+    case record_format::LENGTH_PREFIX:
+      need = format.size;
+      if(avail >= format.size) {
+        uint64_t len = 0;
+        for(size_t i = 0; i < format.size; ++i)
+          len = (len << 8) | (unsigned char)data[i];
+        if(len > format.max) {
+          too_long = true;
+          break;
+        }
+        if(avail - format.size >= len) {
+          current     = record_view(data + format.size, len);
+          data_start += format.size + len;
+          return true;
+        }
+        need += len;
+      }
+      break;
+    }
+
+    if(too_long) {
+      error_ = EMSGSIZE;
+      finish();
+      return false;
+    }
+    if(eof) {
+      truncated_ = avail > 0;
+      finish();
+      return false;
+    }
+    fill(need);
+  }
+}
+} // namespace noshell
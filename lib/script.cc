@@ -0,0 +1,236 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <mutex>
+#include <thread>
+
+#include <noshell/script.hpp>
+#include <noshell/utils.hpp>
+
+namespace noshell {
+Script Script::join(list_type t, Script&& a, Script&& b) {
+  Script res(std::move(a));
+  if(res.type != t) {
+    std::shared_ptr<Script> first(new Script(std::move(res)));
+    res.type = t;
+    res.pipeline.reset();
+    res.items.assign(1, std::move(first));
+  }
+  if(b.type == t)
+    res.items.insert(res.items.end(), b.items.begin(), b.items.end());
+  else
+    res.items.push_back(std::make_shared<Script>(std::move(b)));
+  return res;
+}
+
+// Runs the pipelines of a script, each as soon as the ones it depends
+// on exited, from a background thread.
+class script_scheduler {
+  typedef ScriptExit::node node;
+  std::vector<node>                      nodes;
+  std::vector<std::shared_ptr<PipeLine>> pipelines; // By node, for PIPELINE
+  mutable std::mutex                     mutex;
+  bool                                   stopped; // By kill(): start nothing more
+  int                                    stop_pipe[2];
+  std::thread                            thread;
+
+  void add(const Script& s, ssize_t parent) {
+    const size_t id = nodes.size();
+    nodes.emplace_back(s.type, parent);
+    pipelines.push_back(s.pipeline);
+    if(parent >= 0) nodes[parent].children.push_back(id);
+    for(const auto& it : s.items)
+      add(*it, id);
+  }
+
+  void skip(size_t i) {
+    nodes[i].state = ScriptExit::SKIPPED;
+    for(auto c : nodes[i].children)
+      skip(c);
+  }
+
+  void start(size_t i) {
+    node& n = nodes[i];
+    if(stopped) {
+      skip(i);
+      finish(i, false);
+      return;
+    }
+    n.state = ScriptExit::RUNNING;
+    switch(n.type) {
+    case Script::PIPELINE:
+      n.exit = pipelines[i]->run();
+      break;
+    case Script::CONCURRENT:
+      for(auto c : n.children)
+        if(nodes[c].state == ScriptExit::PENDING) start(c);
+      break;
+    default:
+      start(n.children.front());
+    }
+  }
+
+  // Node i ended. Start what comes after it.
+  void finish(size_t i, bool success) {
+    if(nodes[i].state != ScriptExit::SKIPPED) {
+      nodes[i].state   = ScriptExit::DONE;
+      nodes[i].success = success;
+    }
+    const ssize_t p = nodes[i].parent;
+    if(p < 0 || nodes[p].state != ScriptExit::RUNNING) return;
+    node&      list = nodes[p];
+    const auto next = std::find(list.children.begin(), list.children.end(), i) + 1;
+    switch(list.type) {
+    case Script::CONCURRENT:
+      for(auto c : list.children) {
+        const auto state = nodes[c].state;
+        if(state == ScriptExit::PENDING || state == ScriptExit::RUNNING) return;
+      }
+      finish(p, std::all_of(list.children.begin(), list.children.end(), [&](size_t c) { return nodes[c].success; }));
+      return;
+    case Script::AND:
+    case Script::OR:
+      if(success == (list.type == Script::OR)) { // Short-circuit
+        for(auto it = next; it != list.children.end(); ++it)
+          skip(*it);
+        finish(p, success);
+        return;
+      }
+      break;
+    default: break;
+    }
+    if(next == list.children.end())
+      finish(p, success);
+    else
+      start(*next);
+  }
+
+  bool running() const { return nodes[0].state == ScriptExit::RUNNING; }
+
+  // Reap the pipelines which exited. Return true if any did.
+  bool reap() {
+    bool res = false;
+    for(size_t i = 0; i < nodes.size(); ++i) {
+      if(nodes[i].type != Script::PIPELINE || nodes[i].state != ScriptExit::RUNNING) continue;
+      if(!nodes[i].exit.reap()) continue;
+      finish(i, nodes[i].exit.success());
+      res = true;
+    }
+    return res;
+  }
+
+  void run() {
+    std::vector<pollfd> pfds;
+    while(true) {
+      int timeout = -1;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(reap()) continue;
+        if(!running()) return;
+        pfds.assign(1, pollfd{stop_pipe[0], POLLIN, 0});
+        for(auto& n : nodes) {
+          if(n.type != Script::PIPELINE || n.state != ScriptExit::RUNNING) continue;
+          size_t pidfds = 0;
+          for(const auto& h : n.exit.native_handles()) {
+            if(h.type != native_handle::PROCESS) continue;
+            pfds.push_back(pollfd{h.fd, POLLIN, 0});
+            ++pidfds;
+          }
+          // Some command without pidfd: check again later
+          if(pidfds < (size_t)std::count_if(n.exit.begin(), n.exit.end(), [](const Handle& h) { return h.running(); }))
+            timeout = 10;
+        }
+      }
+      if(poll(pfds.data(), pfds.size(), timeout) == -1 && errno != EINTR) timeout = 10;
+      if(pfds[0].revents) return; // Stopped
+    }
+  }
+
+public:
+  script_scheduler(const Script& s) : stopped(false), stop_pipe{-1, -1} { add(s, -1); }
+  ~script_scheduler() {
+    if(thread.joinable()) {
+      const char c = 0;
+      write_all(stop_pipe[1], &c, 1);
+      thread.join();
+    }
+    safe_close(stop_pipe[0]);
+    safe_close(stop_pipe[1]);
+  }
+
+  void launch() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      start(0);
+      reap();
+      if(!running()) return;
+    }
+    // Without the thread, the pipelines are started by wait()
+    if(pipe2(stop_pipe, O_CLOEXEC) == -1) return;
+    try {
+      thread = std::thread(&script_scheduler::run, this);
+    } catch(...) { }
+  }
+
+  void wait() {
+    if(thread.joinable()) {
+      thread.join();
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    while(running()) {
+      for(auto& n : nodes) {
+        if(n.type == Script::PIPELINE && n.state == ScriptExit::RUNNING)
+          n.exit.wait();
+      }
+      reap();
+    }
+  }
+
+  bool kill(int sig) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped      = true;
+    bool success = true;
+    for(auto& n : nodes) {
+      if(n.type == Script::PIPELINE && n.state == ScriptExit::RUNNING)
+        success = n.exit.kill(sig) && success;
+    }
+    return success;
+  }
+
+  bool done() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !running();
+  }
+  size_t size() const { return nodes.size(); }
+  const node& operator[](size_t i) const { return nodes[i]; }
+};
+
+ScriptExit Script::run() {
+  ScriptExit res;
+  res.scheduler = std::make_shared<script_scheduler>(*this);
+  res.scheduler->launch();
+  return res;
+}
+
+ScriptExit Script::run_wait() {
+  ScriptExit res = run();
+  res.wait();
+  return res;
+}
+
+void ScriptExit::wait() {
+  if(scheduler) scheduler->wait();
+}
+
+bool ScriptExit::kill(int sig) { return !scheduler || scheduler->kill(sig); }
+
+bool ScriptExit::done() const { return !scheduler || scheduler->done(); }
+
+size_t ScriptExit::size() const { return scheduler ? scheduler->size() : 0; }
+
+const ScriptExit::node& ScriptExit::operator[](size_t i) const { return (*scheduler)[i]; }
+} // namespace noshell
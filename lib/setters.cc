@@ -1,11 +1,15 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <signal.h>
+#include <sys/prctl.h>
 #include <iterator>
 #include <string>
 
 #include <noshell/utils.hpp>
 #include <noshell/setters.hpp>
+#include <noshell/metrics.hpp>
+#include <noshell/spawn_policy.hpp>
 
 namespace noshell {
 bool move_fd(int& fd, int above) {
@@ -79,21 +83,34 @@ process_setup* path_redirection_setter::make_setup(std::string& err, std::set<in
   }
 }
 
-bool path_redirection::parent_setup(std::string& err) { safe_close(ft.to); return true; }
-path_redirection::~path_redirection() { safe_close(ft.to); }
+// The file descriptors owned by the setups are counted in metrics()
+namespace {
+void count_open(int fd) {
+  if(fd != -1) metrics().fd_opened();
+}
+void close_counted(int& fd) {
+  if(fd != -1) metrics().fd_closed();
+  safe_close(fd);
+}
+} // namespace
+
+owned_fd_redirection::owned_fd_redirection(int f, int t) : fd_redirection(f, t) { count_open(t); }
+owned_fd_redirection::owned_fd_redirection(const fd_list_type& f, int t) : fd_redirection(f, t) { count_open(t); }
+bool owned_fd_redirection::parent_setup(std::string& err) { close_counted(ft.to); return true; }
+owned_fd_redirection::~owned_fd_redirection() { close_counted(ft.to); }
 
 process_setup* fd_pipe_redirection_setter::make_setup(std::string& err, std::set<int>& rfds) {
   for(auto it : ft.from)
     rfds.insert(it);
   int fds[2];
-  if(pipe2(fds, O_CLOEXEC) == -1) {
+  if(retry_pipe2(fds, O_CLOEXEC) == -1) {
     save_restore_errno sre;
     err = "Failed to create pipes for pipe redirection";
     return nullptr;
   }
   const int nb = (type != READ);
   ft.to        = fds[nb];
-  return new fd_pipe_redirection(ft.from, fds[1 - nb], fds[nb]);
+  return new fd_pipe_redirection(ft.from, fds[1 - nb], fds[nb], type == READ);
 }
 
 bool fd_pipe_redirection::child_setup() {
@@ -106,8 +123,39 @@ bool fd_pipe_redirection::child_setup() {
   return success;
 }
 
-bool fd_pipe_redirection::parent_setup(std::string& err) { safe_close(pipe_dup); return true; }
-fd_pipe_redirection::~fd_pipe_redirection() { safe_close(pipe_dup); }
+fd_pipe_redirection::fd_pipe_redirection(int f, int d, int c, bool r)
+  : from(1, f), pipe_dup(d), pipe_close(c), parent_read(r) { count_open(d); }
+fd_pipe_redirection::fd_pipe_redirection(const fd_list_type f, int d, int c, bool r)
+  : from(f), pipe_dup(d), pipe_close(c), parent_read(r) { count_open(d); }
+bool fd_pipe_redirection::parent_setup(std::string& err) { close_counted(pipe_dup); return true; }
+fd_pipe_redirection::~fd_pipe_redirection() { close_counted(pipe_dup); }
+
+process_setup* nonblocking_pipe_redirection_setter::make_setup(std::string& err, std::set<int>& rfds) {
+  process_setup* setup = fd_pipe_redirection_setter::make_setup(err, rfds);
+  if(!setup) return nullptr;
+  if(!set_nonblock(fd)) {
+    save_restore_errno sre;
+    err = "Failed to set pipe in non-blocking mode";
+    delete setup;
+    safe_close(fd);
+    return nullptr;
+  }
+  nb.fd = fd;
+  return setup;
+}
+
+bool process_group_setup::child_setup() { return setpgid(0, group) != -1; }
+
+bool death_signal_setup::child_setup() {
+  if(prctl(PR_SET_PDEATHSIG, sig) == -1) return false;
+  if(getppid() != parent) // Parent died already
+    raise(sig);
+  return true;
+}
+
+process_setup* death_signal_setter::make_setup(std::string& err, std::set<int>& rfds) {
+  return new death_signal_setup(sig, getpid());
+}
 
 process_setup* stdio_pipe_redirection_setter::make_setup(std::string& err, std::set<int>& rfds) {
   process_setup* setup = fd_pipe_redirection_setter::make_setup(err, rfds);
@@ -0,0 +1,125 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/sched.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <random>
+
+#include <noshell/spawn_policy.hpp>
+
+namespace noshell {
+namespace {
+std::mutex   policy_mutex;
+spawn_policy policy;
+
+// Exponential backoff with jitter
+class backoff {
+  const spawn_policy&       p;
+  std::chrono::microseconds delay;
+
+  static std::minstd_rand& rng() {
+    thread_local std::minstd_rand gen((unsigned)syscall(SYS_gettid) ^ (unsigned)time(nullptr));
+    return gen;
+  }
+
+public:
+  backoff(const spawn_policy& pol) : p(pol), delay(pol.initial_backoff) { }
+  void sleep() {
+    auto d = std::min(delay, p.max_backoff);
+    if(p.jitter > 0) {
+      std::uniform_real_distribution<double> dist(0, std::min(p.jitter, 1.0));
+      d -= std::chrono::microseconds((long long)(d.count() * dist(rng())));
+    }
+    struct timespec ts = { (time_t)(d.count() / 1000000), (long)(d.count() % 1000000) * 1000 };
+    while(nanosleep(&ts, &ts) == -1 && errno == EINTR) { }
+    delay = std::min(delay * 2, p.max_backoff);
+  }
+};
+} // namespace
+
+void set_spawn_policy(const spawn_policy& p) {
+  std::lock_guard<std::mutex> lock(policy_mutex);
+  policy = p;
+}
+
+spawn_policy get_spawn_policy() {
+  std::lock_guard<std::mutex> lock(policy_mutex);
+  return policy;
+}
+
+pid_t retry_fork() {
+  pid_t pid = fork();
+  if(pid != -1 || errno != EAGAIN) return pid;
+  const spawn_policy p = get_spawn_policy();
+  backoff            b(p);
+  for(unsigned i = 0; i < p.retries && pid == -1 && errno == EAGAIN; ++i) {
+    b.sleep();
+    pid = fork();
+  }
+  return pid;
+}
+
+namespace {
+pid_t clone_into_cgroup(int cgroup_fd) {
+#if defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+  struct clone_args args;
+  memset(&args, 0, sizeof(args));
+  args.flags       = CLONE_INTO_CGROUP;
+  args.exit_signal = SIGCHLD;
+  args.cgroup      = cgroup_fd;
+  const long res = syscall(SYS_clone3, &args, sizeof(args));
+  // No clone3(), or without cgroup support
+  if(res == -1 && (errno == ENOSYS || errno == E2BIG || errno == EINVAL))
+    errno = ENOSYS;
+  return res;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+} // namespace
+
+pid_t retry_clone_into_cgroup(int cgroup_fd) {
+  pid_t pid = clone_into_cgroup(cgroup_fd);
+  if(pid != -1 || errno != EAGAIN) return pid;
+  const spawn_policy p = get_spawn_policy();
+  backoff            b(p);
+  for(unsigned i = 0; i < p.retries && pid == -1 && errno == EAGAIN; ++i) {
+    b.sleep();
+    pid = clone_into_cgroup(cgroup_fd);
+  }
+  return pid;
+}
+
+bool join_cgroup(int cgroup_fd) {
+  const int fd = openat(cgroup_fd, "cgroup.procs", O_WRONLY|O_CLOEXEC);
+  if(fd == -1) return false;
+  const bool res = write(fd, "0", 1) == 1; // 0 is the writing process
+  const int  e   = errno;
+  close(fd);
+  errno = e;
+  return res;
+}
+
+int retry_pipe2(int fds[2], int flags) {
+  int res = pipe2(fds, flags);
+  if(res != -1 || (errno != EMFILE && errno != ENFILE)) return res;
+  const spawn_policy p = get_spawn_policy();
+  if(p.fd_wait.count() == 0) return res;
+  const auto deadline = std::chrono::steady_clock::now() + p.fd_wait;
+  backoff    b(p);
+  while(res == -1 && (errno == EMFILE || errno == ENFILE) && std::chrono::steady_clock::now() < deadline) {
+    b.sleep();
+    res = pipe2(fds, flags);
+  }
+  return res;
+}
+} // namespace noshell
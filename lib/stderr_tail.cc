@@ -0,0 +1,149 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include <cerrno>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <noshell/handle.hpp>
+#include <noshell/utils.hpp>
+
+namespace noshell {
+// The last bytes read from a pipe. Reading is done under the mutex,
+// either by the collector thread or by the thread asking for the tail.
+class stderr_ring {
+  mutable std::mutex mutex;
+  int                fd;
+  std::vector<char>  buf;
+  size_t             head; // Next byte written
+  bool               full; // Wrapped around at least once
+
+public:
+  stderr_ring(int f, size_t capacity) : fd(f), buf(capacity), head(0), full(false) { }
+  ~stderr_ring() { safe_close(fd); }
+
+  // Read all the available data, straight into the buffer. Return
+  // true on end of file (or error).
+  bool drain() {
+    std::lock_guard<std::mutex> lock(mutex);
+    while(fd != -1) {
+      struct iovec iov[2] = { { buf.data() + head, buf.size() - head }, { buf.data(), head } };
+      const ssize_t bytes = readv(fd, iov, head ? 2 : 1);
+      if(bytes == -1 && errno == EINTR) continue;
+      if(bytes == -1 && errno == EAGAIN) return false;
+      if(bytes <= 0) return true;
+      full = full || head + bytes >= buf.size();
+      head = (head + bytes) % buf.size();
+    }
+    return true;
+  }
+
+  int file() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return fd;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    safe_close(fd);
+  }
+
+  std::string str() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!full) return std::string(buf.data(), head);
+    std::string res(buf.data() + head, buf.size() - head);
+    res.append(buf.data(), head);
+    return res;
+  }
+};
+
+namespace {
+// Reads the standard errors of all the commands, with one epoll
+// instance and one thread for the whole process, started on first use.
+class stderr_collector {
+  std::mutex                                   mutex;
+  int                                          epfd;
+  std::map<int, std::shared_ptr<stderr_ring>> rings; // By file descriptor
+
+  void remove(int fd) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    auto it = rings.find(fd);
+    it->second->close();
+    rings.erase(it);
+  }
+
+  void run(int ep) {
+    struct epoll_event events[64];
+    while(true) {
+      const int nb = epoll_wait(ep, events, 64, -1);
+      if(nb == -1) continue; // EINTR
+      std::lock_guard<std::mutex> lock(mutex);
+      for(int i = 0; i < nb; ++i) {
+        // Removed, or replaced by another pipe with the same number,
+        // since epoll_wait returned: draining is harmless.
+        auto it = rings.find(events[i].data.fd);
+        if(it != rings.end() && it->second->drain())
+          remove(it->first);
+      }
+    }
+  }
+
+public:
+  stderr_collector() : epfd(-1) { }
+
+  static stderr_collector& instance() {
+    static stderr_collector* c = new stderr_collector; // The thread never stops
+    return *c;
+  }
+
+  bool add(int fd, const std::shared_ptr<stderr_ring>& ring) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(epfd == -1) {
+      const int fd = epoll_create1(EPOLL_CLOEXEC);
+      if(fd == -1) return false;
+      try {
+        std::thread(&stderr_collector::run, this, fd).detach();
+      } catch(...) {
+        close(fd);
+        return false;
+      }
+      epfd = fd;
+    }
+    struct epoll_event ev;
+    ev.events  = EPOLLIN;
+    ev.data.fd = fd;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) return false;
+    rings[fd] = ring;
+    return true;
+  }
+
+  // Read what is left once the child exited. The pipe stays with the
+  // collector if another process still has it open.
+  void finish(const std::shared_ptr<stderr_ring>& ring) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = rings.find(ring->file()); // -1 once removed
+    if(it != rings.end() && it->second == ring && ring->drain())
+      remove(it->first);
+  }
+};
+} // namespace
+
+std::shared_ptr<stderr_ring> Exit::collect_stderr(int fd, size_t capacity) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  std::shared_ptr<stderr_ring> ring(new stderr_ring(fd, capacity));
+  if(!stderr_collector::instance().add(fd, ring)) ring.reset(); // Closes fd
+  return ring;
+}
+
+void Handle::finish_stderr() {
+  if(stderr_) stderr_collector::instance().finish(stderr_);
+}
+
+std::string Handle::stderr_tail() const {
+  return stderr_ ? stderr_->str() : std::string();
+}
+} // namespace noshell
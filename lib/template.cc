@@ -0,0 +1,166 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+#include <noshell/utils.hpp>
+#include <noshell/template.hpp>
+#include <noshell/fork_exclusions.hpp>
+#include <noshell/metrics.hpp>
+#include <noshell/spawn_policy.hpp>
+#include <noshell/trace.hpp>
+
+extern char** environ;
+
+namespace noshell {
+namespace {
+bool is_placeholder(const std::string& arg) {
+  if(arg.size() < 2 || arg.front() != '{' || arg.back() != '}') return false;
+  for(size_t i = 1; i < arg.size() - 1; ++i)
+    if(!isalnum(arg[i]) && arg[i] != '_') return false;
+  return true;
+}
+
+// Look up cmd in PATH, as execvp does. Return the path found, or an
+// empty string with errno set.
+std::string find_executable(const std::string& cmd) {
+  if(cmd.empty()) {
+    errno = ENOENT;
+    return std::string();
+  }
+  if(cmd.find('/') != std::string::npos) return cmd;
+
+  const char* path_env = getenv("PATH");
+  std::string dirs     = path_env ? path_env : "/bin:/usr/bin";
+  int         err      = ENOENT;
+  for(size_t start = 0; start <= dirs.size(); ) {
+    size_t end = dirs.find(':', start);
+    if(end == std::string::npos) end = dirs.size();
+    std::string file = end == start ? cmd : dirs.substr(start, end - start) + '/' + cmd;
+    if(access(file.c_str(), X_OK) == 0) return file;
+    if(errno == EACCES) err = EACCES;
+    start = end + 1;
+  }
+  errno = err;
+  return std::string();
+}
+} // namespace
+
+Template::Template(std::vector<std::string> cmd, bool placeholders)
+  : args(std::move(cmd))
+  , path_errno(0)
+  , keep_argv(false)
+{
+  argv.reserve(args.size() + 1);
+  for(size_t i = 0; i < args.size(); ++i) {
+    if(placeholders && is_placeholder(args[i])) slots.push_back(i);
+    argv.push_back(args[i].c_str());
+  }
+  argv.push_back(nullptr);
+  if(!args.empty())
+    path = find_executable(args[0]);
+  if(path.empty())
+    path_errno = args.empty() ? EINVAL : errno;
+}
+
+Template& Template::environment(std::vector<std::string> vars) {
+  env = std::move(vars);
+  envp.clear();
+  for(const auto& var : env)
+    envp.push_back(var.c_str());
+  envp.push_back(nullptr);
+  return *this;
+}
+
+Handle Template::run_append(const char* const* values, size_t nb_values, const char* const* extra, size_t nb_extra) {
+  Handle ret;
+  auto failed = [&](int e) -> Handle&& {
+    metrics().spawn_failed(e);
+    return ret.return_errno(e);
+  };
+  if(nb_values != slots.size()) {
+    ret.message = "Wrong number of values for the placeholders";
+    return failed(EINVAL);
+  }
+  if(path.empty()) {
+    ret.message = "Executable not found";
+    return failed(path_errno);
+  }
+  for(size_t i = 0; i < nb_values; ++i)
+    argv[slots[i]] = values[i];
+  argv.resize(args.size()); // Drop the extra arguments of the previous run
+  argv.insert(argv.end(), extra, extra + nb_extra);
+  argv.push_back(nullptr);
+  if(keep_argv)
+    ret.argv = std::make_shared<std::vector<std::string>>(argv.begin(), argv.end() - 1);
+
+  int pipe_fds[2];
+  if(retry_pipe2(pipe_fds, O_CLOEXEC) == -1)
+    return failed(errno);
+
+  const uint64_t spawn_ts    = trace::enabled() ? trace::now() : 0;
+  const auto     spawn_start = std::chrono::steady_clock::now();
+  const bool excluded = fork_exclusions::enter();
+  ret.pid = retry_fork();
+  if(excluded && ret.pid != 0) fork_exclusions::leave();
+  switch(ret.pid) {
+  case -1: {
+    const int e = errno;
+    safe_close(pipe_fds[0]);
+    safe_close(pipe_fds[1]);
+    return failed(e);
+  }
+
+  case 0: {
+    safe_close(pipe_fds[0]);
+    // Keep the error pipe out of the way of the redirections
+    int max_fd = 2;
+    for(const auto& r : redirections)
+      max_fd = std::max(max_fd, r.fd);
+    if(pipe_fds[1] <= max_fd) {
+      const int fd = fcntl(pipe_fds[1], F_DUPFD_CLOEXEC, max_fd + 1);
+      if(fd != -1) pipe_fds[1] = fd;
+    }
+    bool success = true;
+    for(const auto& r : redirections) {
+      if(r.path.empty()) {
+        success = safe_dup2_no_close(r.to, r.fd);
+      } else {
+        int fd = open(r.path.c_str(), r.flags, 0666);
+        success = fd != -1 && (fd == r.fd || safe_dup2(fd, r.fd));
+      }
+      if(!success) break;
+    }
+    if(success)
+      execve(path.c_str(), (char**)argv.data(), envp.empty() ? environ : (char**)envp.data());
+    const int e = errno;
+    while(write(pipe_fds[1], &e, sizeof(e)) == -1 && errno == EINTR) { }
+    _exit(127);
+  }
+
+  default: break;
+  }
+
+  safe_close(pipe_fds[1]);
+  auto_close close_pipe0(pipe_fds[0]);
+  if(spawn_ts)
+    trace::record(trace::SPAWN, ret.pid, -1, 0, argv[0], spawn_ts);
+  int recv_errno;
+  while(true) {
+    const ssize_t bytes = read(pipe_fds[0], &recv_errno, sizeof(recv_errno));
+    if(bytes == -1 && errno == EINTR) continue;
+    if(bytes == -1) return failed(errno);
+    if(bytes == 0) {
+      if(spawn_ts) trace::record(trace::EXEC, ret.pid, -1, 0);
+      metrics().spawned(std::chrono::steady_clock::now() - spawn_start);
+      ret.started = spawn_start;
+      return ret;
+    }
+    ret.message = "Child process setup error";
+    int status;
+    waitpid(ret.pid, &status, 0);
+    return failed(recv_errno);
+  }
+}
+} // namespace noshell
@@ -0,0 +1,170 @@
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <noshell/trace.hpp>
+
+namespace noshell {
+namespace trace {
+std::atomic<bool> tracing(false);
+
+namespace {
+// Ring buffer of a thread. Only this thread writes to it, the readers
+// get the number of events recorded from head.
+struct ring {
+  std::vector<event>    events;
+  std::atomic<uint64_t> head;
+  ring(size_t size) : events(std::max(size, (size_t)1)), head(0) { }
+};
+
+std::mutex                         registry_mutex;
+std::vector<std::shared_ptr<ring>> registry;
+size_t                             ring_size = 1 << 16;
+std::atomic<uint64_t>              generation(0); // Incremented by clear(), to drop the old rings
+
+struct thread_ring {
+  std::shared_ptr<ring> r;
+  uint64_t              gen;
+  pid_t                 tid;
+};
+thread_local thread_ring local;
+
+ring* get_ring() {
+  if(!local.r || local.gen != generation.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    local.r   = std::make_shared<ring>(ring_size);
+    local.gen = generation.load();
+    local.tid = syscall(SYS_gettid);
+    registry.push_back(local.r);
+  }
+  return local.r.get();
+}
+
+std::string json_escape(const char* s) {
+  std::string res;
+  for( ; *s; ++s) {
+    const unsigned char c = *s;
+    if(c == '"' || c == '\\') {
+      res += '\\';
+      res += c;
+    } else if(c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      res += buf;
+    } else {
+      res += c;
+    }
+  }
+  return res;
+}
+} // namespace
+
+void start(size_t events_per_thread) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  ring_size = events_per_thread;
+  registry.clear();
+  ++generation;
+  tracing = true;
+}
+
+void stop() { tracing = false; }
+
+void clear() {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  registry.clear();
+  ++generation;
+}
+
+uint64_t now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void record(event_type type, pid_t pid, int fd, int64_t value, const char* name, uint64_t ts) {
+  ring*          r    = get_ring();
+  const uint64_t head = r->head.load(std::memory_order_relaxed);
+  event&         e    = r->events[head % r->events.size()];
+  e.ts    = ts ? ts : now();
+  e.value = value;
+  e.pid   = pid;
+  e.fd    = fd;
+  e.tid   = local.tid;
+  e.type  = type;
+  e.name[0] = '\0';
+  if(name) {
+    const char* slash = strrchr(name, '/'); // Keep the base name
+    if(slash) name = slash + 1;
+    strncpy(e.name, name, sizeof(e.name) - 1);
+    e.name[sizeof(e.name) - 1] = '\0';
+  }
+  r->head.store(head + 1, std::memory_order_release);
+}
+
+bool write_chrome_trace(std::ostream& os) {
+  std::vector<event> events;
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for(const auto& r : registry) {
+      const uint64_t head = r->head.load(std::memory_order_acquire);
+      const uint64_t size = r->events.size();
+      for(uint64_t i = head > size ? head - size : 0; i < head; ++i)
+        events.push_back(r->events[i % size]);
+    }
+  }
+  std::stable_sort(events.begin(), events.end(), [](const event& a, const event& b) { return a.ts < b.ts; });
+
+  const pid_t   self  = getpid();
+  bool          first = true;
+  std::set<int> read_fds; // Seen a read on these file descriptors
+  char          buf[256];
+  auto emit = [&](const char* ph, const std::string& name, double ts, pid_t tid, const std::string& args) {
+    snprintf(buf, sizeof(buf), "\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", ph, ts, (int)self, (int)tid);
+    os << (first ? "\n" : ",\n") << "{\"name\":\"" << name << "\"," << buf;
+    if(ph[0] == 'i') os << ",\"s\":\"t\"";
+    if(!args.empty()) os << ",\"args\":{" << args << '}';
+    os << '}';
+    first = false;
+  };
+
+  os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for(const auto& e : events) {
+    const double ts = e.ts / 1000.0;
+    switch(e.type) {
+    case SPAWN: {
+      const std::string name = json_escape(e.name);
+      emit("M", "thread_name", ts, e.pid, "\"name\":\"" + name + " (" + std::to_string(e.pid) + ")\"");
+      emit("B", name, ts, e.pid, "\"pid\":" + std::to_string(e.pid));
+      break;
+    }
+    case EXEC: emit("i", "exec", ts, e.pid, ""); break;
+    case EXIT: emit("E", "", ts, e.pid, "\"status\":" + std::to_string(e.value)); break;
+    case READ:
+      if(read_fds.insert(e.fd).second)
+        emit("i", "first byte", ts, e.tid, "\"fd\":" + std::to_string(e.fd));
+      emit("i", "read", ts, e.tid, "\"fd\":" + std::to_string(e.fd) + ",\"bytes\":" + std::to_string(e.value));
+      break;
+    case WRITE:
+      emit("i", "write", ts, e.tid, "\"fd\":" + std::to_string(e.fd) + ",\"bytes\":" + std::to_string(e.value));
+      break;
+    }
+  }
+  os << "\n]}\n";
+  return os.good();
+}
+
+bool write_chrome_trace(const std::string& path) {
+  std::ofstream os(path);
+  return os.good() && write_chrome_trace(os);
+}
+} // namespace trace
+} // namespace noshell
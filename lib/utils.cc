@@ -1,6 +1,14 @@
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <algorithm>
 #include <cerrno>
+#include <cstdlib>
+#include <vector>
+
+#include <noshell/utils.hpp>
 
 
 namespace noshell {
@@ -52,4 +60,99 @@ bool safe_dup2(int& to, int from) {
   return false;
 }
 
+bool write_all(int fd, const void* buf, size_t len) {
+  const char* ptr = static_cast<const char*>(buf);
+  while(len > 0) {
+    const ssize_t res = write(fd, ptr, len);
+    if(res == -1) {
+      if(errno == EINTR) continue;
+      return false;
+    }
+    ptr += res;
+    len -= res;
+  }
+  return true;
+}
+
+static void close_if_cloexec(int fd) {
+  const int flags = fcntl(fd, F_GETFD);
+  if(flags != -1 && (flags & FD_CLOEXEC))
+    safe_close(fd);
+}
+
+namespace {
+ssize_t copy_data(int in, int out, size_t len) {
+  char buf[65536];
+  while(true) {
+    const ssize_t res = read(in, buf, std::min(len, sizeof(buf)));
+    if(res == -1 && errno == EINTR) continue;
+    if(res <= 0) return res;
+    return write_all(out, buf, res) ? res : -1;
+  }
+}
+} // namespace
+
+ssize_t move_data(int in, int out, size_t len) {
+#ifdef SPLICE_F_MOVE
+  while(true) {
+    const ssize_t res = splice(in, nullptr, out, nullptr, len, SPLICE_F_MOVE);
+    if(res != -1) return res;
+    if(errno == EINTR) continue;
+    if(errno != EINVAL) return -1;
+    break; // Neither is a pipe, or out does not support splice
+  }
+#endif
+  return copy_data(in, out, len);
+}
+
+bool set_nonblock(int fd) {
+  const int flags = fcntl(fd, F_GETFL);
+  return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+void close_cloexec_fds() {
+  DIR* dir = opendir("/proc/self/fd");
+  if(dir) {
+    std::vector<int> fds;
+    const int     self = dirfd(dir);
+    for(dirent* entry = readdir(dir); entry; entry = readdir(dir)) {
+      if(entry->d_name[0] == '.') continue;
+      const int fd = atoi(entry->d_name);
+      if(fd != self) fds.push_back(fd);
+    }
+    closedir(dir);
+    for(auto fd : fds)
+      close_if_cloexec(fd);
+    return;
+  }
+
+  // No /proc: check every possible file descriptor
+  long max = sysconf(_SC_OPEN_MAX);
+  if(max == -1 || max > 65536) max = 65536;
+  for(int fd = 0; fd < max; ++fd)
+    close_if_cloexec(fd);
+}
+
+block_sigpipe::block_sigpipe() {
+  sigset_t pipe_set, pending;
+  sigemptyset(&pipe_set);
+  sigaddset(&pipe_set, SIGPIPE);
+  sigemptyset(&pending);
+  sigpending(&pending);
+  was_pending = sigismember(&pending, SIGPIPE) == 1;
+  pthread_sigmask(SIG_BLOCK, &pipe_set, &old_mask);
+}
+
+block_sigpipe::~block_sigpipe() {
+  save_restore_errno sre;
+  if(!was_pending) {
+    sigset_t        pipe_set;
+    struct timespec zero = { 0, 0 };
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    while(sigtimedwait(&pipe_set, nullptr, &zero) == -1 && errno == EINTR) { }
+  }
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+}
+
 } // namespace noshell
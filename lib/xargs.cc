@@ -0,0 +1,113 @@
+#include <unistd.h>
+#include <poll.h>
+
+#include <algorithm>
+
+#include <noshell/template.hpp>
+#include <noshell/xargs.hpp>
+
+extern char** environ;
+
+namespace noshell {
+namespace {
+// Headroom left below ARG_MAX, as GNU xargs does
+const size_t arg_headroom = 2048;
+
+// Size taken by a string on the stack of a new program: the string and
+// its pointer in argv or envp
+size_t arg_size(size_t len) { return len + 1 + sizeof(char*); }
+
+// Cut the arguments in batches fitting on a command line. Return the
+// index of the first argument of each batch, or set error.
+std::vector<size_t> make_batches(const std::vector<std::string>& base, const argument_arena& args,
+                                 const xargs_options& opts, int& error) {
+  size_t limit = opts.max_bytes;
+  if(limit == 0) {
+    const long arg_max = sysconf(_SC_ARG_MAX);
+    limit              = arg_max > 0 ? arg_max : 131072;
+    limit              = limit > 2 * arg_headroom ? limit - arg_headroom : limit / 2;
+  }
+  const long   page_size  = sysconf(_SC_PAGESIZE);
+  const size_t max_strlen = 32 * (page_size > 0 ? page_size : 4096); // MAX_ARG_STRLEN
+
+  size_t fixed = 2 * sizeof(char*); // nullptr at the end of argv and envp
+  for(char** env = environ; env && *env; ++env)
+    fixed += arg_size(strlen(*env));
+  for(const auto& arg : base)
+    fixed += arg_size(arg.size());
+
+  std::vector<size_t> batches;
+  size_t              size = 0, nb = 0; // Of the current batch
+  for(size_t i = 0; i < args.size(); ++i) {
+    const size_t s = arg_size(args.length(i));
+    if(args.length(i) + 1 > max_strlen || fixed + s > limit) {
+      error = E2BIG;
+      return std::vector<size_t>();
+    }
+    if(nb == 0 || fixed + size + s > limit || (opts.max_args && nb == opts.max_args)) {
+      batches.push_back(i);
+      size = nb = 0;
+    }
+    size += s;
+    ++nb;
+  }
+  return batches;
+}
+
+// Wait until at least one of the running batches is done, and remove
+// it (them) from running.
+bool retire(std::vector<Exit>& exits, std::vector<size_t>& running) {
+  while(true) {
+    const auto end = std::remove_if(running.begin(), running.end(), [&](size_t i) { return exits[i].reap(); });
+    if(end != running.end()) {
+      running.erase(end, running.end());
+      return true;
+    }
+
+    std::vector<pollfd> pfds;
+    for(auto i : running) {
+      size_t nb = 0;
+      for(const auto& h : exits[i].native_handles()) {
+        if(h.type != native_handle::PROCESS) continue;
+        pfds.push_back(pollfd{h.fd, POLLIN, 0});
+        ++nb;
+      }
+      if(nb == 0) { // No pidfd support, wait for this one
+        exits[i].wait();
+        running.erase(std::find(running.begin(), running.end(), i));
+        return true;
+      }
+    }
+    if(poll(pfds.data(), pfds.size(), -1) == -1 && errno != EINTR)
+      return false;
+  }
+}
+} // namespace
+
+xargs_result xargs(const std::vector<std::string>& base, const argument_arena& args, const xargs_options& opts) {
+  xargs_result res;
+  res.batches = make_batches(base, args, opts, res.error);
+  if(res.error) return res;
+
+  // The argv of each batch points straight into the arena
+  Template                 cmd(base, false);
+  std::vector<const char*> ptrs(args.size());
+  for(size_t i = 0; i < args.size(); ++i)
+    ptrs[i] = args[i];
+  std::vector<size_t> running;
+  for(size_t b = 0; b < res.batches.size(); ++b) {
+    if(running.size() >= opts.jobs && !retire(res.exits, running)) {
+      res.error = errno;
+      break;
+    }
+    const size_t end = b + 1 < res.batches.size() ? res.batches[b + 1] : args.size();
+    Exit         e;
+    e.push_handle(cmd.run_append(nullptr, 0, ptrs.data() + res.batches[b], end - res.batches[b]));
+    res.exits.push_back(std::move(e));
+    running.push_back(res.exits.size() - 1);
+  }
+  for(auto i : running)
+    res.exits[i].wait();
+  return res;
+}
+} // namespace noshell
@@ -6,6 +6,8 @@
 #include <cerrno>
 #include <cctype>
 
+#include <fstream>
+#include <sstream>
 #include <vector>
 #include <system_error>
 #include <stdexcept>
@@ -48,3 +50,10 @@ std::vector<int> open_fds() {
 
   return ret;
 }
+
+std::string read_file(const std::string& path) {
+  std::ifstream     is(path);
+  std::stringstream ss;
+  ss << is.rdbuf();
+  return ss.str();
+}
@@ -5,12 +5,16 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <string>
 #include <vector>
 #include <stdexcept>
 #include <iostream>
 
 std::vector<int> open_fds();
 
+// Content of the file at path, empty if it can't be read
+std::string read_file(const std::string& path);
+
 struct auto_close {
   DIR* dirp;
   auto_close(DIR* p) : dirp(p) { }
@@ -0,0 +1,112 @@
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/builtin.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+namespace B  = noshell::builtin;
+using namespace NS::literal;
+static const char* tmpfile  = "Builtin_tmp";
+static const char* tmpfile2 = "Builtin_tmp_2";
+
+std::string seq(int first, int last) {
+  std::string res;
+  for(int i = first; i <= last; ++i)
+    res += std::to_string(i) + '\n';
+  return res;
+}
+
+TEST(Builtin, Cat) {
+  check_fixed_fds check_fds;
+
+  ASSERT_TRUE(NS::Exit("seq"_C(1, 10) > tmpfile).success());
+  ASSERT_TRUE(NS::Exit("seq"_C(11, 20000) > tmpfile2).success());
+  {
+    NS::Exit e = (B::cat({tmpfile, tmpfile2}) | "cat"_C()) > "Builtin_tmp_3";
+    EXPECT_TRUE(e.success());
+    EXPECT_EQ(seq(1, 20000), read_file("Builtin_tmp_3"));
+  }
+  {
+    NS::Exit e = ("seq"_C(1, 5) | B::cat()) > tmpfile; // Pipe to file
+    EXPECT_TRUE(e.success());
+    EXPECT_EQ(seq(1, 5), read_file(tmpfile));
+  }
+} // Builtin.Cat
+
+TEST(Builtin, Head) {
+  check_fixed_fds check_fds;
+
+  {
+    NS::Exit e = ("seq"_C(1, 1000000) | B::head(12)) > tmpfile;
+    EXPECT_TRUE(e.success(true));
+    EXPECT_EQ(seq(1, 12), read_file(tmpfile));
+  }
+  {
+    NS::Exit e = ("seq"_C(1, 1000000) | B::head_bytes(6) | "cat"_C()) > tmpfile;
+    EXPECT_TRUE(e.success(true));
+    EXPECT_EQ("1\n2\n3\n", read_file(tmpfile));
+  }
+  {
+    NS::Exit e = ("seq"_C(1, 3) | B::head(10)) > tmpfile;
+    EXPECT_TRUE(e.success());
+    EXPECT_EQ(seq(1, 3), read_file(tmpfile));
+  }
+} // Builtin.Head
+
+TEST(Builtin, WcL) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = ("seq"_C(1, 123456) | B::wc_l()) > tmpfile;
+  EXPECT_TRUE(e.success());
+  EXPECT_EQ("123456\n", read_file(tmpfile));
+} // Builtin.WcL
+
+TEST(Builtin, Tee) {
+  check_fixed_fds check_fds;
+
+  {
+    NS::Exit e = ("seq"_C(1, 50000) | B::tee({tmpfile}) | B::wc_l()) > tmpfile2;
+    EXPECT_TRUE(e.success());
+    EXPECT_EQ(seq(1, 50000), read_file(tmpfile));
+    EXPECT_EQ("50000\n", read_file(tmpfile2));
+  }
+  {
+    NS::Exit e = ("seq"_C(1, 10) | B::tee({tmpfile, tmpfile2}, true)) > "/dev/null";
+    EXPECT_TRUE(e.success());
+    EXPECT_EQ(seq(1, 50000) + seq(1, 10), read_file(tmpfile));
+    EXPECT_EQ("50000\n" + seq(1, 10), read_file(tmpfile2));
+  }
+  {
+    // A file named like the append option
+    NS::Exit e = ("seq"_C(1, 3) | B::tee({"-a"})) > "/dev/null";
+    EXPECT_TRUE(e.success());
+    EXPECT_EQ(seq(1, 3), read_file("-a"));
+    unlink("-a");
+  }
+} // Builtin.Tee
+
+TEST(Builtin, Split) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = "seq"_C(1, 25) | B::split(10, "Builtin_split_tmp_");
+  EXPECT_TRUE(e.success());
+  EXPECT_EQ(seq(1, 10), read_file("Builtin_split_tmp_aa"));
+  EXPECT_EQ(seq(11, 20), read_file("Builtin_split_tmp_ab"));
+  EXPECT_EQ(seq(21, 25), read_file("Builtin_split_tmp_ac"));
+  EXPECT_NE(0, access("Builtin_split_tmp_ad", F_OK));
+} // Builtin.Split
+
+TEST(Builtin, Failure) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = B::cat({"/doesntexists"}) > NS::R(2).to("/dev/null");
+  EXPECT_FALSE(e.success());
+  ASSERT_TRUE(e[0].have_status());
+  EXPECT_EQ(1, e[0].status().exit_status());
+  EXPECT_EQ(1, std::distance(e.failures().begin(), e.failures().end()));
+} // Builtin.Failure
+} // empty namespace
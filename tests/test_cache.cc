@@ -0,0 +1,117 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+static const char* tmpfile  = "Cache_tmp";
+static const char* tmpfile2 = "Cache_tmp_2";
+static const char* logfile  = "Cache_tmp_log";
+static const char* cachedir = "Cache_tmp_dir";
+
+class Cache : public ::testing::Test {
+protected:
+  NS::cache_options opts;
+  void SetUp() override {
+    ASSERT_TRUE(NS::Exit("rm"_C("-rf", cachedir, logfile)).success());
+    opts.dir = cachedir;
+  }
+  void TearDown() override { NS::Exit("rm"_C("-rf", cachedir)); }
+
+  // Command logging each time it runs
+  std::string logged(const std::string& cmd) { return std::string("echo run >> ") + logfile + "; " + cmd; }
+};
+
+TEST_F(Cache, Outputs) {
+  check_fixed_fds check_fds;
+
+  auto run = [&]() {
+    return NS::Exit(("sh"_C("-c", logged("seq 1 5; echo error >&2")) < "/dev/null" > tmpfile > NS::R(2).to(tmpfile2)).cacheable(opts));
+  };
+  {
+    NS::Exit e = run();
+    EXPECT_TRUE(e.success());
+    EXPECT_FALSE(e[0].cached);
+  }
+  unlink(tmpfile);
+  unlink(tmpfile2);
+  {
+    NS::Exit e = run();
+    EXPECT_TRUE(e.success());
+    EXPECT_TRUE(e[0].cached);
+  }
+  EXPECT_EQ("run\n", read_file(logfile));
+  EXPECT_EQ("1\n2\n3\n4\n5\n", read_file(tmpfile));
+  EXPECT_EQ("error\n", read_file(tmpfile2));
+} // Cache.Outputs
+
+TEST_F(Cache, Stdout) {
+  check_fixed_fds check_fds;
+
+  for(int i = 0; i < 2; ++i) {
+    int fd = open(tmpfile, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+    ASSERT_NE(-1, fd);
+    NS::Exit e = (("sh"_C("-c", logged("seq 1 3")) < "/dev/null") | "tac"_C()).cacheable(opts).run(-1, fd);
+    close(fd);
+    EXPECT_TRUE(e.success());
+    EXPECT_EQ(i == 1, e[0].cached);
+    EXPECT_EQ(i == 1, e[1].cached);
+    EXPECT_EQ("3\n2\n1\n", read_file(tmpfile));
+  }
+  EXPECT_EQ("run\n", read_file(logfile));
+} // Cache.Stdout
+
+TEST_F(Cache, Key) {
+  check_fixed_fds check_fds;
+
+  auto run = [&]() {
+    return NS::Exit(("sh"_C("-c", logged("cat")) < tmpfile2 > tmpfile).cacheable(opts));
+  };
+  ASSERT_TRUE(NS::Exit("echo"_C("hello") > tmpfile2).success());
+  EXPECT_TRUE(run().success());
+  EXPECT_TRUE(run().success());
+  EXPECT_EQ("run\n", read_file(logfile));
+
+  // Changing the input file invalidates the entry
+  ASSERT_TRUE(NS::Exit("echo"_C("hello world") > tmpfile2).success());
+  EXPECT_TRUE(run().success());
+  EXPECT_EQ("hello world\n", read_file(tmpfile));
+  EXPECT_EQ("run\nrun\n", read_file(logfile));
+
+  // So does changing the command line
+  EXPECT_TRUE(NS::Exit(("sh"_C("-c", logged("cat"), "sh") < tmpfile2 > tmpfile).cacheable(opts)).success());
+  EXPECT_EQ("run\nrun\nrun\n", read_file(logfile));
+} // Cache.Key
+
+TEST_F(Cache, NotCached) {
+  check_fixed_fds check_fds;
+
+  // Failures are not saved
+  for(int i = 0; i < 2; ++i) {
+    NS::Exit e(("sh"_C("-c", logged("exit 1")) < "/dev/null" > tmpfile).cacheable(opts));
+    EXPECT_FALSE(e.success());
+    EXPECT_FALSE(e[0].cached);
+  }
+  EXPECT_EQ("run\nrun\n", read_file(logfile));
+
+  // Appending is not cacheable
+  for(int i = 0; i < 2; ++i) {
+    NS::Exit e((("sh"_C("-c", logged("true")) < "/dev/null") >> tmpfile).cacheable(opts));
+    EXPECT_TRUE(e.success());
+    EXPECT_FALSE(e[0].cached);
+  }
+  EXPECT_EQ("run\nrun\nrun\nrun\n", read_file(logfile));
+
+  // Nor is reading the inherited standard input
+  for(int i = 0; i < 2; ++i) {
+    NS::Exit e(("sh"_C("-c", logged("true")) > tmpfile).cacheable(opts));
+    EXPECT_TRUE(e.success());
+    EXPECT_FALSE(e[0].cached);
+  }
+  EXPECT_EQ("run\nrun\nrun\nrun\nrun\nrun\n", read_file(logfile));
+} // Cache.NotCached
+} // empty namespace
@@ -0,0 +1,144 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+static const char* tmpfile = "Cgroup_tmp";
+
+// Mount point of the cgroup v2 hierarchy, empty if none
+std::string cgroup2_mount() {
+  std::ifstream is("/proc/self/mounts");
+  std::string   dev, dir, type, rest;
+  while(is >> dev >> dir >> type && std::getline(is, rest))
+    if(type == "cgroup2") return dir;
+  return std::string();
+}
+
+// Path of the cgroup v2 of this process, relative to the mount point
+std::string own_cgroup() {
+  std::ifstream is("/proc/self/cgroup");
+  std::string   line;
+  while(std::getline(is, line))
+    if(line.compare(0, 3, "0::") == 0) return line.substr(3);
+  return std::string();
+}
+
+// Run the tests in a cgroup created under the cgroup of this process,
+// if it is delegated to the user.
+class Cgroup : public ::testing::Test {
+protected:
+  std::string mount, rel, dir; // rel is the path of dir relative to mount
+  void SetUp() override {
+    mount = cgroup2_mount();
+    if(mount.empty()) GTEST_SKIP() << "No cgroup v2 hierarchy";
+    const std::string own = own_cgroup();
+    rel = (own == "/" ? std::string() : own) + "/noshell_test_" + std::to_string(getpid());
+    dir = mount + rel;
+    if(mkdir(dir.c_str(), 0755) == -1 || access((dir + "/cgroup.procs").c_str(), W_OK) == -1)
+      GTEST_SKIP() << "No cgroup delegation: " << strerror(errno);
+  }
+  void TearDown() override {
+    if(!dir.empty()) rmdir(dir.c_str());
+    unlink(tmpfile);
+  }
+};
+
+TEST_F(Cgroup, PerExit) {
+  check_fixed_fds check_fds;
+
+  // The busy loop runs in a grandchild
+  NS::Exit e = ("sh"_C("-c", "cat /proc/self/cgroup; sh -c 'i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done'") > tmpfile).cgroup(dir, true).run();
+  const std::string path = e.cgroup_path();
+  ASSERT_EQ((size_t)0, path.find(dir + "/noshell-")) << path;
+  EXPECT_TRUE(e.cgroup_stats().valid); // While running
+  e.wait();
+  EXPECT_TRUE(e.success());
+
+  const NS::CgroupStats stats = e.cgroup_stats();
+  EXPECT_TRUE(stats.valid);
+  EXPECT_LT(0, stats.cpu_usage.count());
+  EXPECT_LE(stats.cpu_user.count() + stats.cpu_system.count(), stats.cpu_usage.count() + 1000);
+  EXPECT_EQ(-1, access(path.c_str(), F_OK)); // Removed once waited for
+  EXPECT_NE(std::string::npos, read_file(tmpfile).find("0::" + path.substr(mount.size()) + '\n'));
+} // Cgroup.PerExit
+
+TEST_F(Cgroup, Stage) {
+  check_fixed_fds check_fds;
+
+  const std::string expected = "0::" + rel + '\n';
+  auto in_cgroup = [&](const std::vector<std::string>&) -> int {
+    char      buf[4096];
+    const int fd = open("/proc/self/cgroup", O_RDONLY);
+    ssize_t   n  = read(fd, buf, sizeof(buf));
+    close(fd);
+    return n > 0 && std::string(buf, n).find(expected) != std::string::npos ? 0 : 1;
+  };
+  NS::Exit e = (NS::stage(in_cgroup) | "grep"_C("-q", expected.substr(0, expected.size() - 1), "/proc/self/cgroup")).cgroup(dir).run();
+  EXPECT_EQ(dir, e.cgroup_path());
+  e.wait();
+  EXPECT_TRUE(e.success()) << e;
+  EXPECT_TRUE(e.cgroup_stats().valid);
+} // Cgroup.Stage
+
+TEST_F(Cgroup, Kill) {
+  check_fixed_fds check_fds;
+  if(access((dir + "/cgroup.kill").c_str(), W_OK) == -1) GTEST_SKIP() << "No cgroup.kill";
+
+  auto wait_empty = [](const std::string& procs) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(!read_file(procs).empty() && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return read_file(procs);
+  };
+
+  // The background sleep is not a child of the parent
+  {
+    NS::Exit e = "sh"_C("-c", "sleep 100 & sleep 100").cgroup(dir, true).run();
+    const std::string path = e.cgroup_path();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_TRUE(e.kill(SIGKILL));
+    e.wait();
+    ASSERT_TRUE(e[0].have_status());
+    EXPECT_EQ(SIGKILL, e[0].status().term_sig());
+    if(access(path.c_str(), F_OK) == 0) { // Not removed yet if the sleep was still exiting
+      EXPECT_EQ("", wait_empty(path + "/cgroup.procs"));
+    }
+  }
+
+  // A cgroup given as is may be shared: the background sleep survives
+  NS::Exit e = "sh"_C("-c", "sleep 100 & sleep 100").cgroup(dir).run();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_TRUE(e.kill(SIGKILL));
+  e.wait();
+  ASSERT_TRUE(e[0].have_status());
+  EXPECT_EQ(SIGKILL, e[0].status().term_sig());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_NE("", read_file(dir + "/cgroup.procs"));
+  std::ofstream(dir + "/cgroup.kill") << "1";
+  EXPECT_EQ("", wait_empty(dir + "/cgroup.procs"));
+} // Cgroup.Kill
+
+TEST(CgroupError, NoCgroup) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = ("true"_C() | "true"_C()).cgroup("/nonexistent/cgroup").run();
+  e.wait();
+  ASSERT_EQ(2, std::distance(e.begin(), e.end()));
+  for(const auto& h : e) {
+    EXPECT_TRUE(h.setup_error());
+    EXPECT_EQ(ENOENT, h.err().value);
+    EXPECT_EQ("Failed to open cgroup", h.message);
+  }
+  EXPECT_FALSE(e.cgroup_stats().valid);
+  EXPECT_EQ("", e.cgroup_path());
+} // CgroupError.NoCgroup
+} // empty namespace
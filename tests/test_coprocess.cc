@@ -0,0 +1,159 @@
+#include <signal.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/coprocess.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+TEST(CoProcess, Delimiter) {
+  check_fixed_fds check_fds;
+
+  NS::CoProcess co([]() { return "cat"_C(); });
+  EXPECT_TRUE(co.running());
+  std::string res;
+  for(int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(co.request(std::to_string(i), res));
+    EXPECT_EQ(std::to_string(i), res);
+  }
+  EXPECT_EQ((size_t)0, co.restarts());
+  co.stop();
+  EXPECT_TRUE(co.exit().success());
+} // CoProcess.Delimiter
+
+TEST(CoProcess, LengthPrefix) {
+  check_fixed_fds check_fds;
+
+  NS::CoProcess co([]() { return "cat"_C(); }, NS::framing::length_prefix(2));
+  std::string res;
+  const std::string req("a\nb\0c", 5);
+  ASSERT_TRUE(co.request(req, res));
+  EXPECT_EQ(req, res);
+  const std::string large(200000, 'x'); // Larger than the pipe buffers
+  NS::CoProcess co4([]() { return "cat"_C(); }, NS::framing::length_prefix());
+  ASSERT_TRUE(co4.request(large, res));
+  EXPECT_EQ(large, res);
+
+  // 256 bytes do not fit in a 1 byte length. The co-process is kept.
+  NS::CoProcess co1([]() { return "cat"_C(); }, NS::framing::length_prefix(1));
+  EXPECT_FALSE(co1.request(std::string(256, 'x'), res));
+  EXPECT_EQ(EMSGSIZE, co1.error());
+  EXPECT_TRUE(co1.running());
+  ASSERT_TRUE(co1.request(std::string(255, 'x'), res));
+  EXPECT_EQ(std::string(255, 'x'), res);
+  EXPECT_EQ((size_t)0, co1.restarts());
+  EXPECT_TRUE(NS::framing::length_prefix(8).fits(large.size()));
+
+  // Only 1, 2, 4 or 8 bytes: nothing is started
+  const NS::framing wide{NS::framing::LENGTH_PREFIX, 16, '\0', std::string()};
+  EXPECT_FALSE(wide.valid());
+  NS::CoProcess co16([]() { return "cat"_C(); }, wide);
+  EXPECT_FALSE(co16.request(req, res));
+  EXPECT_EQ(EINVAL, co16.error());
+  EXPECT_EQ((size_t)0, co16.restarts());
+#ifndef NDEBUG
+  EXPECT_DEATH(NS::framing::length_prefix(3), "");
+#endif
+} // CoProcess.LengthPrefix
+
+TEST(CoProcess, MaxSize) {
+  check_fixed_fds check_fds;
+
+  // The response is refused from its length, and the co-process stopped
+  NS::CoProcess co([]() { return "cat"_C(); }, NS::framing::length_prefix(2).max_size(4));
+  std::string res;
+  ASSERT_TRUE(co.request("abcd", res));
+  EXPECT_EQ("abcd", res);
+  EXPECT_FALSE(co.request("abcde", res));
+  EXPECT_EQ(EMSGSIZE, co.error());
+  EXPECT_FALSE(co.running());
+
+  NS::CoProcess lines([]() { return "cat"_C(); }, NS::framing::delimiter().max_size(4));
+  EXPECT_FALSE(lines.request("abcdefgh", res));
+  EXPECT_EQ(EMSGSIZE, lines.error());
+  ASSERT_TRUE(lines.request("abc", res)); // On a restarted co-process
+  EXPECT_EQ("abc", res);
+
+  NS::CoProcess sh([]() { return "sh"_C(); }, NS::framing::sentinel_line("END").max_size(4));
+  EXPECT_FALSE(sh.request("echo abcd; echo END", res));
+  EXPECT_EQ(EMSGSIZE, sh.error());
+
+  // Not buffered past the max: the output of yes has no newline left
+  NS::CoProcess yes([]() { return "yes"_C() | "tr"_C("-d", "\\n"); }, NS::framing::delimiter().max_size(100000));
+  EXPECT_FALSE(yes.request("a", res));
+  EXPECT_EQ(EMSGSIZE, yes.error());
+} // CoProcess.MaxSize
+
+TEST(CoProcess, Sentinel) {
+  check_fixed_fds check_fds;
+
+  NS::CoProcess sh([]() { return "sh"_C(); }, NS::framing::sentinel_line("END"));
+  std::string res;
+  ASSERT_TRUE(sh.request("echo a; echo b; echo END", res));
+  EXPECT_EQ("a\nb\n", res);
+  ASSERT_TRUE(sh.request("echo END", res));
+  EXPECT_EQ("", res);
+} // CoProcess.Sentinel
+
+TEST(CoProcess, Restart) {
+  check_fixed_fds check_fds;
+
+  NS::CoProcess sh([]() { return "sh"_C(); }, NS::framing::sentinel_line("END"));
+  std::string res;
+  EXPECT_FALSE(sh.request("exit 3", res));
+  EXPECT_FALSE(sh.running());
+  EXPECT_FALSE(sh.exit().success());
+  ASSERT_TRUE(sh.request("echo hello; echo END", res));
+  EXPECT_EQ("hello\n", res);
+  EXPECT_EQ((size_t)1, sh.restarts());
+
+  // A restarted co-process does not inherit SIGPIPE blocked. grep
+  // prints its own mask, then waits on its stdin.
+  NS::CoProcess mask([]() { return "grep"_C("-h", "--line-buffered", "SigBlk", "/proc/self/status", "-"); });
+  mask.stop();
+  ASSERT_TRUE(mask.request("", res));
+  EXPECT_EQ((size_t)1, mask.restarts());
+  ASSERT_EQ((size_t)0, res.find("SigBlk:"));
+  EXPECT_EQ(0ull, std::stoull(res.substr(7), nullptr, 16) & (1ull << (SIGPIPE - 1)));
+} // CoProcess.Restart
+
+TEST(CoProcess, Failure) {
+  check_fixed_fds check_fds;
+
+  NS::CoProcess co([]() { return "/doesntexists"_C(); });
+  EXPECT_FALSE(co.running());
+  EXPECT_EQ(ENOENT, co.error());
+  std::string res;
+  EXPECT_FALSE(co.request("a", res));
+} // CoProcess.Failure
+
+TEST(CoProcess, Pool) {
+  check_fixed_fds check_fds;
+
+  NS::CoProcessPool pool(3, []() { return "cat"_C() | "cat"_C(); });
+  EXPECT_EQ((size_t)3, pool.size());
+  std::vector<std::thread> threads;
+  std::vector<int>         errors(4, 0);
+  for(int t = 0; t < 4; ++t) {
+    threads.push_back(std::thread([&, t]() {
+          std::string res;
+          for(int i = 0; i < 200; ++i) {
+            const std::string req = std::to_string(t) + ':' + std::to_string(i);
+            if(!pool.request(req, res) || res != req)
+              ++errors[t];
+          }
+        }));
+  }
+  for(auto& th : threads)
+    th.join();
+  for(int t = 0; t < 4; ++t)
+    EXPECT_EQ(0, errors[t]);
+  for(size_t i = 0; i < pool.size(); ++i)
+    EXPECT_TRUE(pool[i].running());
+} // CoProcess.Pool
+} // empty namespace
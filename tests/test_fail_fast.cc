@@ -0,0 +1,61 @@
+#include <chrono>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+typedef std::chrono::steady_clock clock_type;
+
+TEST(FailFast, Failure) {
+  check_fixed_fds check_fds;
+
+  const auto start = clock_type::now();
+  NS::Exit e = ("sh"_C("-c", "sleep 0.1; exit 3") | "sleep"_C(100) | "sleep"_C(100)).pipefail_fast();
+  EXPECT_LT(clock_type::now() - start, std::chrono::seconds(10));
+  EXPECT_FALSE(e.success());
+  ASSERT_TRUE(e[0].have_status());
+  EXPECT_EQ(3, e[0].status().exit_status());
+  EXPECT_FALSE(e[0].aborted);
+  for(int i = 1; i < 3; ++i) {
+    ASSERT_TRUE(e[i].have_status());
+    EXPECT_EQ(SIGTERM, e[i].status().term_sig());
+    EXPECT_TRUE(e[i].aborted);
+  }
+} // FailFast.Failure
+
+TEST(FailFast, Sigpipe) {
+  check_fixed_fds check_fds;
+
+  {
+    NS::Exit e = ("yes"_C() | "head"_C("-n", 1) | "sleep"_C("0.2")).pipefail_fast(true);
+    EXPECT_TRUE(e.success(true));
+    for(const auto& h : e)
+      EXPECT_FALSE(h.aborted);
+  }
+  {
+    const auto start = clock_type::now();
+    NS::Exit e = ("yes"_C() | "head"_C("-n", 1) | "sleep"_C(100)).pipefail_fast(false, SIGKILL);
+    EXPECT_LT(clock_type::now() - start, std::chrono::seconds(10));
+    EXPECT_EQ(SIGPIPE, e[0].status().term_sig());
+    EXPECT_EQ(SIGKILL, e[2].status().term_sig());
+    EXPECT_TRUE(e[2].aborted);
+  }
+} // FailFast.Sigpipe
+
+TEST(FailFast, Success) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = (("seq"_C(1, 1000) | "cat"_C()) > "/dev/null").pipefail_fast();
+  EXPECT_TRUE(e.success());
+  for(const auto& h : e)
+    EXPECT_FALSE(h.aborted);
+
+  // Not waited for: the watcher is stopped on destruction
+  int fd;
+  NS::Exit e2 = ("sleep"_C(100) | "cat"_C()).pipefail_fast() | fd;
+  close(fd);
+  e2.kill_on_destroy();
+} // FailFast.Success
+} // empty namespace
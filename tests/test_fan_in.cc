@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/fan_in.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+std::vector<std::string> read_lines(NS::istream& is) {
+  std::vector<std::string> res;
+  std::string line;
+  while(std::getline(is, line))
+    res.push_back(line);
+  return res;
+}
+
+TEST(FanIn, Concat) {
+  check_fixed_fds check_fds;
+
+  NS::FanIn f(NS::FanIn::CONCAT);
+  f.add("./puts_to"_C(1, "a1", "a2")).add("./puts_to"_C(1, "b1")).add("./puts_to"_C(1, "c1", "c2"));
+  NS::istream is;
+  NS::Exit e = f.pipeline() | "cat"_C() | is;
+  const auto lines = read_lines(is);
+  is.close();
+  e.wait();
+
+  EXPECT_TRUE(e.success());
+  const std::vector<std::string> expected{"a1", "a2", "b1", "c1", "c2"};
+  EXPECT_EQ(expected, lines);
+  ASSERT_EQ((size_t)3, e[0].attached.size());
+  for(const auto& it : e[0].attached)
+    EXPECT_TRUE(it->success());
+} // FanIn.Concat
+
+TEST(FanIn, Lines) {
+  check_fixed_fds check_fds;
+
+  const std::string a(5000, 'a'), b(7000, 'b');
+  NS::FanIn f(NS::FanIn::LINES);
+  f.add("yes"_C(a) | "head"_C("-n", 200)).add("yes"_C(b) | "head"_C("-n", 300));
+  NS::istream is;
+  NS::Exit e = f.pipeline() | is;
+  const auto lines = read_lines(is);
+  is.close();
+  e.wait();
+
+  EXPECT_TRUE(e.success(true));
+  ASSERT_EQ((size_t)500, lines.size());
+  int nb_a = 0;
+  for(const auto& line : lines) {
+    if(line == a) ++nb_a;
+    else EXPECT_EQ(b, line);
+  }
+  EXPECT_EQ(200, nb_a);
+} // FanIn.Lines
+
+TEST(FanIn, LastLine) {
+  check_fixed_fds check_fds;
+
+  // The partial last line of a is not glued to the line of b
+  NS::FanIn f(NS::FanIn::LINES);
+  f.add("printf"_C("a1\\na2")).add("./puts_to"_C(1, "b1"));
+  NS::istream is;
+  NS::Exit e = f.pipeline() | is;
+  auto lines = read_lines(is);
+  is.close();
+  e.wait();
+
+  EXPECT_TRUE(e.success());
+  std::sort(lines.begin(), lines.end());
+  const std::vector<std::string> expected{"a1", "a2", "b1"};
+  EXPECT_EQ(expected, lines);
+} // FanIn.LastLine
+
+TEST(FanIn, Records) {
+  check_fixed_fds check_fds;
+
+  NS::FanIn f(NS::FanIn::RECORDS, 8);
+  f.add("yes"_C("AAAAAAA") | "head"_C("-n", 1000)).add("yes"_C("BBBBBBB") | "head"_C("-n", 1000));
+  NS::istream is;
+  NS::Exit e = f.pipeline() | is;
+  const auto lines = read_lines(is);
+  is.close();
+  e.wait();
+
+  EXPECT_TRUE(e.success(true));
+  ASSERT_EQ((size_t)2000, lines.size());
+  for(const auto& line : lines)
+    EXPECT_TRUE(line == "AAAAAAA" || line == "BBBBBBB") << line;
+} // FanIn.Records
+
+TEST(FanIn, Failure) {
+  check_fixed_fds check_fds;
+
+  NS::FanIn f;
+  f.add("./puts_to"_C(1, "hello")).add("false"_C());
+  NS::Exit e = (f.pipeline() | "wc"_C("-l")) > "/dev/null";
+
+  EXPECT_FALSE(e.success());
+  EXPECT_TRUE(e[0].success());
+  EXPECT_TRUE(e[1].success());
+  ASSERT_EQ((size_t)2, e[0].attached.size());
+  EXPECT_TRUE(e[0].attached[0]->success());
+  EXPECT_FALSE(e[0].attached[1]->success());
+  // The merging stage fails along with its input, but not wc
+  auto failures = e.failures();
+  ASSERT_EQ(1, std::distance(failures.begin(), failures.end()));
+  EXPECT_EQ(0, failures.begin().id());
+  EXPECT_FALSE(e[0].success_all());
+} // FanIn.Failure
+
+TEST(Stage, Function) {
+  check_fixed_fds check_fds;
+
+  NS::istream is;
+  NS::Exit e = NS::stage([](const std::vector<std::string>& args) -> int {
+      for(const auto& it : args) {
+        const std::string line = it + '\n';
+        if(write(1, line.data(), line.size()) != (ssize_t)line.size()) return 1;
+      }
+      return 3;
+    }, {"x", "y"}) | "cat"_C() | is;
+  const auto lines = read_lines(is);
+  is.close();
+  e.wait();
+
+  const std::vector<std::string> expected{"x", "y"};
+  EXPECT_EQ(expected, lines);
+  ASSERT_TRUE(e[0].have_status());
+  EXPECT_EQ(3, e[0].status().exit_status());
+  EXPECT_TRUE(e[1].success());
+} // Stage.Function
+} // empty namespace
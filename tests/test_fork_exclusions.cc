@@ -0,0 +1,86 @@
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <vector>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/fork_exclusions.hpp>
+#include <noshell/template.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+struct mapping {
+  const size_t len;
+  char*        data;
+  mapping(size_t l) : len(l), data((char*)mmap(nullptr, l, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)) {
+    if(data != MAP_FAILED) memset(data, 1, len);
+  }
+  ~mapping() { if(data != MAP_FAILED) munmap(data, len); }
+};
+
+// Exit status 0 if the whole buffer is 1, 1 if it is 0
+NS::PipeLine check(const mapping& m) {
+  return NS::stage([&](const std::vector<std::string>&) -> int {
+      for(size_t i = 0; i < m.len; ++i)
+        if(m.data[i] != 1) return 1;
+      return 0;
+    });
+}
+
+TEST(ForkExclusions, WipeOnFork) {
+  check_fixed_fds check_fds;
+  mapping         m(64 * sysconf(_SC_PAGESIZE));
+  ASSERT_NE(MAP_FAILED, (void*)m.data);
+
+  if(!NS::fork_exclusions::add(m.data, m.len, NS::fork_exclusions::WIPEONFORK)) {
+    ASSERT_EQ(EINVAL, errno); // Before Linux 4.14
+    GTEST_SKIP() << "MADV_WIPEONFORK not supported";
+  }
+  EXPECT_EQ((size_t)1, NS::fork_exclusions::size());
+  {
+    NS::Exit e = check(m);
+    ASSERT_TRUE(e[0].have_status());
+    EXPECT_EQ(1, e[0].status().exit_status()); // Zeroed in the child
+  }
+  EXPECT_EQ(1, m.data[0]); // Not in the parent
+  EXPECT_EQ(1, m.data[m.len - 1]);
+
+  EXPECT_TRUE(NS::fork_exclusions::remove(m.data));
+  EXPECT_FALSE(NS::fork_exclusions::remove(m.data));
+  EXPECT_EQ((size_t)0, NS::fork_exclusions::size());
+  NS::Exit e = check(m);
+  EXPECT_TRUE(e.success());
+} // ForkExclusions.WipeOnFork
+
+TEST(ForkExclusions, DontFork) {
+  check_fixed_fds check_fds;
+  mapping         m(64 * sysconf(_SC_PAGESIZE));
+  ASSERT_NE(MAP_FAILED, (void*)m.data);
+
+  ASSERT_TRUE(NS::fork_exclusions::add(m.data, m.len));
+  {
+    NS::Exit e = check(m);
+    ASSERT_TRUE(e[0].have_status());
+    EXPECT_EQ(SIGSEGV, e[0].status().term_sig()); // Not mapped in the child
+  }
+  {
+    NS::Exit e = "true"_C() | "true"_C(); // Commands do not care
+    EXPECT_TRUE(e.success());
+    NS::Template t({ "true", "{}" });
+    EXPECT_TRUE(t.run_wait("x").success());
+  }
+  EXPECT_TRUE(NS::fork_exclusions::remove(m.data));
+  NS::Exit e = check(m);
+  EXPECT_TRUE(e.success());
+} // ForkExclusions.DontFork
+
+TEST(ForkExclusions, Small) {
+  // Less than a page: nothing to exclude
+  char buf[16];
+  EXPECT_TRUE(NS::fork_exclusions::add(buf, sizeof(buf)));
+  EXPECT_EQ((size_t)0, NS::fork_exclusions::size());
+} // ForkExclusions.Small
+} // empty namespace
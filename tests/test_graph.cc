@@ -0,0 +1,70 @@
+#include <unistd.h>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/graph.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+static const char* tmpfile1 = "Graph1_tmp";
+static const char* tmpfile2 = "Graph2_tmp";
+
+bool write_str(int fd, const std::string& str) {
+  return write(fd, str.data(), str.size()) == (ssize_t)str.size();
+}
+
+TEST(Graph, Edges) {
+  check_fixed_fds check_fds;
+
+  NS::Graph g;
+  const auto a = g.add(NS::stage([](const std::vector<std::string>&) -> int {
+        return write_str(3, "to b\n") && write_str(1, "to c\n") ? 0 : 1;
+      }));
+  const auto b = g.add("cat"_C() > tmpfile1);
+  const auto c = g.add(("cat"_C() | "cat"_C()) > tmpfile2);
+  EXPECT_TRUE(g.connect(a, 3, b, 0));
+  EXPECT_TRUE(g.connect(a, 1, c, 0));
+  EXPECT_FALSE(g.connect(a, 1, b, 4));
+  EXPECT_FALSE(g.connect(a, 4, b, 0));
+  EXPECT_FALSE(g.connect(a, 5, 10, 0));
+  EXPECT_EQ((size_t)4, g.size());
+
+  NS::Exit e = g.run_wait();
+  EXPECT_TRUE(e.success());
+  EXPECT_EQ("to b\n", read_file(tmpfile1));
+  EXPECT_EQ("to c\n", read_file(tmpfile2));
+} // Graph.Edges
+
+TEST(Graph, Join) {
+  check_fixed_fds check_fds;
+
+  NS::Graph g;
+  const auto a = g.add("./puts_to"_C(1, "a1", "a2"));
+  const auto b = g.add("./puts_to"_C(5, "b1", "b2"));
+  const auto p = g.add("paste"_C("-d", ":", "/dev/fd/3", "/dev/fd/4") > tmpfile1);
+  EXPECT_TRUE(g.connect(a, 1, p, 3));
+  EXPECT_TRUE(g.connect(b, 5, p, 4));
+
+  for(int i = 0; i < 2; ++i) {
+    NS::Exit e = g.run_wait();
+    EXPECT_TRUE(e.success());
+    EXPECT_EQ("a1:b1\na2:b2\n", read_file(tmpfile1));
+  }
+} // Graph.Join
+
+TEST(Graph, Failure) {
+  check_fixed_fds check_fds;
+
+  NS::Graph g;
+  const auto a = g.add("./puts_to"_C(1, "hello") < "doesntexists");
+  const auto b = g.add("cat"_C() > "/dev/null");
+  EXPECT_TRUE(g.connect(a, 1, b, 0));
+
+  NS::Exit e = g.run_wait();
+  EXPECT_FALSE(e.success());
+  EXPECT_TRUE(e[0].setup_error());
+  EXPECT_TRUE(e[1].success()); // Got end of file
+} // Graph.Failure
+} // empty namespace
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+bool contains(const std::string& s, const std::string& what) { return s.find(what) != std::string::npos; }
+
+TEST(Json, Statuses) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = "sh"_C("-c", "exit 3") | "sh"_C("-c", "kill -PIPE $$") | "/nonexistent/command"_C();
+  const std::string json = e.to_json();
+
+  EXPECT_EQ(0, json.find("{\"success\":false,\"stages\":[{\"argv\":[\"sh\",\"-c\",\"exit 3\"],\"pid\":" + std::to_string(e[0].pid) + ","));
+  EXPECT_TRUE(contains(json, "\"exit_status\":3,"));
+  EXPECT_TRUE(contains(json, "\"argv\":[\"sh\",\"-c\",\"kill -PIPE $$\"]"));
+  EXPECT_TRUE(contains(json, "\"signal\":13,\"signal_name\":\"SIGPIPE\",\"core_dump\":false,"));
+  EXPECT_TRUE(contains(json, "\"error\":{\"errno\":2,\"message\":\""));
+  EXPECT_EQ(std::count(json.begin(), json.end(), '{'), std::count(json.begin(), json.end(), '}'));
+  EXPECT_EQ(std::count(json.begin(), json.end(), '['), std::count(json.begin(), json.end(), ']'));
+  EXPECT_EQ('}', json.back());
+
+  std::ostringstream os;
+  EXPECT_TRUE(e.write_json(os));
+  EXPECT_EQ(json, os.str());
+
+  // The argv of each run is shared with the command, not copied
+  NS::PipeLine pl = "true"_C("x");
+  NS::Exit     e1 = pl.run(), e2 = pl.run();
+  e1.wait();
+  e2.wait();
+  EXPECT_EQ(e1[0].argv.get(), e2[0].argv.get());
+} // Json.Statuses
+
+TEST(Json, Resources) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = "true"_C("a\"b\\c\n\x01");
+  EXPECT_TRUE(e.success());
+  const std::string json = e.to_json();
+  EXPECT_TRUE(contains(json, "\"argv\":[\"true\",\"a\\\"b\\\\c\\n\\u0001\"],"));
+  EXPECT_TRUE(contains(json, "\"success\":true,\"exit_status\":0,\"wall_us\":"));
+  for(const char* key : { "user_us", "system_us", "max_rss_kb", "minor_faults", "major_faults", "in_blocks",
+        "out_blocks", "voluntary_switches", "involuntary_switches" })
+    EXPECT_TRUE(contains(json, std::string("\"") + key + "\":")) << key;
+  EXPECT_TRUE(contains(json, "\"max_rss_kb\":" + std::to_string(e[0].maximum_rss()) + ","));
+} // Json.Resources
+
+TEST(Json, Attached) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = "cat"_C(NS::input_of("echo"_C("hello"))) > "/dev/null";
+  EXPECT_TRUE(e.success());
+  const std::string json = e.to_json();
+  EXPECT_TRUE(contains(json, "\"attached\":[{\"success\":true,\"stages\":[{\"argv\":[\"echo\",\"hello\"],"));
+} // Json.Attached
+} // empty namespace
@@ -0,0 +1,123 @@
+#include <unistd.h>
+#include <signal.h>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+// True if the process pid is gone (or a zombie not reaped by its new parent)
+bool process_gone(pid_t pid) {
+  std::ifstream is("/proc/" + std::to_string(pid) + "/stat");
+  if(!is.good()) return true;
+  std::string line;
+  std::getline(is, line);
+  const auto paren = line.rfind(')');
+  return paren != std::string::npos && paren + 2 < line.size() && line[paren + 2] == 'Z';
+}
+
+bool wait_gone(pid_t pid) {
+  for(int i = 0; i < 500; ++i) {
+    if(process_gone(pid)) return true;
+    usleep(10000);
+  }
+  return false;
+}
+
+TEST(Kill, Signal) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = ("sleep"_C(100) | "sleep"_C(100)).run();
+  EXPECT_FALSE(e.wait_for(std::chrono::milliseconds(10)));
+  EXPECT_TRUE(e.kill(SIGKILL));
+  e.wait();
+  for(const auto& h : e) {
+    ASSERT_TRUE(h.have_status());
+    EXPECT_TRUE(h.status().signaled());
+    EXPECT_EQ(SIGKILL, h.status().term_sig());
+  }
+} // Kill.Signal
+
+TEST(Kill, ProcessGroup) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = ("sleep"_C(100) | "sleep"_C(100)).process_group().run();
+  ASSERT_EQ(e[0].pid, e.process_group());
+  EXPECT_EQ(e[0].pid, getpgid(e[0].pid));
+  EXPECT_EQ(e[0].pid, getpgid(e[1].pid));
+  EXPECT_NE(getpgid(0), e.process_group());
+  EXPECT_TRUE(e.kill());
+  e.wait();
+  EXPECT_EQ(SIGTERM, e[0].status().term_sig());
+  EXPECT_EQ(SIGTERM, e[1].status().term_sig());
+} // Kill.ProcessGroup
+
+TEST(Kill, Terminate) {
+  check_fixed_fds check_fds;
+
+  {
+    NS::Exit e = "sleep"_C(100).run();
+    EXPECT_TRUE(e.terminate(std::chrono::seconds(5)));
+    EXPECT_EQ(SIGTERM, e[0].status().term_sig());
+  }
+  {
+    // Stage ignoring SIGTERM. It tells when it is ready.
+    int fd;
+    NS::Exit e = NS::stage([](const std::vector<std::string>&) -> int {
+        signal(SIGTERM, SIG_IGN);
+        if(write(1, "x", 1) != 1) return 1;
+        close(1);
+        while(true) pause();
+        return 0;
+      }) | fd;
+    char c;
+    ASSERT_EQ(1, read(fd, &c, 1));
+    close(fd);
+    EXPECT_FALSE(e.terminate(std::chrono::milliseconds(50)));
+    EXPECT_EQ(SIGKILL, e[0].status().term_sig());
+  }
+} // Kill.Terminate
+
+TEST(Kill, OnDestroy) {
+  check_fixed_fds check_fds;
+
+  pid_t pid;
+  {
+    NS::Exit e = "sleep"_C(100).run();
+    pid = e[0].pid;
+    e.kill_on_destroy();
+  }
+  EXPECT_EQ(-1, kill(pid, 0)); // Killed and reaped
+
+  {
+    NS::Exit e = "sleep"_C(100).run();
+    pid = e[0].pid;
+  }
+  EXPECT_EQ(0, kill(pid, 0)); // Left running by default
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+} // Kill.OnDestroy
+
+TEST(Kill, DeathSignal) {
+  check_fixed_fds check_fds;
+
+  // A stage starts sleep with a death signal and exits: sleep gets SIGKILL.
+  int fd;
+  NS::Exit e = NS::stage([](const std::vector<std::string>&) -> int {
+      NS::Exit s = "sleep"_C(100).death_signal(SIGKILL).run();
+      const pid_t pid = s[0].pid;
+      return write(1, &pid, sizeof(pid)) == sizeof(pid) ? 0 : 1;
+    }) | fd;
+  pid_t pid = -1;
+  ASSERT_EQ((ssize_t)sizeof(pid), read(fd, &pid, sizeof(pid)));
+  close(fd);
+  e.wait();
+  EXPECT_TRUE(e.success());
+  EXPECT_TRUE(wait_gone(pid));
+} // Kill.DeathSignal
+} // empty namespace
@@ -0,0 +1,74 @@
+#include <unistd.h>
+#include <sys/resource.h>
+#include <chrono>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/records.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+TEST(Meter, Bytes) {
+  check_fixed_fds check_fds;
+
+  auto   lines = NS::lines(("seq"_C(1, 100000) | "cat"_C() | "cat"_C()).metered());
+  size_t nb    = 0;
+  for(auto line : lines)
+    EXPECT_EQ(std::to_string(++nb), line.str());
+  EXPECT_EQ((size_t)100000, nb);
+  EXPECT_TRUE(lines.exit().success());
+
+  const auto stats = lines.exit().link_stats();
+  ASSERT_EQ((size_t)2, stats.size());
+  for(const auto& s : stats) {
+    EXPECT_EQ((uint64_t)588895, s.bytes); // Length of seq 1 100000
+    EXPECT_TRUE(s.done);
+    EXPECT_LE(0.0, s.rate());
+    EXPECT_LE(s.rate(), s.peak_rate * 1.01);
+  }
+} // Meter.Bytes
+
+TEST(Meter, ReaderExits) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = (("yes"_C() | "head"_C("-c", 1000)) > "/dev/null").metered().run();
+  ASSERT_TRUE(e.wait_for(std::chrono::seconds(10))); // yes got SIGPIPE
+  EXPECT_TRUE(e.success(true));
+  EXPECT_EQ(SIGPIPE, e[0].status().term_sig());
+  const auto stats = e.link_stats();
+  ASSERT_EQ((size_t)1, stats.size());
+  EXPECT_LE((uint64_t)1000, stats[0].bytes);
+  EXPECT_TRUE(stats[0].done);
+} // Meter.ReaderExits
+
+TEST(Meter, SlowReader) {
+  check_fixed_fds check_fds;
+
+  // seq exits with data left in its pipe while the reader sleeps: the
+  // meter thread waits on the output instead of spinning
+  struct rusage before, after;
+  getrusage(RUSAGE_SELF, &before);
+  NS::Exit e = (("seq"_C(1, 15000) | "sh"_C("-c", "sleep 1; cat")) > "/dev/null").metered().run();
+  ASSERT_TRUE(e.wait_for(std::chrono::seconds(10)));
+  getrusage(RUSAGE_SELF, &after);
+  EXPECT_TRUE(e.success());
+  const auto stats = e.link_stats();
+  ASSERT_EQ((size_t)1, stats.size());
+  EXPECT_EQ((uint64_t)78894, stats[0].bytes); // Length of seq 1 15000
+  const auto cpu = [](const struct rusage& r) {
+    return r.ru_utime.tv_sec + r.ru_stime.tv_sec + (r.ru_utime.tv_usec + r.ru_stime.tv_usec) / 1e6;
+  };
+  EXPECT_GT(0.5, cpu(after) - cpu(before));
+} // Meter.SlowReader
+
+TEST(Meter, Off) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = "true"_C() | "true"_C();
+  EXPECT_TRUE(e.success());
+  EXPECT_TRUE(e.link_stats().empty());
+} // Meter.Off
+} // empty namespace
@@ -0,0 +1,80 @@
+#include <errno.h>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/metrics.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+uint64_t failures(const NS::metrics_snapshot& s, int err) {
+  for(const auto& f : s.failures_by_errno)
+    if(f.first == err) return f.second;
+  return 0;
+}
+
+uint64_t latency_count(const NS::metrics_snapshot& s) {
+  return std::accumulate(s.latency_buckets.begin(), s.latency_buckets.end(), (uint64_t)0);
+}
+
+TEST(Metrics, Spawns) {
+  check_fixed_fds check_fds;
+
+  const auto before = NS::metrics().snapshot();
+  {
+    NS::Exit e = ("true"_C() | "cat"_C()) > "/dev/null";
+    EXPECT_TRUE(e.success());
+  }
+  {
+    NS::Exit e = "true"_C() | "/nonexistent/command"_C();
+    EXPECT_FALSE(e.success());
+  }
+  {
+    NS::Exit e = "cat"_C() < "/nonexistent/file";
+    EXPECT_FALSE(e.success());
+  }
+  const auto after = NS::metrics().snapshot();
+  EXPECT_EQ(before.spawns + 3, after.spawns);
+  EXPECT_EQ(before.reaped + 3, after.reaped);
+  EXPECT_EQ(before.running, after.running);
+  EXPECT_EQ(before.fds_held, after.fds_held);
+  EXPECT_EQ(before.spawn_failures + 2, after.spawn_failures);
+  EXPECT_EQ(failures(before, ENOENT) + 2, failures(after, ENOENT));
+  EXPECT_EQ(latency_count(before) + 3, latency_count(after));
+  EXPECT_EQ(after.latency_bounds.size() + 1, after.latency_buckets.size());
+  EXPECT_LT(before.latency_sum, after.latency_sum);
+} // Metrics.Spawns
+
+TEST(Metrics, Running) {
+  check_fixed_fds check_fds;
+
+  const auto before = NS::metrics().snapshot();
+  NS::Exit   e      = "sleep"_C(10).run();
+  EXPECT_EQ(before.running + 1, NS::metrics().snapshot().running);
+  e.kill(SIGKILL);
+  e.wait();
+  EXPECT_EQ(before.running, NS::metrics().snapshot().running);
+} // Metrics.Running
+
+TEST(Metrics, Prometheus) {
+  NS::Exit e = "/nonexistent/command"_C();
+  EXPECT_FALSE(e.success());
+
+  std::ostringstream os;
+  EXPECT_TRUE(NS::metrics().write_prometheus(os));
+  const std::string text = os.str();
+  const auto        s    = NS::metrics().snapshot();
+  EXPECT_NE(std::string::npos, text.find("# TYPE noshell_spawns_total counter\nnoshell_spawns_total " + std::to_string(s.spawns) + "\n"));
+  EXPECT_NE(std::string::npos, text.find("noshell_spawn_failures_total{errno=\"ENOENT\"} "));
+  EXPECT_NE(std::string::npos, text.find("# TYPE noshell_exec_latency_seconds histogram\n"));
+  EXPECT_NE(std::string::npos, text.find("noshell_exec_latency_seconds_bucket{le=\"+Inf\"} " + std::to_string(s.spawns) + "\n"));
+  EXPECT_NE(std::string::npos, text.find("noshell_exec_latency_seconds_count " + std::to_string(s.spawns) + "\n"));
+  EXPECT_NE(std::string::npos, text.find("noshell_running_children "));
+  EXPECT_NE(std::string::npos, text.find("noshell_fds_held "));
+  EXPECT_NE(std::string::npos, text.find("noshell_reaped_total "));
+} // Metrics.Prometheus
+} // empty namespace
@@ -0,0 +1,85 @@
+#include <unistd.h>
+#include <time.h>
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+using std::chrono::milliseconds;
+
+// Stage using size bytes of memory and about cpu of CPU time
+NS::PipeLine busy(size_t size, milliseconds cpu) {
+  return NS::stage([=](const std::vector<std::string>&) -> int {
+      std::vector<char> mem(size);
+      memset(mem.data(), 1, mem.size());
+      const clock_t end = clock() + cpu.count() * (CLOCKS_PER_SEC / 1000);
+      while(clock() < end) { }
+      return mem[size / 2] == 1 ? 0 : 1;
+    });
+}
+
+TEST(Monitor, Sample) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = busy(64 << 20, milliseconds(600)).monitor(milliseconds(20)).run();
+  EXPECT_EQ(0, e[0].current_resources().rss); // Not sampled yet
+  usleep(400000);
+  const auto res = e[0].current_resources();
+  EXPECT_LT(60000, res.rss);
+  EXPECT_LT(milliseconds(100), res.cpu_time);
+  EXPECT_LT(10.0, res.cpu_percent);
+  e.wait();
+  EXPECT_TRUE(e.success());
+  EXPECT_EQ(NS::resource_budget::NONE, e[0].budget_exceeded());
+  EXPECT_LE(res.cpu_time.count(), e[0].current_resources().cpu_time.count()); // Last sample kept
+} // Monitor.Sample
+
+TEST(Monitor, Budget) {
+  check_fixed_fds check_fds;
+
+  {
+    NS::resource_budget budget;
+    budget.rss = 32 * 1024;
+    NS::Exit e = busy(64 << 20, milliseconds(5000)).monitor(milliseconds(10), budget).run();
+    e.wait();
+    EXPECT_EQ(NS::resource_budget::RSS, e[0].budget_exceeded());
+    ASSERT_TRUE(e[0].have_status());
+    EXPECT_EQ(SIGKILL, e[0].status().term_sig());
+  }
+  {
+    NS::resource_budget budget;
+    budget.cpu_time = milliseconds(100);
+    NS::Exit e = busy(1024, milliseconds(5000)).monitor(milliseconds(10), budget).run();
+    e.wait();
+    EXPECT_EQ(NS::resource_budget::CPU_TIME, e[0].budget_exceeded());
+  }
+  {
+    NS::resource_budget budget;
+    budget.wall_time = milliseconds(50);
+    budget.sig       = SIGTERM;
+    NS::Exit e = ("sleep"_C(10) | "true"_C()).monitor(milliseconds(10), budget).run();
+    e.wait();
+    EXPECT_EQ(NS::resource_budget::WALL_TIME, e[0].budget_exceeded());
+    EXPECT_EQ(SIGTERM, e[0].status().term_sig());
+    EXPECT_EQ(NS::resource_budget::NONE, e[1].budget_exceeded()); // Exited before
+  }
+} // Monitor.Budget
+
+TEST(Monitor, TotalResources) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = busy(1024, milliseconds(100)) | busy(1024, milliseconds(100));
+  EXPECT_TRUE(e.success());
+  const struct rusage total = e.total_resources();
+  auto us = [](const struct timeval& tv) { return (long)tv.tv_sec * 1000000 + tv.tv_usec; };
+  EXPECT_EQ(us(e[0].resources.ru_utime) + us(e[1].resources.ru_utime), us(total.ru_utime));
+  EXPECT_EQ(us(e[0].resources.ru_stime) + us(e[1].resources.ru_stime), us(total.ru_stime));
+  EXPECT_EQ(std::max(e[0].resources.ru_maxrss, e[1].resources.ru_maxrss), total.ru_maxrss);
+  EXPECT_LT(150000, us(total.ru_utime) + us(total.ru_stime));
+} // Monitor.TotalResources
+} // empty namespace
@@ -0,0 +1,91 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+TEST(NativeHandles, EventLoop) {
+  check_fixed_fds check_fds;
+
+  NS::nonblocking_fd fd;
+  NS::Exit e = "sh"_C("-c", "sleep 0.1; echo hello") | fd;
+  ASSERT_NE(-1, fd.fd);
+  EXPECT_TRUE(fcntl(fd, F_GETFL) & O_NONBLOCK);
+  char buf[64];
+  EXPECT_EQ(-1, read(fd, buf, sizeof(buf)));
+  EXPECT_EQ(EAGAIN, errno);
+
+  auto handles = e.native_handles();
+  ASSERT_EQ((size_t)2, handles.size());
+  EXPECT_EQ(NS::native_handle::PROCESS, handles[0].type);
+  EXPECT_EQ(NS::native_handle::READ, handles[1].type);
+  EXPECT_EQ(fd.fd, handles[1].fd);
+  EXPECT_EQ(1, handles[1].child_fd);
+
+  std::string output;
+  bool        eof = false, exited = false;
+  while(!eof || !exited) {
+    std::vector<pollfd> pfds;
+    for(const auto& h : handles)
+      if((h.type == NS::native_handle::PROCESS && !exited) || (h.type == NS::native_handle::READ && !eof))
+        pfds.push_back(pollfd{h.fd, POLLIN, 0});
+    ASSERT_LT(0, poll(pfds.data(), pfds.size(), 10000));
+    for(const auto& p : pfds) {
+      if(!p.revents) continue;
+      if(p.fd == fd.fd) {
+        const ssize_t res = read(fd, buf, sizeof(buf));
+        ASSERT_NE(-1, res);
+        output.append(buf, res);
+        eof = res == 0;
+      } else {
+        ASSERT_TRUE(e.reap());
+        exited = true;
+      }
+    }
+  }
+  close(fd);
+  EXPECT_EQ("hello\n", output);
+  EXPECT_TRUE(e.success());
+} // NativeHandles.EventLoop
+
+TEST(NativeHandles, Write) {
+  check_fixed_fds check_fds;
+
+  NS::nonblocking_fd fd;
+  NS::Exit e = (fd | "cat"_C()) > "/dev/null";
+  auto handles = e.native_handles();
+  ASSERT_EQ((size_t)2, handles.size());
+  EXPECT_EQ(NS::native_handle::WRITE, handles[1].type);
+  EXPECT_EQ(0, handles[1].child_fd);
+  EXPECT_TRUE(fcntl(fd, F_GETFL) & O_NONBLOCK);
+  // Fill the pipe without blocking
+  const std::string data(1 << 16, 'a');
+  ssize_t res;
+  while((res = write(fd, data.data(), data.size())) > 0) { }
+  EXPECT_EQ(EAGAIN, errno);
+  EXPECT_FALSE(e.reap());
+  close(fd);
+  e.wait();
+  EXPECT_TRUE(e.success());
+} // NativeHandles.Write
+
+TEST(NativeHandles, Reap) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = "sleep"_C("0.1").run();
+  EXPECT_FALSE(e.reap());
+  const int pidfd = e.native_handles()[0].fd;
+  pollfd pfd = { pidfd, POLLIN, 0 };
+  ASSERT_EQ(1, poll(&pfd, 1, 10000));
+  EXPECT_TRUE(e.reap());
+  ASSERT_TRUE(e[0].have_status());
+  EXPECT_TRUE(e.success());
+  EXPECT_TRUE(e.native_handles().empty());
+} // NativeHandles.Reap
+} // empty namespace
@@ -0,0 +1,135 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/parallel.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+static const char* tmpfile = "Parallel_tmp";
+
+std::vector<std::string> read_lines(const char* path) {
+  std::ifstream is(path);
+  std::vector<std::string> res;
+  std::string line;
+  while(std::getline(is, line))
+    res.push_back(line);
+  return res;
+}
+
+std::vector<std::string> seq(int n) {
+  std::vector<std::string> res;
+  for(int i = 1; i <= n; ++i)
+    res.push_back(std::to_string(i));
+  return res;
+}
+
+class Parallel : public ::testing::Test {
+protected:
+  int out;
+  virtual void SetUp() {
+    out = open(tmpfile, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    ASSERT_NE(-1, out);
+  }
+  virtual void TearDown() { close(out); }
+};
+
+TEST_F(Parallel, KeepOrder) {
+  check_fixed_fds check_fds;
+
+  int in;
+  NS::Exit e = "seq"_C(1, 20000) | in;
+  NS::parallel_options opts;
+  opts.out_fd = out;
+  auto res = NS::parallel_pipe(in, 4096, 4, []() { return "cat"_C() | "cat"_C(); }, opts);
+  close(in);
+  e.wait();
+
+  EXPECT_TRUE(e.success());
+  EXPECT_TRUE(res.success());
+  EXPECT_LT((size_t)10, res.exits.size());
+  EXPECT_EQ(seq(20000), read_lines(tmpfile));
+} // Parallel.KeepOrder
+
+TEST_F(Parallel, SmallBuffer) {
+  check_fixed_fds check_fds;
+
+  int in;
+  NS::Exit e = "seq"_C(1, 20000) | in;
+  NS::parallel_options opts;
+  opts.out_fd     = out;
+  opts.max_buffer = 10;
+  auto res = NS::parallel_pipe(in, 1000, 3, []() { return "wc"_C("-l"); }, opts);
+  close(in);
+  e.wait();
+
+  EXPECT_TRUE(res.success());
+  int total = 0;
+  const auto counts = read_lines(tmpfile);
+  EXPECT_EQ(res.exits.size(), counts.size());
+  for(const auto& it : counts)
+    total += std::stoi(it);
+  EXPECT_EQ(20000, total);
+} // Parallel.SmallBuffer
+
+TEST_F(Parallel, Streaming) {
+  check_fixed_fds check_fds;
+
+  int in;
+  NS::Exit e = "seq"_C(1, 20000) | in;
+  NS::parallel_options opts(NS::parallel_options::STREAMING);
+  opts.out_fd = out;
+  auto res = NS::parallel_pipe(in, 2048, 3, []() { return "cat"_C(); }, opts);
+  close(in);
+  e.wait();
+
+  EXPECT_TRUE(res.success());
+  EXPECT_EQ((size_t)3, res.exits.size());
+  auto lines = read_lines(tmpfile);
+  std::sort(lines.begin(), lines.end());
+  auto expected = seq(20000);
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(expected, lines);
+} // Parallel.Streaming
+
+TEST_F(Parallel, Failure) {
+  check_fixed_fds check_fds;
+
+  int in;
+  NS::Exit e = "seq"_C(1, 1000) | in;
+  NS::parallel_options opts;
+  opts.out_fd = out;
+  auto res = NS::parallel_pipe(in, 100, 2, []() { return "false"_C(); }, opts);
+  close(in);
+  e.wait();
+
+  EXPECT_FALSE(res.success());
+  ASSERT_FALSE(res.exits.empty());
+  EXPECT_FALSE(res.exits[0].success());
+} // Parallel.Failure
+
+TEST_F(Parallel, SigPipe) {
+  check_fixed_fds check_fds;
+
+  int in;
+  NS::Exit e = "seq"_C(1, 10) | in;
+  NS::parallel_options opts;
+  opts.out_fd = out;
+  auto res = NS::parallel_pipe(in, 4096, 1, []() { return "yes"_C() | "head"_C("-n", 1); }, opts);
+  close(in);
+  e.wait();
+
+  // The workers do not inherit SIGPIPE blocked from parallel_pipe
+  EXPECT_TRUE(res.success(true));
+  ASSERT_EQ((size_t)1, res.exits.size());
+  EXPECT_EQ(SIGPIPE, res.exits[0][0].status().term_sig());
+  EXPECT_EQ(std::vector<std::string>{"y"}, read_lines(tmpfile));
+} // Parallel.SigPipe
+} // empty namespace
@@ -0,0 +1,76 @@
+#include <fstream>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+static const char* tmpfile = "ProcessSubstitution_tmp";
+
+TEST(ProcessSubstitution, InputOf) {
+  check_fixed_fds check_fds;
+
+  NS::istream is;
+  NS::Exit e = "paste"_C(NS::input_of("./puts_to"_C(1, "a", "b")), "-d", ":")  | is;
+  std::string line;
+  EXPECT_TRUE((bool)std::getline(is, line));
+  EXPECT_EQ("a", line);
+  is.close();
+  e.wait();
+  EXPECT_TRUE(e.success(true));
+
+  NS::Exit e2 = NS::C("paste", "-d", ":", NS::input_of("./puts_to"_C(1, "a", "b")), NS::input_of("./puts_to"_C(1, "c", "d"))) | is;
+  EXPECT_TRUE((bool)std::getline(is, line));
+  EXPECT_EQ("a:c", line);
+  EXPECT_TRUE((bool)std::getline(is, line));
+  EXPECT_EQ("b:d", line);
+  EXPECT_FALSE((bool)std::getline(is, line));
+  is.close();
+  e2.wait();
+
+  EXPECT_TRUE(e2.success());
+  ASSERT_EQ((size_t)2, e2[0].attached.size());
+  EXPECT_TRUE(e2[0].attached[0]->success());
+  EXPECT_TRUE(e2[0].attached[1]->success());
+} // ProcessSubstitution.InputOf
+
+TEST(ProcessSubstitution, OutputTo) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = ("./puts_to"_C(1, "x", "y", "z") | "tee"_C(NS::output_to("wc"_C("-l") > tmpfile))) > "/dev/null";
+  EXPECT_TRUE(e.success());
+  ASSERT_EQ((size_t)1, e[1].attached.size());
+  EXPECT_TRUE(e[1].attached[0]->success());
+
+  std::ifstream is(tmpfile);
+  int nb = 0;
+  is >> nb;
+  EXPECT_EQ(3, nb);
+} // ProcessSubstitution.OutputTo
+
+TEST(ProcessSubstitution, Failure) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = "cat"_C(NS::input_of("false"_C())) > "/dev/null";
+  EXPECT_FALSE(e.success());
+  EXPECT_TRUE(e[0].success());
+  ASSERT_EQ((size_t)1, e[0].attached.size());
+  EXPECT_FALSE(e[0].attached[0]->success());
+} // ProcessSubstitution.Failure
+
+TEST(ProcessSubstitution, Rerun) {
+  check_fixed_fds check_fds;
+
+  NS::PipeLine p = "cat"_C(NS::input_of("./puts_to"_C(1, "hello"))) > tmpfile;
+  for(int i = 0; i < 2; ++i) {
+    NS::Exit e = p.run_wait();
+    EXPECT_TRUE(e.success());
+    std::ifstream is(tmpfile);
+    std::string line;
+    EXPECT_TRUE((bool)std::getline(is, line));
+    EXPECT_EQ("hello", line);
+  }
+} // ProcessSubstitution.Rerun
+} // empty namespace
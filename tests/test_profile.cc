@@ -0,0 +1,79 @@
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+using std::chrono::milliseconds;
+
+// Read 4kB from stdin every 2ms, nb times
+NS::PipeLine slow_reader(int nb) {
+  return NS::stage([=](const std::vector<std::string>&) -> int {
+      char buf[4096];
+      for(int i = 0; i < nb; ++i) {
+        if(read(0, buf, sizeof(buf)) <= 0) return 1;
+        usleep(2000);
+      }
+      return 0;
+    });
+}
+
+// Write 100 bytes to stdout every 2ms, nb times
+NS::PipeLine slow_writer(int nb) {
+  return NS::stage([=](const std::vector<std::string>&) -> int {
+      const std::string line(99, 'x');
+      for(int i = 0; i < nb; ++i) {
+        if(write(1, (line + '\n').data(), line.size() + 1) <= 0) return 1;
+        usleep(2000);
+      }
+      return 0;
+    });
+}
+
+TEST(Profile, SlowReader) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = ("yes"_C() | slow_reader(150)).profile(milliseconds(5)).run();
+  ASSERT_TRUE(e.wait_for(std::chrono::seconds(10))); // yes got SIGPIPE, the profiler closed its copy of the pipe
+  EXPECT_TRUE(e.success(true));
+
+  const NS::PipelineProfile prof = e.profile();
+  ASSERT_EQ((size_t)2, prof.stages.size());
+  ASSERT_EQ((size_t)1, prof.links.size());
+  EXPECT_LT((size_t)0, prof.links[0].capacity);
+  EXPECT_LT((size_t)10, prof.links[0].samples);
+  EXPECT_EQ(NS::link_profile::MOSTLY_FULL, prof.links[0].state);
+  EXPECT_LT(0.5, prof.links[0].mean_fill);
+  EXPECT_EQ(1, prof.bottleneck);
+  EXPECT_LT((uint64_t)0, prof.stages[0].write_bytes);
+  EXPECT_LT(0.0, prof.stages[0].throughput);
+} // Profile.SlowReader
+
+TEST(Profile, SlowWriter) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = ((slow_writer(150) | "cat"_C() | "wc"_C("-l")) > "/dev/null").profile(milliseconds(5));
+  EXPECT_TRUE(e.success());
+
+  const NS::PipelineProfile prof = e.profile();
+  ASSERT_EQ((size_t)3, prof.stages.size());
+  ASSERT_EQ((size_t)2, prof.links.size());
+  EXPECT_EQ(NS::link_profile::MOSTLY_EMPTY, prof.links[0].state);
+  EXPECT_EQ(NS::link_profile::MOSTLY_EMPTY, prof.links[1].state);
+  EXPECT_GT(0.1, prof.links[0].mean_fill);
+  EXPECT_EQ(0, prof.bottleneck);
+} // Profile.SlowWriter
+
+TEST(Profile, Off) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = "true"_C() | "true"_C();
+  EXPECT_TRUE(e.success());
+  EXPECT_TRUE(e.profile().stages.empty());
+  EXPECT_EQ(-1, e.profile().bottleneck);
+} // Profile.Off
+} // empty namespace
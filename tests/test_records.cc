@@ -0,0 +1,148 @@
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/records.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+NS::PipeLine write_data(const std::string& data) {
+  return NS::stage([=](const std::vector<std::string>&) -> int {
+      return write(1, data.data(), data.size()) == (ssize_t)data.size() ? 0 : 1;
+    });
+}
+
+TEST(Records, Lines) {
+  check_fixed_fds check_fds;
+
+  auto lines = NS::lines("seq"_C(1, 100000));
+  long sum = 0, nb = 0;
+  for(auto line : lines) {
+    sum += std::stol(line.str());
+    ++nb;
+  }
+  EXPECT_EQ(100000, nb);
+  EXPECT_EQ(100000L * 100001L / 2, sum);
+  EXPECT_TRUE(lines.exit().success());
+  EXPECT_EQ(0, lines.error());
+} // Records.Lines
+
+TEST(Records, LongLines) {
+  check_fixed_fds check_fds;
+
+  const std::string a(1000, 'a');
+  NS::Records lines("yes"_C(a) | "head"_C("-n", 50), NS::record_format::delimiter(), 16);
+  int nb = 0;
+  for(auto line : lines) {
+    EXPECT_EQ(a, line.str());
+    ++nb;
+  }
+  EXPECT_EQ(50, nb);
+  EXPECT_TRUE(lines.exit().success(true));
+} // Records.LongLines
+
+TEST(Records, LastLine) {
+  check_fixed_fds check_fds;
+
+  std::vector<std::string> res;
+  for(auto line : NS::lines(write_data("a\n\nb")))
+    res.push_back(line.str());
+  const std::vector<std::string> expected{"a", "", "b"};
+  EXPECT_EQ(expected, res);
+} // Records.LastLine
+
+TEST(Records, Fixed) {
+  check_fixed_fds check_fds;
+
+  auto records = NS::records(write_data("abcdefghij"), NS::record_format::fixed(4));
+  std::vector<std::string> res;
+  for(auto rec : records)
+    res.push_back(rec.str());
+  const std::vector<std::string> expected{"abcd", "efgh"};
+  EXPECT_EQ(expected, res);
+  EXPECT_TRUE(records.truncated());
+  EXPECT_TRUE(records.exit().success());
+} // Records.Fixed
+
+TEST(Records, LengthPrefix) {
+  check_fixed_fds check_fds;
+
+  auto records = NS::records(write_data(std::string("\0\3abc\0\0\0\1z", 10)), NS::record_format::length_prefix(2));
+  std::vector<std::string> res;
+  for(auto rec : records)
+    res.push_back(rec.str());
+  const std::vector<std::string> expected{"abc", "", "z"};
+  EXPECT_EQ(expected, res);
+  EXPECT_FALSE(records.truncated());
+} // Records.LengthPrefix
+
+TEST(Records, MaxSize) {
+  check_fixed_fds check_fds;
+
+  // A length of 2^64 - 1 is not allocated
+  auto huge = NS::records(write_data(std::string("\0\0\0\0\0\0\0\1a", 9) + std::string(8, '\xff')), NS::record_format::length_prefix(8));
+  std::vector<std::string> res;
+  for(auto rec : huge)
+    res.push_back(rec.str());
+  EXPECT_EQ(std::vector<std::string>{"a"}, res);
+  EXPECT_EQ(EMSGSIZE, huge.error());
+
+  auto prefixed = NS::records(write_data(std::string("\0\2ab\0\5abcde", 11)), NS::record_format::length_prefix(2).max_size(4));
+  res.clear();
+  for(auto rec : prefixed)
+    res.push_back(rec.str());
+  EXPECT_EQ(std::vector<std::string>{"ab"}, res);
+  EXPECT_EQ(EMSGSIZE, prefixed.error());
+
+  NS::Records lines("./puts_to"_C(1, "abcd", "abcdefgh", "ab"), NS::record_format::delimiter().max_size(4), 2);
+  res.clear();
+  for(auto line : lines)
+    res.push_back(line.str());
+  EXPECT_EQ(std::vector<std::string>{"abcd"}, res);
+  EXPECT_EQ(EMSGSIZE, lines.error());
+
+  auto fixed = NS::records(write_data("abcdefgh"), NS::record_format::fixed(8).max_size(4));
+  EXPECT_FALSE(fixed.next());
+  EXPECT_EQ(EMSGSIZE, fixed.error());
+} // Records.MaxSize
+
+TEST(Records, InvalidFormat) {
+  check_fixed_fds check_fds;
+
+  // A width of 0 would give empty records forever
+  NS::Records records(write_data("abc"), NS::record_format{NS::record_format::LENGTH_PREFIX, 0, '\0', NS::record_format::default_max});
+  EXPECT_FALSE(records.next());
+  EXPECT_EQ(EINVAL, records.error());
+  const NS::record_format three{NS::record_format::LENGTH_PREFIX, 3, '\0', 10};
+  EXPECT_FALSE(three.valid());
+#ifndef NDEBUG
+  EXPECT_DEATH(NS::record_format::length_prefix(0), "");
+#endif
+} // Records.InvalidFormat
+
+TEST(Records, FileDescriptor) {
+  check_fixed_fds check_fds;
+
+  int fd;
+  NS::Exit e = "./puts_to"_C(1, "hello", "world") | fd;
+  std::vector<std::string> res;
+  for(auto line : NS::lines(fd))
+    res.push_back(line.str());
+  close(fd);
+  e.wait();
+  EXPECT_TRUE(e.success());
+  const std::vector<std::string> expected{"hello", "world"};
+  EXPECT_EQ(expected, res);
+} // Records.FileDescriptor
+
+#if __cplusplus >= 201703L
+TEST(Records, StringView) {
+  for(std::string_view line : NS::lines("./puts_to"_C(1, "view")))
+    EXPECT_EQ("view", line);
+} // Records.StringView
+#endif
+} // empty namespace
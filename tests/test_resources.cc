@@ -14,4 +14,18 @@ TEST(Resources, Test) {
   EXPECT_LT(0, e[0].maximum_rss());
   EXPECT_LT(0, e[0].minor_faults() + e[0].major_faults());
 }
+
+TEST(Resources, Move) {
+  NS::Handle h = NS::Command({"true"}).run_wait();
+  ASSERT_TRUE(h.success());
+  const long rss    = h.maximum_rss();
+  const long faults = h.minor_faults() + h.major_faults();
+  const auto user   = h.user_time();
+  ASSERT_LT(0, rss);
+  // The resource usage moves along with the status
+  NS::Handle moved(std::move(h));
+  EXPECT_EQ(rss, moved.maximum_rss());
+  EXPECT_EQ(faults, moved.minor_faults() + moved.major_faults());
+  EXPECT_EQ(user, moved.user_time());
+}
 } // empty namespace
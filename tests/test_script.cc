@@ -0,0 +1,140 @@
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/script.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+static const char* tmpfile = "Script_tmp";
+
+class Script : public ::testing::Test {
+protected:
+  void TearDown() override { unlink(tmpfile); }
+};
+
+TEST_F(Script, AndOr) {
+  check_fixed_fds check_fds;
+
+  NS::ScriptExit e = ("true"_C() && "false"_C() && "touch"_C(tmpfile)).run_wait();
+  EXPECT_FALSE(e.success());
+  ASSERT_EQ((size_t)4, e.size()); // Flattened
+  EXPECT_EQ(NS::Script::AND, e[0].type);
+  EXPECT_EQ((std::vector<size_t>{ 1, 2, 3 }), e[0].children);
+  EXPECT_EQ(NS::ScriptExit::DONE, e[1].state);
+  EXPECT_TRUE(e[1].success);
+  EXPECT_EQ(NS::ScriptExit::DONE, e[2].state);
+  EXPECT_FALSE(e[2].success);
+  EXPECT_EQ(NS::ScriptExit::SKIPPED, e[3].state);
+  EXPECT_EQ(-1, access(tmpfile, F_OK));
+
+  NS::ScriptExit e2 = ("false"_C() || "true"_C() || "touch"_C(tmpfile)).run_wait();
+  EXPECT_TRUE(e2.success());
+  EXPECT_EQ(NS::ScriptExit::SKIPPED, e2[3].state);
+  EXPECT_EQ(-1, access(tmpfile, F_OK));
+
+  // && binds tighter than ||, as in C++. The shell has them of equal
+  // precedence, grouped from left to right.
+  NS::ScriptExit e3 = ("false"_C() || ("true"_C() && "touch"_C(tmpfile))).run_wait();
+  EXPECT_TRUE(e3.success());
+  EXPECT_EQ(NS::Script::OR, e3[0].type);
+  ASSERT_EQ((size_t)5, e3.size());
+  EXPECT_EQ(NS::Script::AND, e3[2].type);
+  EXPECT_EQ(0, access(tmpfile, F_OK));
+  unlink(tmpfile);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wparentheses"
+  NS::ScriptExit e4 = ("false"_C() || "true"_C() && "touch"_C(tmpfile)).run_wait(); // Same without parentheses
+#pragma GCC diagnostic pop
+  EXPECT_TRUE(e4.success());
+  ASSERT_EQ(e3.size(), e4.size());
+  for(size_t i = 0; i < e3.size(); ++i) {
+    EXPECT_EQ(e3[i].type, e4[i].type);
+    EXPECT_EQ(e3[i].children, e4[i].children);
+  }
+  EXPECT_EQ(0, access(tmpfile, F_OK));
+  unlink(tmpfile);
+
+  // Where the two differ: true || (false && touch) skips touch, while
+  // the shell runs (true || false) && touch
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wparentheses"
+  NS::ScriptExit e5 = ("true"_C() || "false"_C() && "touch"_C(tmpfile)).run_wait();
+#pragma GCC diagnostic pop
+  EXPECT_TRUE(e5.success());
+  EXPECT_EQ(NS::Script::OR, e5[0].type);
+  ASSERT_EQ((size_t)5, e5.size());
+  EXPECT_EQ(NS::ScriptExit::SKIPPED, e5[4].state);
+  EXPECT_EQ(-1, access(tmpfile, F_OK));
+  EXPECT_TRUE("sh"_C("-c", std::string("true || false && touch ") + tmpfile).run_wait().success());
+  EXPECT_EQ(0, access(tmpfile, F_OK));
+} // Script.AndOr
+
+TEST_F(Script, Sequence) {
+  check_fixed_fds check_fds;
+
+  NS::ScriptExit e = NS::Script("false"_C()).then("true"_C()).run_wait();
+  EXPECT_TRUE(e.success()); // Status of the last one
+  ASSERT_EQ((size_t)3, e.size());
+  EXPECT_EQ(NS::Script::SEQUENCE, e[0].type);
+  EXPECT_FALSE(e[1].success);
+  EXPECT_TRUE(e[2].success);
+} // Script.Sequence
+
+TEST_F(Script, Concurrent) {
+  check_fixed_fds check_fds;
+
+  const auto     start = std::chrono::steady_clock::now();
+  NS::ScriptExit e     = ("true"_C() && ("sleep"_C(0.2) & "sleep"_C(0.2) & "sleep"_C(0.2)) && ("echo"_C("done") > tmpfile)).run();
+  EXPECT_FALSE(e.done());
+  e.wait();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_TRUE(e.done());
+  EXPECT_TRUE(e.success());
+  EXPECT_LE(std::chrono::milliseconds(200), elapsed);
+  EXPECT_GT(std::chrono::milliseconds(500), elapsed);
+
+  // 0: &&, 1: true, 2: &, 3-5: sleep, 6: echo
+  ASSERT_EQ((size_t)7, e.size());
+  EXPECT_EQ(NS::Script::CONCURRENT, e[2].type);
+  EXPECT_EQ((ssize_t)2, e[4].parent);
+  auto last_sleep = e[3].exit.begin()->ended;
+  for(size_t i = 3; i <= 5; ++i) {
+    EXPECT_EQ(NS::ScriptExit::DONE, e[i].state);
+    last_sleep = std::max(last_sleep, e[i].exit.begin()->ended);
+  }
+  // The successor starts as soon as the sleeps exited
+  const auto echo_start = e[6].exit.begin()->started;
+  EXPECT_LE(last_sleep - std::chrono::milliseconds(10), echo_start);
+  EXPECT_GT(last_sleep + std::chrono::milliseconds(100), echo_start);
+} // Script.Concurrent
+
+TEST_F(Script, Kill) {
+  check_fixed_fds check_fds;
+
+  NS::ScriptExit e = ("sleep"_C(10) & "sleep"_C(10)).then("touch"_C(tmpfile)).run();
+  EXPECT_TRUE(e.kill(SIGKILL));
+  e.wait();
+  EXPECT_FALSE(e.success());
+  ASSERT_EQ((size_t)5, e.size());
+  for(size_t i = 2; i <= 3; ++i) {
+    ASSERT_EQ(NS::ScriptExit::DONE, e[i].state);
+    ASSERT_TRUE(e[i].exit.begin()->have_status());
+    EXPECT_EQ(SIGKILL, e[i].exit.begin()->status().term_sig());
+  }
+  EXPECT_EQ(NS::ScriptExit::SKIPPED, e[4].state);
+  EXPECT_EQ(-1, access(tmpfile, F_OK));
+} // Script.Kill
+
+TEST_F(Script, SetupError) {
+  check_fixed_fds check_fds;
+
+  NS::ScriptExit e = ("./does_not_exist"_C() || "true"_C()).run_wait();
+  EXPECT_TRUE(e.success());
+  EXPECT_TRUE(e[1].exit.begin()->setup_error());
+  EXPECT_TRUE(e[2].success);
+} // Script.SetupError
+} // empty namespace
@@ -0,0 +1,106 @@
+#include <unistd.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/spawn_policy.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+// Set the soft limit of resource while in scope
+struct soft_limit {
+  const int     resource;
+  struct rlimit saved;
+  soft_limit(int r, rlim_t value) : resource(r) {
+    getrlimit(resource, &saved);
+    struct rlimit l = saved;
+    l.rlim_cur      = value;
+    setrlimit(resource, &l);
+  }
+  ~soft_limit() { setrlimit(resource, &saved); }
+};
+
+// Restore the default policy when out of scope
+struct policy_guard {
+  policy_guard(const NS::spawn_policy& p) { NS::set_spawn_policy(p); }
+  ~policy_guard() { NS::set_spawn_policy(NS::spawn_policy()); }
+};
+
+int max_fd() {
+  const auto fds = open_fds();
+  return *std::max_element(fds.begin(), fds.end());
+}
+
+TEST(SpawnPolicy, NoPipe) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = []() {
+    soft_limit limit(RLIMIT_NOFILE, max_fd() + 1); // No file descriptor left
+    return ("true"_C() | "true"_C() | "true"_C()).run();
+  }();
+  e.wait();
+  ASSERT_EQ(3, std::distance(e.begin(), e.end()));
+  for(const auto& h : e) {
+    EXPECT_TRUE(h.setup_error());
+    EXPECT_EQ(EMFILE, h.err().value);
+    EXPECT_EQ("Failed to create pipe for pipeline", h.message);
+    ASSERT_TRUE(h.argv);
+    EXPECT_EQ(std::vector<std::string>{ "true" }, *h.argv);
+  }
+} // SpawnPolicy.NoPipe
+
+TEST(SpawnPolicy, WaitForFds) {
+  check_fixed_fds check_fds;
+
+  NS::spawn_policy policy;
+  policy.fd_wait = std::chrono::seconds(5);
+  policy_guard pg(policy);
+
+  bool       success;
+  const auto start = std::chrono::steady_clock::now();
+  {
+    soft_limit       limit(RLIMIT_NOFILE, max_fd() + 8);
+    std::vector<int> fillers;
+    for(int fd; (fd = dup(0)) != -1; )
+      fillers.push_back(fd);
+    std::thread release([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        for(int fd : fillers)
+          close(fd);
+      });
+    NS::Exit e = "true"_C() | "true"_C();
+    release.join();
+    success = e.success();
+  }
+  EXPECT_TRUE(success);
+  EXPECT_LE(std::chrono::milliseconds(100), std::chrono::steady_clock::now() - start);
+} // SpawnPolicy.WaitForFds
+
+TEST(SpawnPolicy, ForkRetries) {
+  if(geteuid() == 0) GTEST_SKIP() << "RLIMIT_NPROC does not apply to root";
+  check_fixed_fds check_fds;
+
+  NS::spawn_policy policy;
+  policy.retries         = 3;
+  policy.initial_backoff = std::chrono::milliseconds(10);
+  policy.jitter          = 0;
+  policy_guard pg(policy);
+
+  const auto start = std::chrono::steady_clock::now();
+  NS::Exit   e     = []() {
+    soft_limit limit(RLIMIT_NPROC, 1);
+    return "true"_C().run();
+  }();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  e.wait();
+  ASSERT_TRUE(e[0].setup_error());
+  EXPECT_EQ(EAGAIN, e[0].err().value);
+  EXPECT_LE(std::chrono::milliseconds(70), elapsed); // 10 + 20 + 40ms
+} // SpawnPolicy.ForkRetries
+} // empty namespace
@@ -0,0 +1,66 @@
+#include <unistd.h>
+#include <string>
+#include <type_traits>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/static_pipeline.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+static const char* tmpfile  = "StaticPipeline_tmp";
+static const char* tmpfile2 = "StaticPipeline_tmp_2";
+
+TEST(StaticPipeline, Simple) {
+  check_fixed_fds check_fds;
+
+  const auto p = NS::static_command("seq", "1", "1000") | (NS::static_command("grep", "-c", "0") > tmpfile);
+  static_assert(decltype(p)::size == 2, "Two commands");
+  static_assert(std::is_same<std::tuple_element<1, decltype(p.stages)>::type,
+                NS::static_stage<3, NS::static_redirection::path>>::value, "Redirection in type");
+
+  auto e = p.run_wait();
+  EXPECT_TRUE(e.success());
+  EXPECT_EQ("181\n", read_file(tmpfile));
+
+  // The pipeline can be run again
+  e = p.run_wait();
+  EXPECT_TRUE(e.success());
+  EXPECT_EQ("181\n", read_file(tmpfile));
+} // StaticPipeline.Simple
+
+TEST(StaticPipeline, Redirections) {
+  check_fixed_fds check_fds;
+
+  ASSERT_TRUE(NS::Exit("seq"_C(1, 10) > tmpfile).success());
+  const auto p = (NS::static_command("cat") < tmpfile) | NS::static_command("tail", "-n", "2") | NS::static_command("cat") >> tmpfile2;
+  unlink(tmpfile2);
+  EXPECT_TRUE(p.run_wait().success());
+  EXPECT_TRUE(p.run_wait().success());
+  EXPECT_EQ("9\n10\n9\n10\n", read_file(tmpfile2));
+
+  const auto p2 = NS::make_static_pipeline(NS::static_command("sh", "-c", "echo error >&2")
+                                           > tmpfile > NS::static_redirection::fd{2, 1});
+  EXPECT_TRUE(p2.run_wait().success());
+  EXPECT_EQ("error\n", read_file(tmpfile));
+} // StaticPipeline.Redirections
+
+TEST(StaticPipeline, Failure) {
+  check_fixed_fds check_fds;
+
+  auto e = (NS::static_command("/doesntexists") | (NS::static_command("cat") > tmpfile)).run_wait();
+  EXPECT_FALSE(e.success());
+  EXPECT_EQ(ENOENT, e.errors[0]);
+  EXPECT_EQ(0, e.errors[1]);
+  EXPECT_TRUE(e.command_success(1));
+
+  e = (NS::static_command("true") | (NS::static_command("cat") < "/doesntexists")).run_wait();
+  EXPECT_TRUE(e.command_success(0));
+  EXPECT_EQ(ENOENT, e.errors[1]);
+
+  auto e2 = NS::make_static_pipeline(NS::static_command("sh", "-c", "exit 3")).run_wait();
+  EXPECT_FALSE(e2.success());
+  EXPECT_EQ(3, e2.status(0).exit_status());
+} // StaticPipeline.Failure
+} // empty namespace
@@ -0,0 +1,68 @@
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+static const char* tmpfile = "StderrTail_tmp";
+
+class StderrTail : public ::testing::Test {
+protected:
+  static void SetUpTestSuite() {
+    // The collector keeps its epoll file descriptor: open it before checking the file descriptors
+    NS::Exit("true"_C().stderr_tail());
+  }
+  void TearDown() override { unlink(tmpfile); }
+};
+
+TEST_F(StderrTail, Stages) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = (("sh"_C("-c", "echo first >&2; cat") < "/dev/null") | "./puts_to"_C(2, "second") | "sh"_C("-c", "echo third >&2; exit 1")).stderr_tail();
+  e.wait();
+  ASSERT_EQ(3, std::distance(e.begin(), e.end()));
+  EXPECT_EQ("first\n", e[0].stderr_tail());
+  EXPECT_EQ("second\n", e[1].stderr_tail());
+  EXPECT_EQ("third\n", e[2].stderr_tail());
+  EXPECT_FALSE(e.success());
+} // StderrTail.Stages
+
+TEST_F(StderrTail, Bounded) {
+  check_fixed_fds check_fds;
+
+  // Far more than a pipe can hold: the command does not block
+  NS::Exit e = "sh"_C("-c", "seq 1 100000 >&2").stderr_tail(100);
+  e.wait();
+  EXPECT_TRUE(e.success());
+
+  std::ostringstream expected;
+  for(int i = 1; i <= 100000; ++i)
+    expected << i << '\n';
+  const std::string all = expected.str();
+  EXPECT_EQ(all.substr(all.size() - 100), e[0].stderr_tail());
+} // StderrTail.Bounded
+
+TEST_F(StderrTail, Redirected) {
+  check_fixed_fds check_fds;
+
+  NS::Exit e = ("./puts_to"_C(2, "kept") > NS::R(2).to(tmpfile)).stderr_tail();
+  e.wait();
+  EXPECT_TRUE(e.success());
+  EXPECT_EQ("", e[0].stderr_tail());
+  std::ifstream is(tmpfile);
+  std::string   content;
+  std::getline(is, content);
+  EXPECT_EQ("kept", content);
+} // StderrTail.Redirected
+
+TEST(StderrTailOff, Empty) {
+  NS::Exit e = "true"_C();
+  EXPECT_TRUE(e.success());
+  EXPECT_EQ("", e[0].stderr_tail());
+} // StderrTailOff.Empty
+} // empty namespace
@@ -0,0 +1,97 @@
+#include <unistd.h>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/template.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+static const char* tmpfile  = "Template_tmp";
+static const char* tmpfile2 = "Template_tmp_2";
+
+TEST(Template, Placeholders) {
+  check_fixed_fds check_fds;
+
+  NS::Template t({"sh", "-c", std::string("echo \"$1 $2\" >> ") + tmpfile, "sh", "{a}", "{}"});
+  EXPECT_EQ((size_t)2, t.placeholders());
+  EXPECT_FALSE(t.executable().empty());
+  unlink(tmpfile);
+  EXPECT_TRUE(t.run_wait("x", "y").success());
+  EXPECT_TRUE(t.run_wait("z", std::string("w")).success());
+  for(int i = 0; i < 100; ++i) {
+    auto h = t.run(std::to_string(i), "-");
+    h.wait();
+    ASSERT_TRUE(h.success());
+  }
+
+  std::string expected = "x y\nz w\n";
+  for(int i = 0; i < 100; ++i)
+    expected += std::to_string(i) + " -\n";
+  EXPECT_EQ(expected, read_file(tmpfile));
+
+  EXPECT_FALSE(t.run_wait("a", "b").argv); // Not recorded by default
+  const auto h = t.record_argv().run_wait("a", "b");
+  ASSERT_TRUE(h.argv);
+  EXPECT_EQ((std::vector<std::string>{"sh", "-c", std::string("echo \"$1 $2\" >> ") + tmpfile, "sh", "a", "b"}), *h.argv);
+
+  // Extra arguments, only for one run
+  const char* extra[] = { "c", "d" };
+  auto        h2      = t.run_append(std::array<const char*, 2>{{"a", "b"}}.data(), 2, extra, 2);
+  h2.wait();
+  ASSERT_TRUE(h2.argv);
+  EXPECT_EQ((std::vector<std::string>{"sh", "-c", std::string("echo \"$1 $2\" >> ") + tmpfile, "sh", "a", "b", "c", "d"}), *h2.argv);
+  EXPECT_EQ((size_t)6, t.run_wait("a", "b").argv->size());
+} // Template.Placeholders
+
+TEST(Template, Redirections) {
+  check_fixed_fds check_fds;
+
+  NS::Template seq({"seq", "{}"});
+  seq.output(tmpfile);
+  EXPECT_TRUE(seq.run_wait("3").success());
+  EXPECT_EQ("1\n2\n3\n", read_file(tmpfile));
+
+  NS::Template cat({"cat"});
+  cat.input(tmpfile).output(tmpfile2, 1, true);
+  unlink(tmpfile2);
+  EXPECT_TRUE(cat.run_wait().success());
+  EXPECT_TRUE(cat.run_wait().success());
+  EXPECT_EQ("1\n2\n3\n1\n2\n3\n", read_file(tmpfile2));
+
+  NS::Template err({"sh", "-c", "echo error >&2"});
+  err.output(tmpfile).dup(2, 1);
+  EXPECT_TRUE(err.run_wait().success());
+  EXPECT_EQ("error\n", read_file(tmpfile));
+
+  NS::Template env({"sh", "-c", "echo $NOSHELL_VAR"});
+  env.environment({"NOSHELL_VAR=value"}).output(tmpfile);
+  EXPECT_TRUE(env.run_wait().success());
+  EXPECT_EQ("value\n", read_file(tmpfile));
+} // Template.Redirections
+
+TEST(Template, Errors) {
+  check_fixed_fds check_fds;
+
+  NS::Template t({"echo", "{}"});
+  auto h = t.run_wait();
+  EXPECT_TRUE(h.setup_error());
+  EXPECT_EQ(EINVAL, h.err().value);
+
+  NS::Template missing({"doesntexists_command"});
+  EXPECT_TRUE(missing.executable().empty());
+  auto h2 = missing.run_wait();
+  EXPECT_TRUE(h2.setup_error()); // ENOENT, or EACCES if a directory in PATH is not accessible
+
+  NS::Template path({"/doesntexists"});
+  auto h3 = path.run_wait();
+  EXPECT_TRUE(h3.setup_error());
+  EXPECT_EQ(ENOENT, h3.err().value);
+
+  NS::Template input({"cat"});
+  input.input("/doesntexists");
+  auto h4 = input.run_wait();
+  EXPECT_TRUE(h4.setup_error());
+  EXPECT_EQ(ENOENT, h4.err().value);
+} // Template.Errors
+} // empty namespace
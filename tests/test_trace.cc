@@ -0,0 +1,73 @@
+#include <unistd.h>
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/records.hpp>
+#include <noshell/trace.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+using namespace NS::literal;
+
+size_t count(const std::string& s, const std::string& what) {
+  size_t res = 0;
+  for(size_t pos = s.find(what); pos != std::string::npos; pos = s.find(what, pos + 1))
+    ++res;
+  return res;
+}
+
+std::string dump() {
+  std::ostringstream os;
+  EXPECT_TRUE(NS::trace::write_chrome_trace(os));
+  NS::trace::stop();
+  NS::trace::clear();
+  return os.str();
+}
+
+TEST(Trace, Commands) {
+  check_fixed_fds check_fds;
+
+  NS::trace::start();
+  NS::Exit e = "true"_C() | "/bin/sleep"_C("0.01");
+  EXPECT_TRUE(e.success());
+  const std::string json = dump();
+
+  EXPECT_EQ(0, json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+  EXPECT_EQ(2, count(json, "\"ph\":\"B\""));
+  EXPECT_EQ(2, count(json, "\"ph\":\"E\""));
+  EXPECT_EQ(2, count(json, "\"name\":\"exec\""));
+  EXPECT_NE(std::string::npos, json.find("\"name\":\"true\""));
+  EXPECT_NE(std::string::npos, json.find("\"name\":\"sleep\"")); // Without the directory
+  EXPECT_NE(std::string::npos, json.find("\"name\":\"sleep (" + std::to_string(e[1].pid) + ")\""));
+  EXPECT_EQ(2, count(json, "\"status\":0"));
+} // Trace.Commands
+
+TEST(Trace, Reads) {
+  check_fixed_fds check_fds;
+
+  NS::trace::start();
+  auto lines = NS::lines("seq"_C(1, 1000));
+  EXPECT_EQ(1000, std::distance(lines.begin(), lines.end()));
+  EXPECT_TRUE(lines.exit().success());
+  const std::string json = dump();
+  EXPECT_EQ(1, count(json, "\"name\":\"first byte\""));
+  EXPECT_LE(1, count(json, "\"name\":\"read\""));
+} // Trace.Reads
+
+TEST(Trace, Ring) {
+  check_fixed_fds check_fds;
+
+  // Only the last 4 events are kept
+  NS::trace::start(4);
+  for(int i = 0; i < 10; ++i)
+    EXPECT_TRUE(NS::Exit("true"_C()).success());
+  const std::string json = dump();
+  EXPECT_GE(4, count(json, "\"ph\":\"") - count(json, "\"ph\":\"M\""));
+
+  // Nothing recorded when not tracing
+  EXPECT_TRUE(NS::Exit("true"_C()).success());
+  EXPECT_EQ(0, count(dump(), "\"ph\":\""));
+} // Trace.Ring
+} // empty namespace
@@ -0,0 +1,91 @@
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <noshell/noshell.hpp>
+#include <noshell/xargs.hpp>
+#include "libtest_misc.hpp"
+
+namespace {
+namespace NS = noshell;
+static const char* tmpfile = "Xargs_tmp";
+
+TEST(Xargs, Arena) {
+  NS::argument_arena arena;
+  arena.push_back("hello");
+  arena.push_back(std::string(""));
+  arena.push_back("world", 3);
+  ASSERT_EQ((size_t)3, arena.size());
+  EXPECT_STREQ("hello", arena[0]);
+  EXPECT_EQ((size_t)0, arena.length(1));
+  EXPECT_STREQ("wor", arena[2]);
+  EXPECT_EQ((size_t)3, arena.length(2));
+} // Xargs.Arena
+
+TEST(Xargs, MaxArgs) {
+  check_fixed_fds check_fds;
+
+  std::vector<std::string> args;
+  std::string              expected;
+  for(int i = 0; i < 100; ++i) {
+    args.push_back(std::to_string(i));
+    expected += args.back() + '\n';
+  }
+  unlink(tmpfile);
+  NS::xargs_options opts;
+  opts.max_args = 7;
+  auto res = NS::xargs({"sh", "-c", std::string("for a; do echo \"$a\"; done >> ") + tmpfile, "sh"}, args, opts);
+  EXPECT_TRUE(res.success());
+  EXPECT_EQ((size_t)15, res.exits.size());
+  ASSERT_EQ((size_t)15, res.batches.size());
+  EXPECT_EQ((size_t)7, res.batches[1]);
+  EXPECT_EQ(expected, read_file(tmpfile));
+
+  // Braces are not placeholders
+  unlink(tmpfile);
+  const std::vector<std::string> braces{"a", "{b}"};
+  EXPECT_TRUE(NS::xargs({"sh", "-c", std::string("echo \"$0\" \"$@\" > ") + tmpfile, "{}"}, braces).success());
+  EXPECT_EQ("{} a {b}\n", read_file(tmpfile));
+} // Xargs.MaxArgs
+
+TEST(Xargs, ArgMax) {
+  check_fixed_fds check_fds;
+
+  // More than fits on one command line, counted by batches in parallel
+  const size_t       nb = 200000;
+  NS::argument_arena args;
+  for(size_t i = 0; i < nb; ++i)
+    args.push_back("/some/long/path/to/file_" + std::to_string(i));
+  unlink(tmpfile);
+  auto res = NS::xargs({"sh", "-c", std::string("echo $# >> ") + tmpfile, "sh"}, args, NS::xargs_options(4));
+  EXPECT_TRUE(res.success());
+  EXPECT_LT((size_t)1, res.exits.size());
+
+  std::ifstream is(tmpfile);
+  size_t        total = 0, count = 0, batches = 0;
+  while(is >> count) {
+    total += count;
+    ++batches;
+  }
+  EXPECT_EQ(nb, total);
+  EXPECT_EQ(res.exits.size(), batches);
+} // Xargs.ArgMax
+
+TEST(Xargs, TooBig) {
+  check_fixed_fds check_fds;
+
+  NS::xargs_options opts;
+  opts.max_bytes = 10;
+  auto res = NS::xargs({"true"}, std::vector<std::string>{"a", "b"}, opts);
+  EXPECT_FALSE(res.success());
+  EXPECT_EQ(E2BIG, res.error);
+  EXPECT_TRUE(res.exits.empty());
+
+  auto res2 = NS::xargs({"sh", "-c", "exit 1", "sh"}, std::vector<std::string>{"a", "b"}, NS::xargs_options(2));
+  EXPECT_FALSE(res2.success());
+  EXPECT_EQ(0, res2.error);
+  ASSERT_EQ((size_t)1, res2.exits.size());
+  EXPECT_EQ(1, res2.exits[0][0].status().exit_status());
+} // Xargs.TooBig
+} // empty namespace